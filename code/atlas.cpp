@@ -0,0 +1,188 @@
+#include "atlas.h"
+
+void
+InitAtlas(texture_atlas* Atlas, u32 Width, u32 Height)
+{
+    *Atlas = {};
+    Atlas->Texture.Width = Width;
+    Atlas->Texture.Height = Height;
+    Atlas->Texture.Memory = (u32*)calloc(Width*Height, sizeof(u32));
+
+    Atlas->Skyline[0] = {0, 0, Width};
+    Atlas->SkylineCount = 1;
+}
+
+// NOTE: Where the sprite would be if its left edge is at the start of
+// the segment. It rests on the highest segment below its width.
+internal b32
+FitSkyline(texture_atlas* Atlas, u32 SegmentIndex, u32 Width, u32 Height, u32* Y)
+{
+    atlas_skyline* Segment = Atlas->Skyline + SegmentIndex;
+    if((Segment->X + Width) > Atlas->Texture.Width)
+    {
+        return false;
+    }
+
+    u32 Top = 0;
+    u32 WidthLeft = Width;
+    for(u32 Index = SegmentIndex;
+        WidthLeft > 0;
+        ++Index)
+    {
+        Assert(Index < Atlas->SkylineCount);
+        Top = Max(Top, Atlas->Skyline[Index].Y);
+        if((Top + Height) > Atlas->Texture.Height)
+        {
+            return false;
+        }
+        WidthLeft -= Min(WidthLeft, Atlas->Skyline[Index].Width);
+    }
+
+    *Y = Top;
+    return true;
+}
+
+internal void
+RemoveSkyline(texture_atlas* Atlas, u32 SegmentIndex)
+{
+    for(u32 Index = SegmentIndex;
+        Index < (Atlas->SkylineCount - 1);
+        ++Index)
+    {
+        Atlas->Skyline[Index] = Atlas->Skyline[Index + 1];
+    }
+    --Atlas->SkylineCount;
+}
+
+// NOTE: Only reserves the space, the pixels are up to the caller.
+// Returns INVALID_ATLAS_SPRITE when the sprite doesn't fit anymore.
+u32
+PackAtlasSprite(texture_atlas* Atlas, u32 Width, u32 Height)
+{
+    u32 PaddedWidth = Width + ATLAS_PADDING;
+    u32 PaddedHeight = Height + ATLAS_PADDING;
+    if((Atlas->SpriteCount >= MAX_ATLAS_SPRITES) || (Atlas->SkylineCount >= MAX_ATLAS_SKYLINE))
+    {
+        return INVALID_ATLAS_SPRITE;
+    }
+
+    // NOTE: Lowest bottom wins, the narrower segment wins a tie
+    // so wide gaps stay open for wide sprites
+    u32 BestIndex = INVALID_ATLAS_SPRITE;
+    u32 BestY = 0;
+    u32 BestBottom = ~0u;
+    u32 BestWidth = ~0u;
+    for(u32 SegmentIndex = 0;
+        SegmentIndex < Atlas->SkylineCount;
+        ++SegmentIndex)
+    {
+        u32 Y;
+        if(FitSkyline(Atlas, SegmentIndex, PaddedWidth, PaddedHeight, &Y))
+        {
+            u32 Bottom = Y + PaddedHeight;
+            u32 SegmentWidth = Atlas->Skyline[SegmentIndex].Width;
+            if((Bottom < BestBottom) || ((Bottom == BestBottom) && (SegmentWidth < BestWidth)))
+            {
+                BestIndex = SegmentIndex;
+                BestY = Y;
+                BestBottom = Bottom;
+                BestWidth = SegmentWidth;
+            }
+        }
+    }
+
+    if(BestIndex == INVALID_ATLAS_SPRITE)
+    {
+        return INVALID_ATLAS_SPRITE;
+    }
+
+    u32 X = Atlas->Skyline[BestIndex].X;
+    for(u32 Index = Atlas->SkylineCount;
+        Index > BestIndex;
+        --Index)
+    {
+        Atlas->Skyline[Index] = Atlas->Skyline[Index - 1];
+    }
+    Atlas->Skyline[BestIndex] = {X, BestBottom, PaddedWidth};
+    ++Atlas->SkylineCount;
+
+    // NOTE: The segments under the new one are cut back to where it ends
+    u32 SegmentIndex = BestIndex + 1;
+    while(SegmentIndex < Atlas->SkylineCount)
+    {
+        atlas_skyline* Previous = Atlas->Skyline + SegmentIndex - 1;
+        atlas_skyline* Segment = Atlas->Skyline + SegmentIndex;
+        u32 PreviousEnd = Previous->X + Previous->Width;
+        if(Segment->X >= PreviousEnd)
+        {
+            break;
+        }
+
+        u32 Shrink = PreviousEnd - Segment->X;
+        if(Segment->Width > Shrink)
+        {
+            Segment->X += Shrink;
+            Segment->Width -= Shrink;
+            break;
+        }
+        RemoveSkyline(Atlas, SegmentIndex);
+    }
+
+    for(u32 Index = 0;
+        (Index + 1) < Atlas->SkylineCount;
+        )
+    {
+        if(Atlas->Skyline[Index].Y == Atlas->Skyline[Index + 1].Y)
+        {
+            Atlas->Skyline[Index].Width += Atlas->Skyline[Index + 1].Width;
+            RemoveSkyline(Atlas, Index + 1);
+        }
+        else
+        {
+            ++Index;
+        }
+    }
+
+    r32 AtlasWidth = (r32)Atlas->Texture.Width;
+    r32 AtlasHeight = (r32)Atlas->Texture.Height;
+
+    u32 Result = Atlas->SpriteCount++;
+    atlas_sprite* Sprite = Atlas->Sprites + Result;
+    Sprite->X = X;
+    Sprite->Y = BestY;
+    Sprite->Width = Width;
+    Sprite->Height = Height;
+    Sprite->UVRect = V4(X / AtlasWidth, BestY / AtlasHeight, (X + Width) / AtlasWidth, (BestY + Height) / AtlasHeight);
+
+    Atlas->UsedArea += Width*Height;
+
+    return Result;
+}
+
+// NOTE: Occupancy is the part of the atlas covered by sprites. Fragmentation
+// is the part under the skyline that isn't, padding included.
+atlas_usage
+GetAtlasUsage(texture_atlas* Atlas)
+{
+    u32 SkylineArea = 0;
+    for(u32 SegmentIndex = 0;
+        SegmentIndex < Atlas->SkylineCount;
+        ++SegmentIndex)
+    {
+        SkylineArea += Atlas->Skyline[SegmentIndex].Width*Atlas->Skyline[SegmentIndex].Y;
+    }
+
+    atlas_usage Result = {};
+    Result.SpriteCount = Atlas->SpriteCount;
+    Result.Occupancy = (r32)Atlas->UsedArea / (r32)(Atlas->Texture.Width*Atlas->Texture.Height);
+    Result.Fragmentation = SkylineArea ? (1.0f - ((r32)Atlas->UsedArea / (r32)SkylineArea)) : 0.0f;
+
+    return Result;
+}
+
+void
+DestroyAtlas(texture_atlas* Atlas)
+{
+    free(Atlas->Texture.Memory);
+    *Atlas = {};
+}
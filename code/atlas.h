@@ -0,0 +1,62 @@
+#if !defined(ATLAS_H_)
+
+#include "intrinsics.h"
+#include "hmath.h"
+#include "display.h"
+
+// NOTE: Sprites are packed into one texture with a skyline packer. The
+// skyline is the top edge of everything packed so far, a sprite goes
+// where its bottom lands lowest. Space under the skyline that no sprite
+// covers can't be used anymore, GetAtlasUsage reports it as fragmentation.
+#define MAX_ATLAS_SKYLINE 256
+#define MAX_ATLAS_SPRITES 256
+#define INVALID_ATLAS_SPRITE (~0u)
+
+// NOTE: Empty texels on the right and the top of every
+// sprite, so linear filtering doesn't bleed into the next one
+#define ATLAS_PADDING 1
+
+struct atlas_skyline
+{
+    u32 X;
+    u32 Y;
+    u32 Width;
+};
+
+struct atlas_sprite
+{
+    u32 X;
+    u32 Y;
+    u32 Width;
+    u32 Height;
+
+    // NOTE: Min in xy and max in zw, the same as quad_instance
+    v4 UVRect;
+};
+
+struct atlas_usage
+{
+    u32 SpriteCount;
+    r32 Occupancy;
+    r32 Fragmentation;
+};
+
+struct texture_atlas
+{
+    texture_t Texture;
+
+    atlas_skyline Skyline[MAX_ATLAS_SKYLINE];
+    u32 SkylineCount;
+
+    atlas_sprite Sprites[MAX_ATLAS_SPRITES];
+    u32 SpriteCount;
+    u32 UsedArea;
+};
+
+void InitAtlas(texture_atlas* Atlas, u32 Width, u32 Height);
+u32 PackAtlasSprite(texture_atlas* Atlas, u32 Width, u32 Height);
+atlas_usage GetAtlasUsage(texture_atlas* Atlas);
+void DestroyAtlas(texture_atlas* Atlas);
+
+#define ATLAS_H_
+#endif
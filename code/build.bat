@@ -15,6 +15,14 @@ set CommonLinkFlags=-opt:ref -incremental:no /NODEFAULTLIB:msvcrt /SUBSYSTEM:CON
 
 call glslangValidator --target-env vulkan1.2 ..\shaders\mesh.vert.glsl -V -o ..\shaders\mesh.vert.spv
 call glslangValidator --target-env vulkan1.2 ..\shaders\mesh.frag.glsl -V -o ..\shaders\mesh.frag.spv
+call glslangValidator --target-env vulkan1.2 ..\shaders\upscale.frag.glsl -V -o ..\shaders\upscale.frag.spv
+call glslangValidator --target-env vulkan1.2 ..\shaders\quad.vert.glsl -V -o ..\shaders\quad.vert.spv
+call glslangValidator --target-env vulkan1.2 ..\shaders\quad.frag.glsl -V -o ..\shaders\quad.frag.spv
+call glslangValidator --target-env vulkan1.2 ..\shaders\text.frag.glsl -V -o ..\shaders\text.frag.spv
+call glslangValidator --target-env vulkan1.2 ..\shaders\board.vert.glsl -V -o ..\shaders\board.vert.spv
+call glslangValidator --target-env vulkan1.2 ..\shaders\board.frag.glsl -V -o ..\shaders\board.frag.spv
+call glslangValidator --target-env vulkan1.2 ..\shaders\raster.comp.glsl -V -o ..\shaders\raster.comp.spv
+call glslangValidator --target-env vulkan1.2 ..\shaders\cull.comp.glsl -V -o ..\shaders\cull.comp.spv
 
 if not exist ..\build mkdir ..\build
 pushd ..\build
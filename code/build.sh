@@ -0,0 +1,20 @@
+#!/bin/sh
+# NOTE: Linux counterpart of build.bat, run from the code directory.
+# Needs the SDL2 and Vulkan development packages and glslangValidator.
+
+CommonCompileFlags="-std=c++17 -g -O0 -ffast-math -fno-rtti -DCHESS_DEBUG=1 -Wall -Wno-unused-parameter -Wno-unused-function -Wno-missing-braces"
+CommonLinkFlags="-lSDL2 -lvulkan -lpthread"
+
+set -e
+
+for Shader in mesh.vert mesh.frag upscale.frag quad.vert quad.frag text.frag board.vert board.frag raster.comp cull.comp
+do
+    glslangValidator --target-env vulkan1.2 ../shaders/$Shader.glsl -V -o ../shaders/$Shader.spv
+done
+
+mkdir -p ../build
+cd ../build
+
+c++ $CommonCompileFlags -c ../code/display.cpp -o display.o
+c++ $CommonCompileFlags -c ../code/vulkan_renderer.cpp -o vulkan_renderer.o
+c++ $CommonCompileFlags ../code/main.cpp display.o vulkan_renderer.o -o chess $CommonLinkFlags
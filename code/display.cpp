@@ -8,9 +8,12 @@ SDL_Renderer*   renderer        = NULL;
 SDL_Texture*    texture         = NULL;
 texture_t*      ColorBuffer     = NULL;
 
-bool InitWindow(void)
+// NOTE: Without a window only the timer and events are used,
+// the frames are rendered offscreen by the vulkan renderer
+bool InitWindow(bool ShouldCreateWindow)
 {
-    if(SDL_Init(SDL_INIT_EVERYTHING) != 0)
+    u32 Subsystems = ShouldCreateWindow ? SDL_INIT_EVERYTHING : (SDL_INIT_TIMER|SDL_INIT_EVENTS);
+    if(SDL_Init(Subsystems) != 0)
     {
         fprintf(stderr, "Error: initializing SDL\n");
         return false;
@@ -19,7 +22,7 @@ bool InitWindow(void)
     SDL_DisplayMode display_mode;
     SDL_GetCurrentDisplayMode(0, &display_mode);
 
-    ColorBuffer = (texture_t*)calloc(1, sizeof(ColorBuffer));
+    ColorBuffer = (texture_t*)calloc(1, sizeof(texture_t));
 
 #if 0
     // NOTE: Resize window on whole display
@@ -30,7 +33,12 @@ bool InitWindow(void)
     ColorBuffer->Height = 512;
 #endif
 
-    window = SDL_CreateWindow(NULL, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, ColorBuffer->Width, ColorBuffer->Height, SDL_WINDOW_SHOWN);//|SDL_WINDOW_BORDERLESS);
+    if(!ShouldCreateWindow)
+    {
+        return true;
+    }
+
+    window = SDL_CreateWindow(NULL, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, ColorBuffer->Width, ColorBuffer->Height, SDL_WINDOW_SHOWN|SDL_WINDOW_RESIZABLE);//|SDL_WINDOW_BORDERLESS);
     if(!window)
     {
         fprintf(stderr, "Error: creating SDL window");
@@ -301,22 +309,16 @@ CircleLinePoints(texture_t* Texture, v2 C, v2 P, u32 Color)
     DrawLine(Texture, V2(C.x + P.y, C.y - P.x), V2(C.x - P.y, C.y - P.x), Color);
 }
 
-void
-DrawCircle(v2 P, u32 Width, u32 Height, r32 Radius, r32 Rotation, u32 Color)
+// NOTE: Midpoint circle, the GPU rasterizer walks the same steps
+// in CircleCovers, so keep both of them in sync
+internal void
+RasterCircle(texture_t* Texture, v2 C, r32 Radius, u32 Color, bool Filled)
 {
-    texture_t CircleTexture = {};
-
-    CircleTexture.Width = Width;
-    CircleTexture.Height = Height;
-    CircleTexture.Memory = (u32*)calloc(Width*Height, sizeof(u32));
-
-    v2 TextureOrigin = V2i((Width / 2) - 1, (Height / 2) - 1);
-    v2 TextureOriginN = TextureOrigin * V2(1/(r32)Width, 1/(r32)Height);
-
     i32 X = 0;
     i32 Y = (i32)Radius;
     i32 d = 3 - 2*(i32)Radius;
-    CirclePoints(&CircleTexture, TextureOrigin, V2i(X, Y), Color);
+    if(Filled) CircleLinePoints(Texture, C, V2i(X, Y), Color);
+    else       CirclePoints(Texture, C, V2i(X, Y), Color);
     while(X <= Y)
     {
         if(d <= 0)
@@ -329,104 +331,235 @@ DrawCircle(v2 P, u32 Width, u32 Height, r32 Radius, r32 Rotation, u32 Color)
             Y--;
         }
         X++;
-        CirclePoints(&CircleTexture, TextureOrigin, V2i(X, Y), Color);
+        if(Filled) CircleLinePoints(Texture, C, V2i(X, Y), Color);
+        else       CirclePoints(Texture, C, V2i(X, Y), Color);
     }
+}
+
+// NOTE: The circle is centered in a transparent texture, it is
+// meant to be packed into an atlas once and tinted when drawn
+texture_t*
+CreateCircleTexture(u32 Width, u32 Height, r32 Radius, u32 Color, bool Filled)
+{
+    texture_t* Result = (texture_t*)malloc(sizeof(texture_t));
+
+    Result->Width = Width;
+    Result->Height = Height;
+    Result->Memory = (u32*)calloc(Width*Height, sizeof(u32));
+
+    v2 TextureOrigin = V2i((Width / 2) - 1, (Height / 2) - 1);
+    RasterCircle(Result, TextureOrigin, Radius, Color, Filled);
+
+    return Result;
+}
+
+void
+DrawCircle(v2 P, u32 Width, u32 Height, r32 Radius, r32 Rotation, u32 Color)
+{
+    texture_t* CircleTexture = CreateCircleTexture(Width, Height, Radius, Color, false);
+
+    v2 TextureOrigin = V2i((Width / 2) - 1, (Height / 2) - 1);
     v2 LineMax = V2(Radius, 0.0f);
     LineMax = TextureOrigin + rotate(LineMax, Rotation);
-    DrawLine(&CircleTexture, TextureOrigin, LineMax, Color);
+    DrawLine(CircleTexture, TextureOrigin, LineMax, Color);
 
     v2 XAxis = Width*V2(1, 0);
     v2 YAxis = Height*V2(0, 1);
 
-    DrawRotRect(ColorBuffer, P, XAxis, YAxis, Color, &CircleTexture);
+    DrawRotRect(ColorBuffer, P, XAxis, YAxis, Color, CircleTexture);
+    DestroyTexture(CircleTexture);
 }
 
 void
 DrawFilledCircle(v2 P, u32 Width, u32 Height, r32 Radius, u32 Color)
 {
-    texture_t BallTexture = {};
+    texture_t* BallTexture = CreateCircleTexture(Width, Height, Radius, Color, true);
 
-    BallTexture.Width = Width;
-    BallTexture.Height = Height;
-    BallTexture.Memory = (u32*)calloc(Width*Height, sizeof(u32));
+    v2 XAxis = Width*V2(1, 0);
+    v2 YAxis = Height*V2(0, 1);
 
-    v2 TextureOrigin = V2i((Width / 2) - 1, (Height / 2) - 1);
-    v2 TextureOriginN = TextureOrigin * V2(1/(r32)Width, 1/(r32)Height);
+    DrawRotRect(ColorBuffer, P, XAxis, YAxis, Color, BallTexture);
+    DestroyTexture(BallTexture);
+}
 
-    i32 X = 0;
-    i32 Y = (i32)Radius;
-    i32 d = 3 - 2*(i32)Radius;
-    CircleLinePoints(&BallTexture, TextureOrigin, V2i(X, Y), Color);
-    while(X <= Y)
+void
+DrawPolygon(v2 P, std::vector<v2> Vertices, u32 Color)
+{
+    for(u32 PIndex = 0;
+        PIndex < Vertices.size();
+        ++PIndex)
     {
-        if(d <= 0)
-        {
-            d = d + 4*X + 6;
-        }
-        else
-        {
-            d = d + 4*X - 4*Y + 10;
-            Y--;
-        }
-        X++;
-        CircleLinePoints(&BallTexture, TextureOrigin, V2i(X, Y), Color);
+        i32 CurrIndex = PIndex;
+        i32 NextIndex = (PIndex + 1) % Vertices.size();
+        DrawLine(ColorBuffer, Vertices[CurrIndex], Vertices[NextIndex], Color);
     }
-
-    v2 XAxis = Width*V2(1, 0);
-    v2 YAxis = Height*V2(0, 1);
-
-    DrawRotRect(ColorBuffer, P, XAxis, YAxis, Color, &BallTexture);
 }
 
-internal texture_t*
-FromGlyphToTexture(glyph_t* Glyph)
+internal raster_command*
+PushRasterCommand(raster_commands* Commands, raster_command_type Type, u32 Color)
 {
-    texture_t* Result = (texture_t*)malloc(sizeof(texture_t));
+    raster_command* Result = 0;
+    if(Commands->Count < Commands->MaxCount)
+    {
+        Result = Commands->Base + Commands->Count++;
+        *Result = {};
+        Result->Type  = Type;
+        Result->Color = Color;
+    }
+    return Result;
+}
 
-    Result->Width = Glyph->Width;
-    Result->Height = Glyph->Height;
-    Result->Memory = Glyph->Memory;
+void
+PushClear(raster_commands* Commands, u32 Color)
+{
+    raster_command* Command = PushRasterCommand(Commands, RasterCommand_Clear, Color);
+    if(Command)
+    {
+        Command->MinX = 0;
+        Command->MinY = 0;
+        Command->MaxX = INT32_MAX;
+        Command->MaxY = INT32_MAX;
+    }
+}
 
-    return Result;
+void
+PushRect(raster_commands* Commands, v2 Min, v2 Max, u32 Color)
+{
+    raster_command* Command = PushRasterCommand(Commands, RasterCommand_Rect, Color);
+    if(Command)
+    {
+        // NOTE: DrawRect truncates to unsigned, so negative corners are clamped here
+        Min = V2(Max(0, Min.x), Max(0, Min.y));
+        Max = V2(Max(0, Max.x), Max(0, Max.y));
+
+        Command->Origin = Min;
+        Command->XAxis  = Max;
+        Command->MinX = (i32)Min.x;
+        Command->MinY = (i32)Min.y;
+        Command->MaxX = (i32)Max.x;
+        Command->MaxY = (i32)Max.y;
+    }
 }
 
-#if 0
 void
-PutText(v2 P, std::string Text, font_t* Font, v4 Color)
+PushRotRect(raster_commands* Commands, v2 Origin, v2 XAxis, v2 YAxis, u32 Color)
 {
-    u32 PutOffset = 0;
-    for(u32 CharIndex = 0;
-        CharIndex < Text.size();
-        ++CharIndex)
+    raster_command* Command = PushRasterCommand(Commands, RasterCommand_RotRect, Color);
+    if(Command)
     {
-        u8 Char = Text.c_str()[CharIndex];
-        glyph_t* CharacterFont = Font->at(Char);
-        texture_t* TextureToRender = FromGlyphToTexture(CharacterFont);
+        Command->Origin = Origin;
+        Command->XAxis  = XAxis;
+        Command->YAxis  = YAxis;
+
+        Command->MinX = INT32_MAX;
+        Command->MinY = INT32_MAX;
+        Command->MaxX = INT32_MIN;
+        Command->MaxY = INT32_MIN;
+
+        v2 Ps[] = {Origin, Origin + XAxis, Origin + XAxis + YAxis, Origin + YAxis};
+        for(u32 PIndex = 0;
+            PIndex < 4;
+            ++PIndex)
+        {
+            v2 P = Ps[PIndex];
+
+            i32 FloorX = (i32)floorf(P.x);
+            i32 CeilX =  (i32)ceilf(P.x);
+            i32 FloorY = (i32)floorf(P.y);
+            i32 CeilY =  (i32)ceilf(P.y);
 
-        v2 StartPoint = P + V2(PutOffset, CharacterFont->OffsetY);
-        v2 Width  = V2(CharacterFont->Width, 0);
-        v2 Height = V2(0, CharacterFont->Height);
-        DrawRotRect(ColorBuffer, StartPoint, Width, Height, PackBGRA(Color), TextureToRender);
-        PutOffset += (CharacterFont->Width != 0) ? (CharacterFont->Width + 2) : (CharacterFont->FontSize / 2);
+            if(Command->MinX > FloorX) {Command->MinX = FloorX;}
+            if(Command->MaxX < CeilX)  {Command->MaxX = CeilX;}
+            if(Command->MinY > FloorY) {Command->MinY = FloorY;}
+            if(Command->MaxY < CeilY)  {Command->MaxY = CeilY;}
+        }
+
+        // NOTE: Same expressions as in DrawRotRect
+        r32 Det = XAxis.x*YAxis.y - XAxis.y*YAxis.x;
+        if(Det == 0.0f){ Det = 1.0f; }
 
-        free(TextureToRender);
+        Command->InvXAxis = { YAxis.y/Det, -YAxis.x/Det};
+        Command->InvYAxis = {-XAxis.y/Det,  XAxis.x/Det};
     }
 }
-#endif
 
 void
-DrawPolygon(v2 P, std::vector<v2> Vertices, u32 Color)
+PushCircle(raster_commands* Commands, v2 Center, r32 Radius, u32 Color, bool Filled)
 {
-    for(u32 PIndex = 0;
-        PIndex < Vertices.size();
-        ++PIndex)
+    raster_command* Command = PushRasterCommand(Commands, Filled ? RasterCommand_FilledCircle : RasterCommand_Circle, Color);
+    if(Command)
     {
-        i32 CurrIndex = PIndex;
-        i32 NextIndex = (PIndex + 1) % Vertices.size();
-        DrawLine(ColorBuffer, Vertices[CurrIndex], Vertices[NextIndex], Color);
+        // NOTE: The midpoint steps are integers, so the center is snapped
+        // to a pixel to keep both backends on the same pixels
+        Center = V2(roundf(Center.x), roundf(Center.y));
+        i32 R = (i32)Radius;
+
+        Command->Radius = Radius;
+        Command->Origin = Center;
+        Command->MinX = (i32)Center.x - R - 1;
+        Command->MinY = (i32)Center.y - R - 1;
+        Command->MaxX = (i32)Center.x + R + 2;
+        Command->MaxY = (i32)Center.y + R + 2;
     }
 }
 
+// NOTE: CPU backend of the command stream, every command is opaque
+// and overwrites the pixels it covers in order
+void
+ExecuteRasterCommands(texture_t* Target, raster_commands* Commands)
+{
+    for(u32 CommandIndex = 0;
+        CommandIndex < Commands->Count;
+        ++CommandIndex)
+    {
+        raster_command* Command = Commands->Base + CommandIndex;
+        switch(Command->Type)
+        {
+            case RasterCommand_Clear:
+            {
+                ClearColorBuffer(Target, Command->Color);
+            } break;
+            case RasterCommand_Rect:
+            {
+                DrawRect(Target, Command->Origin, Command->XAxis, Command->Color);
+            } break;
+            case RasterCommand_RotRect:
+            {
+                DrawRotRect(Target, Command->Origin, Command->XAxis, Command->YAxis, Command->Color, nullptr);
+            } break;
+            case RasterCommand_Circle:
+            case RasterCommand_FilledCircle:
+            {
+                RasterCircle(Target, Command->Origin, Command->Radius, Command->Color, Command->Type == RasterCommand_FilledCircle);
+            } break;
+        }
+    }
+}
+
+void
+SetCamera(camera* Camera, v2 P, r32 Scale, v2 ScreenSize)
+{
+    Camera->P = P;
+    Camera->Scale = Scale;
+    Camera->Area = RectangleCenterDim(P, ScreenSize / Scale);
+}
+
+// NOTE: The world position under ScreenP stays where it is
+void
+ZoomCamera(camera* Camera, v2 ScreenP, r32 Scale, v2 ScreenSize)
+{
+    v2 WorldP = Camera->Area.Min + ScreenP / Camera->Scale;
+    v2 Min = WorldP - ScreenP / Scale;
+    SetCamera(Camera, Min + 0.5f*ScreenSize / Scale, Scale, ScreenSize);
+}
+
+v2
+CameraToScreen(camera* Camera, v2 P)
+{
+    v2 Result = (P - Camera->Area.Min) * Camera->Scale;
+    return Result;
+}
+
 void DestroyTexture(texture_t* Texture)
 {
     free(Texture->Memory);
@@ -14,17 +14,115 @@ struct texture_t
     u32* Memory;
 };
 
-struct glyph_t
+// NOTE: Shapes are signed distance functions in quad.frag.glsl,
+// they need no texture and stay sharp at any size
+enum quad_shape
 {
-    u32 Width;
-    u32 Height;
-    i32 OffsetX;
-    i32 OffsetY;
-    i32 FontSize;
+    QuadShape_None,
+    QuadShape_Disc,
+    QuadShape_Ring,
+    QuadShape_Crown,
+};
 
-    u32* Memory;
+// NOTE: Layout of one instance in the quad storage buffer,
+// it has to match quad_instance in quad.vert.glsl (std430).
+// Shapes ignore the UVRect, ShapeParam is the ring thickness
+// as a fraction of the radius.
+struct quad_instance
+{
+    v2 P;
+    v2 Size;
+    v4 UVRect;
+
+    r32 Rotation;
+    u32 Color;
+
+    u32 Shape;
+    r32 ShapeParam;
 };
 
+// NOTE: How an entity type is drawn as a quad
+struct quad_style
+{
+    v4 UVRect;
+    u32 Shape;
+    r32 ShapeParam;
+};
+
+#define MAX_QUAD_INSTANCES 1024
+
+// NOTE: Push constants of the board pass, it has to match
+// the block in board.frag.glsl. Highlights are one bit per square,
+// so only boards up to 64 squares can be highlighted.
+struct board_constants
+{
+    v4 LightColor;
+    v4 DarkColor;
+    v4 GridColor;
+    v4 HighlightColor;
+
+    v2 ScreenSize;
+    v2 BoardMin;
+    v2 BoardSize;
+
+    u32 Cols;
+    u32 Rows;
+    r32 GridWidth;
+    u32 Pad;
+
+    u32 HighlightMask[2];
+};
+
+// NOTE: The opaque primitives of the software rasterizer as a command
+// stream, so the same frame can be rasterized by ExecuteRasterCommands
+// on the CPU or by raster.comp.glsl on the GPU. It has to match
+// raster_command in raster.comp.glsl (std430).
+enum raster_command_type
+{
+    RasterCommand_Clear,
+    RasterCommand_Rect,
+    RasterCommand_RotRect,
+    RasterCommand_Circle,
+    RasterCommand_FilledCircle,
+};
+
+struct raster_command
+{
+    u32 Type;
+    u32 Color;
+    r32 Radius;
+    u32 Pad;
+
+    // NOTE: Pixel bounds before clamping to the target, max is exclusive
+    i32 MinX;
+    i32 MinY;
+    i32 MaxX;
+    i32 MaxY;
+
+    // NOTE: Rect uses Origin as min and XAxis as max,
+    // circles use Origin as the center
+    v2 Origin;
+    v2 XAxis;
+    v2 YAxis;
+
+    // NOTE: Inverse axes are computed once on the CPU, so
+    // both backends test pixels against the same values
+    v2 InvXAxis;
+    v2 InvYAxis;
+};
+
+struct raster_commands
+{
+    raster_command* Base;
+    u32 Count;
+    u32 MaxCount;
+};
+
+#define MAX_RASTER_COMMANDS 4096
+
+// NOTE: P is the center of the view in world pixels and Scale is screen
+// pixels per world pixel. Area is the visible part of the world, it is
+// derived from both by SetCamera.
 struct camera
 {
     rectangle2 Area;
@@ -37,7 +135,7 @@ extern SDL_Renderer*    renderer;
 extern SDL_Texture*     texture;
 extern texture_t*       ColorBuffer;
 
-bool InitWindow();
+bool InitWindow(bool ShouldCreateWindow = true);
 void RenderColorBuffer();
 void ClearColorBuffer(texture_t* Texture, u32);
 void DrawPixel(texture_t* Texture, u32, u32, u32);
@@ -45,10 +143,19 @@ void DrawGrid(texture_t* Texture, u32);
 void DrawLine(texture_t* Texture, v2 Min, v2 Max, u32 Color);
 void DrawRect(texture_t* RenderBuffer, v2, v2, u32);
 void DrawRotRect(texture_t* RenderBuffer, v2 Origin, v2 XAxis, v2 YAxis, u32 color, texture_t* Texture);
+texture_t* CreateCircleTexture(u32 Width, u32 Height, r32 Radius, u32 Color, bool Filled);
 void DrawCircle(v2 P, u32 Width, u32 Height, r32 Radius, r32 Rotation, u32 Color);
 void DrawFilledCircle(v2 P, u32 Width, u32 Height, r32 R, u32 Color);
-//void PutText(v2 P, std::string Text, font_t* Font, v4 Color);
 void DrawPolygon(v2 P, std::vector<v2> Vertices, u32 Color);
+void PushClear(raster_commands* Commands, u32 Color);
+void PushRect(raster_commands* Commands, v2 Min, v2 Max, u32 Color);
+void PushRotRect(raster_commands* Commands, v2 Origin, v2 XAxis, v2 YAxis, u32 Color);
+void PushCircle(raster_commands* Commands, v2 Center, r32 Radius, u32 Color, bool Filled);
+void ExecuteRasterCommands(texture_t* Target, raster_commands* Commands);
+void SetCamera(camera* Camera, v2 P, r32 Scale, v2 ScreenSize);
+void ZoomCamera(camera* Camera, v2 ScreenP, r32 Scale, v2 ScreenSize);
+v2 CameraToScreen(camera* Camera, v2 P);
+void DestroyTexture(texture_t* Texture);
 void DestroyWindow();
 
 
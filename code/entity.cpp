@@ -1,131 +1,368 @@
+#include <emmintrin.h>
 #include "entity.h"
 
+// NOTE: Grows every array to at least Count entities, doubling so that
+// creating entities one by one only reallocates a few times
 void
-CreateEntity(world* World, v2 Position, v2 Velocity, u32 Width, u32 Height, entity_type Type, u32 Color)
+ReserveEntities(entity_storage* Storage, u32 Count)
 {
-    entity_storage* StorageToUpdate = World->EntityStorage;
-    entity_storage* StorageToGetFrom = World->RemovedEntityStorage;
-
-    if (StorageToUpdate->EntityCount == 0)
+    if (Count <= Storage->Capacity)
     {
-        StorageToUpdate->Entities = (entity*)malloc(sizeof(entity));
+        return;
     }
 
-    // TODO: Fetching from the "StorageToGetFrom" 
-    // should be better that this, I believe?
-    entity NewEntity = {};
-    u32 NewEntityID;
-    if (StorageToGetFrom->EntityCount > 0)
+    u32 NewCapacity = Max(Storage->Capacity * 2, (u32)MIN_ENTITY_CAPACITY);
+    while (NewCapacity < Count)
     {
-        NewEntity = StorageToGetFrom->Entities[--StorageToGetFrom->EntityCount];
-        NewEntityID = NewEntity.ID;
+        NewCapacity *= 2;
+    }
 
-        NewEntity.Component->P      = Position;
-        NewEntity.Component->dP     = Velocity;
-        NewEntity.Component->Width  = Width;
-        NewEntity.Component->Height = Height;
-        NewEntity.Component->Type   = Type;
-        NewEntity.Component->Color  = Color;
+    Storage->Handles = (entity_handle*)realloc(Storage->Handles, NewCapacity * sizeof(entity_handle));
+    Storage->P       = (v2*)realloc(Storage->P, NewCapacity * sizeof(v2));
+    Storage->dP      = (v2*)realloc(Storage->dP, NewCapacity * sizeof(v2));
+    Storage->Size    = (v2*)realloc(Storage->Size, NewCapacity * sizeof(v2));
+    Storage->Color   = (u32*)realloc(Storage->Color, NewCapacity * sizeof(u32));
+    Storage->Capacity = NewCapacity;
+}
 
-        NewEntity.Component->StorageIndex = StorageToUpdate->EntityCount;
+// NOTE: Slots are only added when the free list is empty, so the
+// free list never needs more room than there are slots
+internal u32
+AllocateEntitySlot(entity_storage* Storage)
+{
+    if (Storage->FreeSlotCount > 0)
+    {
+        return Storage->FreeSlots[--Storage->FreeSlotCount];
     }
-    else
+
+    Assert(Storage->SlotCount <= ENTITY_SLOT_MASK);
+    if (Storage->SlotCount == Storage->SlotCapacity)
     {
-        NewEntityID = StorageToUpdate->EntityCount;
-        entity_component* NewEntityComponent = (entity_component*)calloc(1, sizeof(entity_component));
+        Storage->SlotCapacity = Max(Storage->SlotCapacity * 2, (u32)MIN_ENTITY_CAPACITY);
+        Storage->DenseIndices = (u32*)realloc(Storage->DenseIndices, Storage->SlotCapacity * sizeof(u32));
+        Storage->Generations  = (u32*)realloc(Storage->Generations, Storage->SlotCapacity * sizeof(u32));
+        Storage->FreeSlots    = (u32*)realloc(Storage->FreeSlots, Storage->SlotCapacity * sizeof(u32));
+    }
 
-        NewEntityComponent->P      = Position;
-        NewEntityComponent->dP     = Velocity;
-        NewEntityComponent->Width  = Width;
-        NewEntityComponent->Height = Height;
-        NewEntityComponent->Type   = Type;
-        NewEntityComponent->Color  = Color;
+    u32 Slot = Storage->SlotCount++;
+    Storage->Generations[Slot] = 1;
+    return Slot;
+}
 
-        NewEntity.Component = NewEntityComponent;
+internal void
+MoveEntity(entity_storage* Storage, u32 From, u32 To)
+{
+    Storage->Handles[To] = Storage->Handles[From];
+    Storage->P[To]       = Storage->P[From];
+    Storage->dP[To]      = Storage->dP[From];
+    Storage->Size[To]    = Storage->Size[From];
+    Storage->Color[To]   = Storage->Color[From];
+    Storage->DenseIndices[GetEntitySlot(Storage->Handles[To])] = To;
+}
 
-        NewEntity.ID = NewEntityID;
+// NOTE: A new archetype goes after all of the others, where the arrays end
+internal u32
+GetArchetype(entity_storage* Storage, entity_type Type, u32 Flags)
+{
+    for (u32 ArchetypeIndex = 0;
+        ArchetypeIndex < Storage->ArchetypeCount;
+        ++ArchetypeIndex)
+    {
+        entity_archetype* Archetype = Storage->Archetypes + ArchetypeIndex;
+        if ((Archetype->Type == Type) && (Archetype->Flags == Flags))
+        {
+            return ArchetypeIndex;
+        }
+    }
 
-        NewEntity.Component->StorageIndex = StorageToUpdate->EntityCount;
+    Assert(Storage->ArchetypeCount < MAX_ENTITY_ARCHETYPES);
+    Storage->Archetypes[Storage->ArchetypeCount] = {Type, Flags, Storage->EntityCount, 0};
+    return Storage->ArchetypeCount++;
+}
 
-        // NOTE: This is a bad thing here? 
-        // I should think about a better solution here
-        StorageToUpdate->Entities = (entity*)realloc(StorageToUpdate->Entities, sizeof(entity) * (StorageToUpdate->EntityCount + 1));
+internal u32
+GetArchetypeOfEntity(entity_storage* Storage, u32 EntityIndex)
+{
+    u32 Result = Storage->ArchetypeCount;
+    for (u32 ArchetypeIndex = 0;
+        ArchetypeIndex < Storage->ArchetypeCount;
+        ++ArchetypeIndex)
+    {
+        entity_archetype* Archetype = Storage->Archetypes + ArchetypeIndex;
+        if ((EntityIndex >= Archetype->First) && (EntityIndex < (Archetype->First + Archetype->Count)))
+        {
+            Result = ArchetypeIndex;
+            break;
+        }
     }
 
-    StorageToUpdate->Entities[StorageToUpdate->EntityCount++] = NewEntity;
+    Assert(Result < Storage->ArchetypeCount);
+    return Result;
 }
 
-// NOTE: Do I really want to remove Entities by their ID
-// Maybe create another function to remove entities directly
-void
-RemoveEntityByID(world* World, u32 EntityID)
+// NOTE: Makes room at the end of the archetype. The free entity at the end
+// of the arrays walks back to it, the first entity of every archetype in
+// between moves to the end of its own archetype to make that room.
+internal u32
+InsertEntity(entity_storage* Storage, u32 ArchetypeIndex)
 {
-    entity_storage* StorageInUse = World->EntityStorage;
-    entity_storage* StorageToStore = World->RemovedEntityStorage;
+    ReserveEntities(Storage, Storage->EntityCount + 1);
 
-    if (StorageToStore->EntityCount == 0)
+    u32 EntityIndex = Storage->EntityCount++;
+    for (u32 Index = Storage->ArchetypeCount - 1;
+        Index > ArchetypeIndex;
+        --Index)
     {
-        StorageToStore->Entities = (entity*)malloc(sizeof(entity));
+        entity_archetype* Archetype = Storage->Archetypes + Index;
+        if (Archetype->Count)
+        {
+            MoveEntity(Storage, Archetype->First, EntityIndex);
+        }
+        EntityIndex = Archetype->First++;
     }
 
-    entity EntityToRemove;
-    entity EntityToMove = StorageInUse->Entities[--StorageInUse->EntityCount];
+    ++Storage->Archetypes[ArchetypeIndex].Count;
+    ++Storage->ChangeCount;
+    return EntityIndex;
+}
+
+// NOTE: The other way around, the last entity of the archetype fills the
+// hole and the hole walks forward to the end of the arrays
+internal void
+DeleteEntity(entity_storage* Storage, u32 EntityIndex)
+{
+    u32 ArchetypeIndex = GetArchetypeOfEntity(Storage, EntityIndex);
+    entity_archetype* Archetype = Storage->Archetypes + ArchetypeIndex;
 
-    if (EntityToMove.ID != EntityID) 
+    u32 LastIndex = Archetype->First + --Archetype->Count;
+    if (EntityIndex != LastIndex)
     {
-        for (u32 EntityIndex = 0;
-            EntityIndex < StorageInUse->EntityCount;
-            ++EntityIndex)
+        MoveEntity(Storage, LastIndex, EntityIndex);
+    }
+    EntityIndex = LastIndex;
+
+    for (u32 Index = ArchetypeIndex + 1;
+        Index < Storage->ArchetypeCount;
+        ++Index)
+    {
+        Archetype = Storage->Archetypes + Index;
+        --Archetype->First;
+        if (Archetype->Count)
         {
-            entity Entity = StorageInUse->Entities[EntityIndex];
-            if (Entity.ID == EntityID)
-            {
-                EntityToRemove = Entity;
-                break;
-            }
+            LastIndex = Archetype->First + Archetype->Count;
+            MoveEntity(Storage, LastIndex, EntityIndex);
+            EntityIndex = LastIndex;
+        }
+    }
+
+    --Storage->EntityCount;
+    ++Storage->ChangeCount;
+}
+
+void
+CreateEntities(world* World, entity_desc* Descs, u32 Count, entity_handle* Handles)
+{
+    entity_storage* Storage = &World->EntityStorage;
+    ReserveEntities(Storage, Storage->EntityCount + Count);
+
+    for (u32 DescIndex = 0;
+        DescIndex < Count;
+        ++DescIndex)
+    {
+        entity_desc* Desc = Descs + DescIndex;
+        u32 EntityIndex = InsertEntity(Storage, GetArchetype(Storage, Desc->Type, Desc->Flags));
+
+        u32 Slot = AllocateEntitySlot(Storage);
+        entity_handle Handle = (Storage->Generations[Slot] << ENTITY_SLOT_BITS) | Slot;
+        Storage->DenseIndices[Slot] = EntityIndex;
+
+        Storage->Handles[EntityIndex] = Handle;
+        Storage->P[EntityIndex]       = Desc->P;
+        Storage->dP[EntityIndex]      = Desc->dP;
+        Storage->Size[EntityIndex]    = Desc->Size;
+        Storage->Color[EntityIndex]   = Desc->Color;
+
+        if (Handles)
+        {
+            Handles[DescIndex] = Handle;
         }
+    }
+}
 
-        EntityToMove.Component->StorageIndex = EntityToRemove.Component->StorageIndex;
-        EntityToRemove.Component->StorageIndex = StorageToStore->EntityCount;
+entity_handle
+CreateEntity(world* World, v2 Position, v2 Velocity, u32 Width, u32 Height, entity_type Type, u32 Color)
+{
+    entity_desc Desc = {Position, Velocity, V2i(Width, Height), Type, Color};
+    entity_handle Result;
+    CreateEntities(World, &Desc, 1, &Result);
+    return Result;
+}
 
-        StorageInUse->Entities[EntityToMove.Component->StorageIndex] = EntityToMove;
+b32
+IsEntityValid(world* World, entity_handle Handle)
+{
+    entity_storage* Storage = &World->EntityStorage;
+    u32 Slot = GetEntitySlot(Handle);
+    b32 Result = (Slot < Storage->SlotCount) && (Storage->Generations[Slot] == GetEntityGeneration(Handle));
+    return Result;
+}
+
+// NOTE: Index into the component arrays, INVALID_ENTITY_INDEX for a removed entity.
+// It is only good until the next removal.
+u32
+GetEntityIndex(world* World, entity_handle Handle)
+{
+    u32 Result = INVALID_ENTITY_INDEX;
+    if (IsEntityValid(World, Handle))
+    {
+        Result = World->EntityStorage.DenseIndices[GetEntitySlot(Handle)];
     }
-    else
+    return Result;
+}
+
+// NOTE: The handle has to be valid, removing an entity twice is a bug of the caller
+void
+RemoveEntity(world* World, entity_handle Handle)
+{
+    Assert(IsEntityValid(World, Handle));
+
+    entity_storage* Storage = &World->EntityStorage;
+    u32 Slot = GetEntitySlot(Handle);
+    DeleteEntity(Storage, Storage->DenseIndices[Slot]);
+
+    // NOTE: Zero is skipped when the generation wraps around
+    u32 Generation = (Storage->Generations[Slot] + 1) & ENTITY_GENERATION_MASK;
+    Storage->Generations[Slot] = Generation ? Generation : 1;
+    Storage->FreeSlots[Storage->FreeSlotCount++] = Slot;
+}
+
+// NOTE: Other flags are another archetype, so the entity moves into that one
+void
+SetEntityFlags(world* World, entity_handle Handle, u32 Flags)
+{
+    u32 EntityIndex = GetEntityIndex(World, Handle);
+    Assert(EntityIndex != INVALID_ENTITY_INDEX);
+
+    entity_storage* Storage = &World->EntityStorage;
+    entity_archetype* Archetype = Storage->Archetypes + GetArchetypeOfEntity(Storage, EntityIndex);
+    if (Archetype->Flags == Flags)
     {
-        EntityToRemove = EntityToMove;
+        return;
     }
 
-    // NOTE: This is a bad thing here? 
-    // I should think about a better solution here
-    StorageToStore->Entities = (entity*)realloc(StorageToStore->Entities, sizeof(entity) * (StorageToStore->EntityCount + 1));
-    StorageToStore->Entities[StorageToStore->EntityCount++] = EntityToRemove;
+    entity_type Type = Archetype->Type;
+    v2 P      = Storage->P[EntityIndex];
+    v2 dP     = Storage->dP[EntityIndex];
+    v2 Size   = Storage->Size[EntityIndex];
+    u32 Color = Storage->Color[EntityIndex];
+    DeleteEntity(Storage, EntityIndex);
+
+    EntityIndex = InsertEntity(Storage, GetArchetype(Storage, Type, Flags));
+    Storage->Handles[EntityIndex] = Handle;
+    Storage->P[EntityIndex]       = P;
+    Storage->dP[EntityIndex]      = dP;
+    Storage->Size[EntityIndex]    = Size;
+    Storage->Color[EntityIndex]   = Color;
+    Storage->DenseIndices[GetEntitySlot(Handle)] = EntityIndex;
 }
 
-entity*
+entity_query
+EntityQuery(u32 TypeMask, u32 RequiredFlags, u32 ExcludedFlags)
+{
+    entity_query Result = {};
+    Result.TypeMask = TypeMask;
+    Result.RequiredFlags = RequiredFlags;
+    Result.ExcludedFlags = ExcludedFlags;
+    return Result;
+}
+
+// NOTE: Returns how many chunks match, the chunks themselves
+// are read from the archetypes so they are always up to date
+u32
+UpdateEntityQuery(world* World, entity_query* Query)
+{
+    entity_storage* Storage = &World->EntityStorage;
+    for (;
+        Query->CheckedCount < Storage->ArchetypeCount;
+        ++Query->CheckedCount)
+    {
+        entity_archetype* Archetype = Storage->Archetypes + Query->CheckedCount;
+        if ((Query->TypeMask & EntityTypeBit(Archetype->Type)) &&
+            ((Archetype->Flags & Query->RequiredFlags) == Query->RequiredFlags) &&
+            !(Archetype->Flags & Query->ExcludedFlags))
+        {
+            Query->Archetypes[Query->MatchCount++] = Query->CheckedCount;
+        }
+    }
+
+    return Query->MatchCount;
+}
+
+entity_chunk
+GetEntityChunk(world* World, entity_query* Query, u32 ChunkIndex)
+{
+    Assert(ChunkIndex < Query->MatchCount);
+    entity_archetype* Archetype = World->EntityStorage.Archetypes + Query->Archetypes[ChunkIndex];
+
+    entity_chunk Result = {Archetype->Type, Archetype->Flags, Archetype->First, Archetype->First + Archetype->Count};
+    return Result;
+}
+
+// NOTE: The last entity of that type, INVALID_ENTITY_INDEX if there is none
+u32
 GetEntityByType(world* World, entity_type Type)
 {
-    entity* Result = 0;
+    u32 Result = INVALID_ENTITY_INDEX;
 
-    entity_storage* StorageToUse = World->EntityStorage;
-    for (u32 EntityIndex = 0;
-        EntityIndex < StorageToUse->EntityCount;
-        ++EntityIndex)
+    entity_query Query = EntityQuery(EntityTypeBit(Type));
+    u32 ChunkCount = UpdateEntityQuery(World, &Query);
+    for (u32 ChunkIndex = 0;
+        ChunkIndex < ChunkCount;
+        ++ChunkIndex)
+    {
+        entity_chunk Chunk = GetEntityChunk(World, &Query, ChunkIndex);
+        if (Chunk.OnePastLast > Chunk.First)
+        {
+            Result = Chunk.OnePastLast - 1;
+        }
+    }
+    return Result;
+}
+
+// NOTE: The first entity of the query whose box contains P, INVALID_ENTITY_HANDLE if there is none
+entity_handle
+GetEntityAt(world* World, entity_query* Query, v2 P)
+{
+    entity_handle Result = INVALID_ENTITY_HANDLE;
+
+    entity_storage* Storage = &World->EntityStorage;
+    u32 ChunkCount = UpdateEntityQuery(World, Query);
+    for (u32 ChunkIndex = 0;
+        (ChunkIndex < ChunkCount) && (Result == INVALID_ENTITY_HANDLE);
+        ++ChunkIndex)
     {
-        entity* EntityFound = StorageToUse->Entities + EntityIndex;
-        if (EntityFound->Component->Type == Type)
+        entity_chunk Chunk = GetEntityChunk(World, Query, ChunkIndex);
+        for (u32 EntityIndex = Chunk.First;
+            (EntityIndex < Chunk.OnePastLast) && (Result == INVALID_ENTITY_HANDLE);
+            ++EntityIndex)
         {
-            Result = EntityFound;
+            v2 Min = Storage->P[EntityIndex];
+            v2 Max = Min + Storage->Size[EntityIndex];
+            if ((P.x >= Min.x) && (P.y >= Min.y) && (P.x < Max.x) && (P.y < Max.y))
+            {
+                Result = Storage->Handles[EntityIndex];
+            }
         }
     }
     return Result;
 }
 
 std::vector<v2>
-GetEntityVertices(entity* Entity)
+GetEntityVertices(entity_storage* Storage, u32 EntityIndex)
 {
-    v2 EntityP = Entity->Component->P;
-    r32 Width  = Entity->Component->Width;
-    r32 Height = Entity->Component->Height;
+    v2 EntityP = Storage->P[EntityIndex];
+    r32 Width  = Storage->Size[EntityIndex].x;
+    r32 Height = Storage->Size[EntityIndex].y;
 
     std::vector<v2> VerticesResult;
     VerticesResult.push_back(EntityP);
@@ -136,118 +373,375 @@ GetEntityVertices(entity* Entity)
     return VerticesResult;
 }
 
-struct collision_result
+// NOTE: TypeStyles has one style per entity_type, without
+// a shape and with an empty rect the quad is flat colored
+u32
+PushEntityInstances(world* World, entity_query* Query, quad_instance* Instances, u32 MaxInstanceCount, quad_style* TypeStyles)
 {
-    entity* CollidedEntity;
-    b32 AreCollided;
-};
+    u32 InstanceCount = 0;
 
-collision_result
-CheckForCollision(entity_storage* Storage, entity* A)
-{
-    collision_result Result;
-    Result.AreCollided = false;
-    Result.CollidedEntity = nullptr;
-
-    for (u32 EntityIndex = 0;
-        EntityIndex < Storage->EntityCount;
-        ++EntityIndex)
+    entity_storage* StorageToUse = &World->EntityStorage;
+    u32 ChunkCount = UpdateEntityQuery(World, Query);
+    for (u32 ChunkIndex = 0;
+        ChunkIndex < ChunkCount;
+        ++ChunkIndex)
     {
-        entity* B = Storage->Entities + EntityIndex;
-        if (A != B)
+        entity_chunk Chunk = GetEntityChunk(World, Query, ChunkIndex);
+        quad_style* Style = TypeStyles + Chunk.Type;
+        for (u32 EntityIndex = Chunk.First;
+            (EntityIndex < Chunk.OnePastLast) && (InstanceCount < MaxInstanceCount);
+            ++EntityIndex)
         {
-            v2 PositionA = A->Component->P;
-            i32 WidthA = A->Component->Width;
-            i32 HeightA = A->Component->Height;
-
-            v2 PositionB = B->Component->P;
-            i32 WidthB = B->Component->Width;
-            i32 HeightB = B->Component->Height;
-            if (((PositionA.x) < (PositionB.x + WidthB)) &&
-                ((PositionA.y) < (PositionB.y + HeightB)) &&
-                ((PositionA.x + WidthA) > (PositionB.x)) &&
-                ((PositionA.y + HeightA) > (PositionB.y)))
-            {
-                Result.CollidedEntity = B;
-                Result.AreCollided = true;
-            }
+            quad_instance* Instance = Instances + InstanceCount++;
+            Instance->P          = StorageToUse->P[EntityIndex];
+            Instance->Size       = StorageToUse->Size[EntityIndex];
+            Instance->UVRect     = Style->UVRect;
+            Instance->Rotation   = 0.0f;
+            Instance->Color      = StorageToUse->Color[EntityIndex];
+            Instance->Shape      = Style->Shape;
+            Instance->ShapeParam = Style->ShapeParam;
         }
     }
+
+    return InstanceCount;
+}
+
+inline b32
+AreBoxesOverlapping(v2 PositionA, v2 SizeA, v2 PositionB, v2 SizeB)
+{
+    b32 Result = (((PositionA.x) < (PositionB.x + SizeB.x)) &&
+                  ((PositionA.y) < (PositionB.y + SizeB.y)) &&
+                  ((PositionA.x + SizeA.x) > (PositionB.x)) &&
+                  ((PositionA.y + SizeA.y) > (PositionB.y)));
     return Result;
 }
 
-struct collision_resolution_result
+void
+InitCollisionGrid(collision_grid* Grid, v2 Origin, r32 CellSize, u32 Cols, u32 Rows)
 {
-    v2 Normal;
-};
+    DestroyCollisionGrid(Grid);
+
+    Grid->Origin = Origin;
+    Grid->CellSize = CellSize;
+    Grid->Cols = Cols;
+    Grid->Rows = Rows;
+    Grid->CellStarts = (u32*)calloc(Cols * Rows + 1, sizeof(u32));
+}
 
-collision_resolution_result
-ResolveCollisionBoxBox(entity* A, entity* B)
+internal void
+GetGridCell(collision_grid* Grid, v2 P, u32* X, u32* Y)
 {
-    collision_resolution_result Result = {};
+    v2 Cell = (P - Grid->Origin) / Grid->CellSize;
+    *X = (u32)Clamp(0.0f, floorf(Cell.x), (r32)(Grid->Cols - 1));
+    *Y = (u32)Clamp(0.0f, floorf(Cell.y), (r32)(Grid->Rows - 1));
+}
 
-    v2 VerticesOfA[] =
+// NOTE: A pair that shares more than one cell is only kept in the cell
+// where their overlap starts, so every pair is found exactly once
+u32
+FindCollisionPairs(collision_grid* Grid, entity_storage* Storage)
+{
+    Grid->PairCount = 0;
+    if (!Grid->CellStarts)
     {
-         A->Component->P,
-         A->Component->P + V2(A->Component->Width, 0),
-         A->Component->P + V2(A->Component->Width, A->Component->Height),
-        (A->Component->P + V2(0, A->Component->Height))
-    };
+        return 0;
+    }
 
-    v2 VerticesOfB[] =
-    {
-         B->Component->P,
-         B->Component->P + V2(B->Component->Width, 0),
-         B->Component->P + V2(B->Component->Width, B->Component->Height),
-        (B->Component->P + V2(0, B->Component->Height))
-    };
+    u32 CellCount = Grid->Cols * Grid->Rows;
+    memset(Grid->CellStarts, 0, (CellCount + 1) * sizeof(u32));
 
-    i32 SizeOfA = ArraySize(VerticesOfA);
-    i32 SizeOfB = ArraySize(VerticesOfB);
+    u32 EntryCount = 0;
+    for (u32 EntityIndex = 0;
+        EntityIndex < Storage->EntityCount;
+        ++EntityIndex)
+    {
+        u32 MinX, MinY, MaxX, MaxY;
+        GetGridCell(Grid, Storage->P[EntityIndex], &MinX, &MinY);
+        GetGridCell(Grid, Storage->P[EntityIndex] + Storage->Size[EntityIndex], &MaxX, &MaxY);
+        for (u32 Y = MinY;
+            Y <= MaxY;
+            ++Y)
+        {
+            for (u32 X = MinX;
+                X <= MaxX;
+                ++X)
+            {
+                ++Grid->CellStarts[Y * Grid->Cols + X];
+                ++EntryCount;
+            }
+        }
+    }
 
-    r32 Separation = -FLT_MAX;
-    for (u32 IndexA = 0;
-        IndexA < SizeOfA;
-        ++IndexA)
+    if (EntryCount > Grid->EntryCapacity)
     {
-        v2 SideOfA_A = VerticesOfA[IndexA];
-        v2 SideOfA_B = VerticesOfA[(IndexA + 1) % SizeOfA];
+        Grid->EntryCapacity = Max(Grid->EntryCapacity * 2, EntryCount);
+        Grid->CellEntries = (u32*)realloc(Grid->CellEntries, Grid->EntryCapacity * sizeof(u32));
+    }
 
-        v2 NormalOfA = Normal(SideOfA_B - SideOfA_A);
+    // NOTE: The counts become the ends of the cells, filling
+    // them from the back leaves the starts behind
+    u32 CellEnd = 0;
+    for (u32 Cell = 0;
+        Cell < CellCount;
+        ++Cell)
+    {
+        CellEnd += Grid->CellStarts[Cell];
+        Grid->CellStarts[Cell] = CellEnd;
+    }
+    Grid->CellStarts[CellCount] = EntryCount;
 
-        r32 MinimumSeparation = FLT_MAX;
-        for (u32 IndexB = 0;
-            IndexB < SizeOfB;
-            ++IndexB)
+    for (u32 EntityIndex = 0;
+        EntityIndex < Storage->EntityCount;
+        ++EntityIndex)
+    {
+        u32 MinX, MinY, MaxX, MaxY;
+        GetGridCell(Grid, Storage->P[EntityIndex], &MinX, &MinY);
+        GetGridCell(Grid, Storage->P[EntityIndex] + Storage->Size[EntityIndex], &MaxX, &MaxY);
+        for (u32 Y = MinY;
+            Y <= MaxY;
+            ++Y)
         {
-            v2 SideOfB_A = VerticesOfB[IndexB];
-
-            r32 Projection = Inner(NormalOfA, SideOfB_A - SideOfA_A);
-            if (Projection < MinimumSeparation)
+            for (u32 X = MinX;
+                X <= MaxX;
+                ++X)
             {
-                MinimumSeparation = Projection;
+                Grid->CellEntries[--Grid->CellStarts[Y * Grid->Cols + X]] = EntityIndex;
             }
         }
-        if (MinimumSeparation > Separation)
+    }
+
+    for (u32 Cell = 0;
+        Cell < CellCount;
+        ++Cell)
+    {
+        u32 First = Grid->CellStarts[Cell];
+        u32 OnePastLast = Grid->CellStarts[Cell + 1];
+        for (u32 EntryA = First;
+            EntryA < OnePastLast;
+            ++EntryA)
         {
-            Separation = MinimumSeparation;
-            Result.Normal = NormalOfA;
+            u32 A = Grid->CellEntries[EntryA];
+            for (u32 EntryB = EntryA + 1;
+                EntryB < OnePastLast;
+                ++EntryB)
+            {
+                u32 B = Grid->CellEntries[EntryB];
+                if (!AreBoxesOverlapping(Storage->P[A], Storage->Size[A], Storage->P[B], Storage->Size[B]))
+                {
+                    continue;
+                }
+
+                u32 X, Y;
+                v2 OverlapMin = V2(Max(Storage->P[A].x, Storage->P[B].x), Max(Storage->P[A].y, Storage->P[B].y));
+                GetGridCell(Grid, OverlapMin, &X, &Y);
+                if ((Y * Grid->Cols + X) != Cell)
+                {
+                    continue;
+                }
+
+                if (Grid->PairCount == Grid->PairCapacity)
+                {
+                    Grid->PairCapacity = Max(Grid->PairCapacity * 2, (u32)MIN_ENTITY_CAPACITY);
+                    Grid->Pairs = (collision_pair*)realloc(Grid->Pairs, Grid->PairCapacity * sizeof(collision_pair));
+                    Grid->Contacts = (collision_contact*)realloc(Grid->Contacts, Grid->PairCapacity * sizeof(collision_contact));
+                }
+                Grid->Pairs[Grid->PairCount++] = {Min(A, B), Max(A, B)};
+            }
         }
     }
 
-    return Result;
+    return Grid->PairCount;
+}
+
+void
+DestroyCollisionGrid(collision_grid* Grid)
+{
+    free(Grid->CellStarts);
+    free(Grid->CellEntries);
+    free(Grid->Pairs);
+    free(Grid->Contacts);
+    *Grid = {};
 }
 
+// NOTE: The v2 of four entities straight into registers, one 8 byte load for
+// each of them and two shuffles that split the xs from the ys
+internal void
+GatherV2x4(v2* Array, u32 Index0, u32 Index1, u32 Index2, u32 Index3, __m128* X, __m128* Y)
+{
+    __m128 Low  = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), (__m64*)(Array + Index0)), (__m64*)(Array + Index1));
+    __m128 High = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), (__m64*)(Array + Index2)), (__m64*)(Array + Index3));
+    *X = _mm_shuffle_ps(Low, High, _MM_SHUFFLE(2, 0, 2, 0));
+    *Y = _mm_shuffle_ps(Low, High, _MM_SHUFFLE(3, 1, 3, 1));
+}
+
+// NOTE: Four pairs of boxes at once. The boxes are gathered into lanes, after
+// that the overlap on both axes is computed from the centers and the half
+// sizes, and the axis with the smaller overlap is the normal.
+internal void
+ResolveBoxPairs4(entity_storage* Storage, collision_pair* Pairs, collision_contact* Contacts)
+{
+    __m128 AX, AY, AW, AH;
+    __m128 BX, BY, BW, BH;
+    GatherV2x4(Storage->P,    Pairs[0].A, Pairs[1].A, Pairs[2].A, Pairs[3].A, &AX, &AY);
+    GatherV2x4(Storage->Size, Pairs[0].A, Pairs[1].A, Pairs[2].A, Pairs[3].A, &AW, &AH);
+    GatherV2x4(Storage->P,    Pairs[0].B, Pairs[1].B, Pairs[2].B, Pairs[3].B, &BX, &BY);
+    GatherV2x4(Storage->Size, Pairs[0].B, Pairs[1].B, Pairs[2].B, Pairs[3].B, &BW, &BH);
+
+    __m128 Half = _mm_set1_ps(0.5f);
+    __m128 One = _mm_set1_ps(1.0f);
+    __m128 SignMask = _mm_set1_ps(-0.0f);
+
+    __m128 AHalfW = _mm_mul_ps(AW, Half);
+    __m128 AHalfH = _mm_mul_ps(AH, Half);
+    __m128 BHalfW = _mm_mul_ps(BW, Half);
+    __m128 BHalfH = _mm_mul_ps(BH, Half);
+
+    __m128 DeltaX = _mm_sub_ps(_mm_add_ps(BX, BHalfW), _mm_add_ps(AX, AHalfW));
+    __m128 DeltaY = _mm_sub_ps(_mm_add_ps(BY, BHalfH), _mm_add_ps(AY, AHalfH));
+    __m128 OverlapX = _mm_sub_ps(_mm_add_ps(AHalfW, BHalfW), _mm_andnot_ps(SignMask, DeltaX));
+    __m128 OverlapY = _mm_sub_ps(_mm_add_ps(AHalfH, BHalfH), _mm_andnot_ps(SignMask, DeltaY));
+
+    // NOTE: +1 or -1 with the sign of the delta, so the normal points from A to B
+    __m128 SignX = _mm_or_ps(_mm_and_ps(DeltaX, SignMask), One);
+    __m128 SignY = _mm_or_ps(_mm_and_ps(DeltaY, SignMask), One);
+    __m128 UseX = _mm_cmplt_ps(OverlapX, OverlapY);
+
+    r32 NormalX[4], NormalY[4], Penetration[4];
+    _mm_storeu_ps(NormalX, _mm_and_ps(UseX, SignX));
+    _mm_storeu_ps(NormalY, _mm_andnot_ps(UseX, SignY));
+    _mm_storeu_ps(Penetration, _mm_min_ps(OverlapX, OverlapY));
+
+    for (u32 Lane = 0;
+        Lane < 4;
+        ++Lane)
+    {
+        collision_contact* Contact = Contacts + Lane;
+        Contact->A = Pairs[Lane].A;
+        Contact->B = Pairs[Lane].B;
+        Contact->Normal = V2(NormalX[Lane], NormalY[Lane]);
+        Contact->Penetration = Penetration[Lane];
+    }
+}
+
+// NOTE: One contact for every pair, the pairs are the ones of the broadphase.
+// Every entity is an axis aligned box, entities have no rotation.
+void
+ResolveCollisionPairs(entity_storage* Storage, collision_pair* Pairs, u32 PairCount, collision_contact* Contacts)
+{
+    u32 PairIndex = 0;
+    for (;
+        (PairIndex + 4) <= PairCount;
+        PairIndex += 4)
+    {
+        ResolveBoxPairs4(Storage, Pairs + PairIndex, Contacts + PairIndex);
+    }
+
+    // NOTE: The last pairs go through the same lanes, the lanes
+    // that are left over repeat the last pair and are thrown away
+    u32 RemainingCount = PairCount - PairIndex;
+    if (RemainingCount)
+    {
+        collision_pair LastPairs[4];
+        collision_contact LastContacts[4];
+        for (u32 Lane = 0;
+            Lane < 4;
+            ++Lane)
+        {
+            LastPairs[Lane] = Pairs[PairIndex + Min(Lane, RemainingCount - 1)];
+        }
+
+        ResolveBoxPairs4(Storage, LastPairs, LastContacts);
+        memcpy(Contacts + PairIndex, LastContacts, RemainingCount * sizeof(collision_contact));
+    }
+}
+
+// NOTE: Only the positions and velocities are read, one linear pass over both.
+// The broadphase is rebuilt from the new positions after that, and every
+// pair it finds gets its contact in one batch.
 void
 UpdateEntities(world* World, r32 DeltaTime, bool* GameOver, i32* BallCount)
 {
-    entity_storage* StorageToUpdate = World->EntityStorage;
+    entity_storage* StorageToUpdate = &World->EntityStorage;
+    v2* P = StorageToUpdate->P;
+    v2* dP = StorageToUpdate->dP;
+    b32 HasMoved = false;
     for (u32 EntityIndex = 0;
         EntityIndex < StorageToUpdate->EntityCount;
         ++EntityIndex)
     {
-        entity* Entity = StorageToUpdate->Entities + EntityIndex;
+        if ((dP[EntityIndex].x != 0.0f) || (dP[EntityIndex].y != 0.0f))
+        {
+            P[EntityIndex] += dP[EntityIndex] * DeltaTime;
+            HasMoved = true;
+        }
+    }
 
-        Entity->Component->P += Entity->Component->dP * DeltaTime;
+    collision_grid* Grid = &World->CollisionGrid;
+    FindCollisionPairs(Grid, StorageToUpdate);
+    ResolveCollisionPairs(StorageToUpdate, Grid->Pairs, Grid->PairCount, Grid->Contacts);
+
+    if (HasMoved)
+    {
+        ++StorageToUpdate->ChangeCount;
+    }
+}
+
+// NOTE: Collision response, a step of its own after UpdateEntities. It uses
+// the contacts of that step and pushes the pairs apart along their normals.
+// Entities without a velocity don't get pushed, the moving one of a pair
+// takes the whole penetration and two moving ones take half of it each.
+// Every contact is from before the pushes, an entity in more than one
+// pair gets all of them.
+void
+ApplyCollisionContacts(world* World)
+{
+    entity_storage* Storage = &World->EntityStorage;
+    collision_grid* Grid = &World->CollisionGrid;
+    b32 HasMoved = false;
+    for (u32 ContactIndex = 0;
+        ContactIndex < Grid->PairCount;
+        ++ContactIndex)
+    {
+        collision_contact* Contact = Grid->Contacts + ContactIndex;
+        b32 IsAMoving = (Storage->dP[Contact->A].x != 0.0f) || (Storage->dP[Contact->A].y != 0.0f);
+        b32 IsBMoving = (Storage->dP[Contact->B].x != 0.0f) || (Storage->dP[Contact->B].y != 0.0f);
+        if ((Contact->Penetration <= 0.0f) || (!IsAMoving && !IsBMoving))
+        {
+            continue;
+        }
+
+        v2 Push = Contact->Normal * Contact->Penetration;
+        if (IsAMoving && IsBMoving)
+        {
+            Push *= 0.5f;
+        }
+        if (IsAMoving)
+        {
+            Storage->P[Contact->A] -= Push;
+        }
+        if (IsBMoving)
+        {
+            Storage->P[Contact->B] += Push;
+        }
+        HasMoved = true;
+    }
+
+    if (HasMoved)
+    {
+        ++Storage->ChangeCount;
     }
 }
+
+void
+DestroyEntityStorage(entity_storage* Storage)
+{
+    free(Storage->Handles);
+    free(Storage->P);
+    free(Storage->dP);
+    free(Storage->Size);
+    free(Storage->Color);
+    free(Storage->DenseIndices);
+    free(Storage->Generations);
+    free(Storage->FreeSlots);
+    *Storage = {};
+}
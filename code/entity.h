@@ -12,59 +12,188 @@ enum entity_type
     EntityType_Count,
 };
 
-// NOTE: I could try here to create
-// a second entity storage for removed entity ids
-// instead of this thing.
-// But Could it be cost more on modern machines?
+#define EntityTypeBit(Type) (1u << (Type))
+#define ALL_ENTITY_TYPES ((1u << EntityType_Count) - 1)
+
 enum entity_flags
 {
     EntityFlag_Placed = (1 << 0),
 };
 
-struct entity_component
+#define INVALID_ENTITY_INDEX (~0u)
+#define MIN_ENTITY_CAPACITY 64
+
+// NOTE: A handle is a slot in the low bits and the generation of that slot
+// in the high bits. Removing an entity bumps the generation of its slot, so
+// handles kept from before don't find whatever reuses the slot. Generations
+// start at 1, a zero handle is never valid.
+typedef u32 entity_handle;
+
+#define ENTITY_SLOT_BITS 20
+#define ENTITY_SLOT_MASK ((1u << ENTITY_SLOT_BITS) - 1)
+#define ENTITY_GENERATION_MASK ((1u << (32 - ENTITY_SLOT_BITS)) - 1)
+#define INVALID_ENTITY_HANDLE 0
+
+inline u32
+GetEntitySlot(entity_handle Handle)
 {
-    v2 P;
-    v2 dP;
+    return Handle & ENTITY_SLOT_MASK;
+}
+
+inline u32
+GetEntityGeneration(entity_handle Handle)
+{
+    return Handle >> ENTITY_SLOT_BITS;
+}
+
+// NOTE: Entities with the same type and flags are an archetype. They are
+// kept next to each other in the component arrays, in the order the
+// archetypes were added, so every archetype is one chunk of the arrays.
+// Archetypes are never removed, an empty one is a chunk of zero entities.
+#define MAX_ENTITY_ARCHETYPES 32
+
+struct entity_archetype
+{
+    entity_type Type;
+    u32 Flags;
+
+    u32 First;
+    u32 Count;
+};
+
+// NOTE: Every component is its own array and an entity is an index into
+// all of them, so a system only streams through the arrays it touches.
+// Adding or removing an entity moves at most one entity of every archetype
+// after its own, the indices of those change then, their handles don't.
+// The arrays double when they are full. ChangeCount goes up whenever an
+// entity is added, removed or moved, so copies of the components can
+// tell when they are out of date.
+struct entity_storage
+{
+    u32 EntityCount;
+    u32 Capacity;
+    u32 ChangeCount;
+
+    entity_handle* Handles;
+    v2* P;
+    v2* dP;
+    v2* Size;
+    u32* Color;
+
+    entity_archetype Archetypes[MAX_ENTITY_ARCHETYPES];
+    u32 ArchetypeCount;
 
-    u32 Width;
-    u32 Height;
+    // NOTE: Sparse side of the set, indexed by the slot of a handle. A slot
+    // of a live entity has the index of its components, removed slots are
+    // on the free list and are given out again before new ones.
+    u32* DenseIndices;
+    u32* Generations;
+    u32 SlotCount;
+    u32 SlotCapacity;
 
+    u32* FreeSlots;
+    u32 FreeSlotCount;
+};
+
+struct entity_desc
+{
+    v2 P;
+    v2 dP;
+    v2 Size;
+    entity_type Type;
     u32 Color;
+    u32 Flags;
+};
 
-    b32 Flags;
+// NOTE: Matches the archetypes of one of the types in TypeMask that have
+// every RequiredFlag and none of the ExcludedFlags. The matches are kept
+// in the query, archetypes added since the last update are checked when
+// it is updated, so a query that lives across frames only costs a compare.
+struct entity_query
+{
+    u32 TypeMask;
+    u32 RequiredFlags;
+    u32 ExcludedFlags;
 
-    i32 StorageIndex;
+    u32 Archetypes[MAX_ENTITY_ARCHETYPES];
+    u32 MatchCount;
+    u32 CheckedCount;
+};
 
+struct entity_chunk
+{
     entity_type Type;
+    u32 Flags;
+
+    u32 First;
+    u32 OnePastLast;
 };
 
-struct entity
+// NOTE: Broadphase over a uniform grid the size of the board squares. It is
+// rebuilt every step with a counting sort, an entity is in every cell its
+// box touches and entities off the grid go into the cells on its border.
+// Pairs are entity indices with A < B, they are good until the next time
+// entities are added or removed. Every buffer only grows, by doubling.
+struct collision_pair
 {
-    u32 ID;
-    entity_component* Component;
+    u32 A;
+    u32 B;
 };
 
-struct entity_storage
+// NOTE: Moving B along the normal by the penetration separates the two,
+// the normal points from A to B
+struct collision_contact
 {
-    entity* Entities;
-    u32 EntityCount;
+    u32 A;
+    u32 B;
+
+    v2 Normal;
+    r32 Penetration;
 };
 
-struct world
+struct collision_grid
 {
-    entity_storage* EntityStorage;
-    entity_storage* RemovedEntityStorage;
+    v2 Origin;
+    r32 CellSize;
+    u32 Cols;
+    u32 Rows;
 
-    // NOTE: Should I count entities that is in use?
-    // Entities that I got from this storage?
-    // But isn't too space consuming?
-    entity GlobalEntityStorage[512];
+    u32* CellStarts;
+    u32* CellEntries;
+    u32 EntryCapacity;
+
+    collision_pair* Pairs;
+    collision_contact* Contacts;
+    u32 PairCount;
+    u32 PairCapacity;
+};
+
+struct world
+{
+    entity_storage EntityStorage;
+    collision_grid CollisionGrid;
 };
 
-void CreateEntity(world* World, v2 Position, v2 Velocity, u32 Width, u32 Height, entity_type Type, u32 Color = 0xFFFFFFFF);
-void RemoveEntityByID(world* World, u32 EntityID);
-entity* GetEntityByType(world* World, entity_type Type);
-std::vector<v2> GetEntityVertices(entity* Entity);
+void ReserveEntities(entity_storage* Storage, u32 Count);
+void CreateEntities(world* World, entity_desc* Descs, u32 Count, entity_handle* Handles = nullptr);
+entity_handle CreateEntity(world* World, v2 Position, v2 Velocity, u32 Width, u32 Height, entity_type Type, u32 Color = 0xFFFFFFFF);
+b32 IsEntityValid(world* World, entity_handle Handle);
+u32 GetEntityIndex(world* World, entity_handle Handle);
+void RemoveEntity(world* World, entity_handle Handle);
+void SetEntityFlags(world* World, entity_handle Handle, u32 Flags);
+entity_query EntityQuery(u32 TypeMask, u32 RequiredFlags = 0, u32 ExcludedFlags = 0);
+u32 UpdateEntityQuery(world* World, entity_query* Query);
+entity_chunk GetEntityChunk(world* World, entity_query* Query, u32 ChunkIndex);
+u32 GetEntityByType(world* World, entity_type Type);
+entity_handle GetEntityAt(world* World, entity_query* Query, v2 P);
+std::vector<v2> GetEntityVertices(entity_storage* Storage, u32 EntityIndex);
+void DestroyEntityStorage(entity_storage* Storage);
+void InitCollisionGrid(collision_grid* Grid, v2 Origin, r32 CellSize, u32 Cols, u32 Rows);
+u32 FindCollisionPairs(collision_grid* Grid, entity_storage* Storage);
+void DestroyCollisionGrid(collision_grid* Grid);
+void ResolveCollisionPairs(entity_storage* Storage, collision_pair* Pairs, u32 PairCount, collision_contact* Contacts);
+u32 PushEntityInstances(world* World, entity_query* Query, quad_instance* Instances, u32 MaxInstanceCount, quad_style* TypeStyles);
 void UpdateEntities(world* World, r32 DeltaTime, bool* GameOver = nullptr, i32* BallCount = 0);
+void ApplyCollisionContacts(world* World);
 
 #endif
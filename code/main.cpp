@@ -3,16 +3,30 @@
 #include <fstream>
 #include <string.h>
 #include <stdlib.h>
-#include <windows.h>
 #include <stdbool.h>
 #include <SDL2/SDL.h>
 #include "display.h"
 #include "vulkan_renderer.h"
 #include "entity.h"
 #include "entity.cpp"
+#include "atlas.h"
+#include "atlas.cpp"
+#include "text.h"
+#include "text.cpp"
 #undef main
 
+#define HEADLESS_DEFAULT_FRAME_COUNT 100
+#define HEADLESS_OUTPUT_PATH "headless.ppm"
+#define CAPTURE_OUTPUT_PATH "capture.ppm"
+
+#define ATLAS_SIZE 512
+
 bool IsDebug = false;
+bool UseGPURaster = false;
+bool UseSharpUpscale = true;
+bool IsLowLatency = false;
+bool IsCaptureRequested = false;
+u32 DebugView = DebugView_None;
 bool StartGame = false;
 
 i32 PreviousFrameTime = 0;
@@ -40,15 +54,114 @@ private:
     world* World;
     bool IsRunning;
 
+    // NOTE: Headless runs a fixed number of frames without a window,
+    // the last one is read back and written into HEADLESS_OUTPUT_PATH
+    bool IsHeadless;
+    u32 HeadlessFrameCount;
+
+    // NOTE: The window can be resized, the ColorBuffer keeps its size.
+    // Paced frames are timed by the display instead of by Update.
+    u32 WindowWidth;
+    u32 WindowHeight;
+    bool IsPresentPaced;
+
     void Setup();
     void ProcessInput();
     void Update();
     void Render();
 
+    static void RecordBoardLayer(vulkan_renderer* Renderer, VkCommandBuffer CommandBuffer, void* Data);
+    static void RecordPiecesLayer(vulkan_renderer* Renderer, VkCommandBuffer CommandBuffer, void* Data);
+    static void RecordUILayer(vulkan_renderer* Renderer, VkCommandBuffer CommandBuffer, void* Data);
+    static void RecordRasterPass(vulkan_renderer* Renderer, VkCommandBuffer CommandBuffer, void* Data);
+    static void RecordUpscalePass(vulkan_renderer* Renderer, VkCommandBuffer CommandBuffer, void* Data);
+    static void RecordOverlayPass(vulkan_renderer* Renderer, VkCommandBuffer CommandBuffer, void* Data);
+    static void RecordCullResetPass(vulkan_renderer* Renderer, VkCommandBuffer CommandBuffer, void* Data);
+    static void RecordCullPass(vulkan_renderer* Renderer, VkCommandBuffer CommandBuffer, void* Data);
+    void WriteHeadlessFrame(const char* Path);
+    void PushProfileOverlay();
+    void PushLabels();
+    void ToggleCapture();
+
     vulkan_renderer* Renderer;
 
-    image RenderEntry;
-    buffer RenderBuffer;
+    material_desc MeshMaterialDesc;
+    material_desc UpscaleMaterialDesc;
+    material_desc OverlayMaterialDesc;
+    material_desc QuadMaterialDesc;
+    material_desc BoardMaterialDesc;
+    material_desc TextMaterialDesc;
+
+    // NOTE: Looked up on the main thread every frame, the layers
+    // are recorded on the workers and only read these
+    material MeshMaterial;
+    material UpscaleMaterial;
+    material OverlayMaterial;
+    material QuadMaterial;
+    material BoardMaterial;
+    material TextMaterial;
+    u32 InstanceCount;
+    u32 InstanceChangeCount;
+    material RasterMaterial;
+    material CullMaterial;
+
+    board_constants Board;
+    v2 MouseP;
+
+    // NOTE: The board and the entities are in world pixels, the camera maps
+    // them into the ColorBuffer. The pieces outside of it are culled on the gpu,
+    // only the visible ones end up in CulledBuffer and get drawn. InstanceBuffer
+    // stays on the gpu and is only uploaded again when the entities change.
+    camera Camera;
+    rectangle2 BoardArea;
+    view_constants View;
+
+    // NOTE: One of each for every frame in flight, so an upload
+    // never has to wait for the frame before to be done with it
+    image RenderEntries[RENDER_FRAME_COUNT];
+
+    // NOTE: Every sprite is in one atlas that is uploaded once,
+    // the quads of all entities are drawn with that one image.
+    // Pieces are shapes and don't take space in it.
+    texture_atlas Atlas;
+    image AtlasImage;
+    quad_style EntityStyles[EntityType_Count];
+    entity_query PieceQuery;
+
+    // NOTE: Everything the host writes for a frame is there once per
+    // frame in flight, FrameIndex picks the one the gpu is done with
+    u32 FrameIndex;
+
+    // NOTE: The glyphs are in the same atlas. Labels that don't change
+    // are laid out once and copied from TextCache, everything of the
+    // frame is drawn from TextBuffer in screen pixels.
+    text_font Font;
+    text_cache* TextCache;
+    text_batch TextBatch;
+    buffer TextBuffers[RENDER_FRAME_COUNT];
+    buffer* TextBuffer;
+    view_constants TextView;
+
+    // NOTE: With unified memory the CPU rasterizes straight into the image
+    // that is sampled. SoftwareImage is the one drawn with.
+    image HostImages[RENDER_FRAME_COUNT];
+    bool IsZeroCopy;
+    image* SoftwareImage;
+
+    // NOTE: The debug layer only lives within the frame. The gpu backend
+    // rasterizes into a transient of the ColorBuffer size, it is scaled
+    // into a transient of the backbuffer size that is drawn over the scene.
+    graph_resource SoftwareLayer;
+    graph_resource OverlayLayer;
+    buffer RenderBuffers[RENDER_FRAME_COUNT];
+    buffer InstanceBuffer;
+    buffer InstanceScratch[RENDER_FRAME_COUNT];
+    buffer CulledBuffer;
+    buffer DrawBuffer;
+    buffer RasterBuffers[RENDER_FRAME_COUNT];
+    buffer* RasterBuffer;
+
+    raster_commands SoftwareCommands;
     
     buffer TransientBuffer;
     buffer VertexBuffer;
@@ -59,7 +172,7 @@ private:
     memory_block IndexBlock;
 
 public:
-    game();
+    game(bool IsHeadless_ = false, u32 HeadlessFrameCount_ = 0);
     ~game();
 
     void Run();
@@ -67,21 +180,51 @@ public:
 };
 
 game::
-game()
+game(bool IsHeadless_, u32 HeadlessFrameCount_)
 {
-    IsRunning = InitWindow();
+    IsHeadless = IsHeadless_;
+    HeadlessFrameCount = HeadlessFrameCount_;
+    IsRunning = InitWindow(!IsHeadless);
 
-    Renderer = new vulkan_renderer(window, ColorBuffer->Width, ColorBuffer->Height);
+    WindowWidth = ColorBuffer->Width;
+    WindowHeight = ColorBuffer->Height;
+    IsPresentPaced = false;
+
+    Renderer = new vulkan_renderer(IsHeadless ? nullptr : window, ColorBuffer->Width, ColorBuffer->Height);
+    Renderer->SetPresentation(IsLowLatency);
     Renderer->InitVulkanRenderer();
     
-    Renderer->UploadShader("../shaders/mesh.vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
-    Renderer->UploadShader("../shaders/mesh.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+    shader MeshVertexShader   = Renderer->UploadShader("../shaders/mesh.vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
+    shader MeshFragmentShader = Renderer->UploadShader("../shaders/mesh.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+    shader UpscaleFragmentShader = Renderer->UploadShader("../shaders/upscale.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+    shader QuadVertexShader   = Renderer->UploadShader("../shaders/quad.vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
+    shader QuadFragmentShader = Renderer->UploadShader("../shaders/quad.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+    shader TextFragmentShader = Renderer->UploadShader("../shaders/text.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+    shader BoardVertexShader   = Renderer->UploadShader("../shaders/board.vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
+    shader BoardFragmentShader = Renderer->UploadShader("../shaders/board.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+    shader RasterComputeShader = Renderer->UploadShader("../shaders/raster.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+    shader CullComputeShader   = Renderer->UploadShader("../shaders/cull.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
 
     Renderer->InitGraphicsPipeline();
 
-    World = (world*)malloc(sizeof(world));
-    World->EntityStorage = (entity_storage*)calloc(1, sizeof(entity_storage));
-    World->RemovedEntityStorage = (entity_storage*)calloc(1, sizeof(entity_storage));
+    // NOTE: Pipelines are compiled in the background, the first
+    // frames skip the draws whose material isn't ready yet
+    MeshMaterialDesc  = MaterialDesc({&MeshVertexShader, &MeshFragmentShader});
+    UpscaleMaterialDesc = MaterialDesc({&MeshVertexShader, &UpscaleFragmentShader});
+    OverlayMaterialDesc = MaterialDesc({&MeshVertexShader, &MeshFragmentShader}, BlendMode_Alpha);
+    QuadMaterialDesc  = MaterialDesc({&QuadVertexShader, &QuadFragmentShader}, BlendMode_Alpha);
+    BoardMaterialDesc = MaterialDesc({&BoardVertexShader, &BoardFragmentShader});
+    TextMaterialDesc  = MaterialDesc({&QuadVertexShader, &TextFragmentShader}, BlendMode_Alpha);
+    Renderer->GetMaterial(MeshMaterialDesc);
+    Renderer->GetMaterial(UpscaleMaterialDesc);
+    Renderer->GetMaterial(OverlayMaterialDesc);
+    Renderer->GetMaterial(QuadMaterialDesc);
+    Renderer->GetMaterial(BoardMaterialDesc);
+    Renderer->GetMaterial(TextMaterialDesc);
+    RasterMaterial = Renderer->CreateComputeMaterial(RasterComputeShader);
+    CullMaterial   = Renderer->CreateComputeMaterial(CullComputeShader, ComputeLayout_Cull);
+
+    World = (world*)calloc(1, sizeof(world));
 
     Setup();
 }
@@ -97,6 +240,27 @@ CreateLevel(u32 NumOfCols, u32 NumOfRows)
     i32 EntityWidth  = LevelWidth  / NumOfRows;
     i32 EntityHeight = LevelHeight / NumOfCols;
 
+    // NOTE: The board itself is drawn by the board pass,
+    // only its description is stored here
+    Board = {};
+    Board.LightColor     = V4(1, 1, 1, 1);
+    Board.DarkColor      = V4(0, 0, 0, 1);
+    Board.GridColor      = V4(0.5f, 0.5f, 0.5f, 1);
+    Board.HighlightColor = V4(0.2f, 0.6f, 1.0f, 0.5f);
+    Board.ScreenSize     = V2i(ColorBuffer->Width, ColorBuffer->Height);
+    Board.Cols           = NumOfCols;
+    Board.Rows           = NumOfRows;
+
+    // NOTE: Where the board is on the screen depends on the camera,
+    // BoardMin and BoardSize are set every frame
+    BoardArea = RectangleMinDim(Start, V2i(NumOfCols * EntityWidth, NumOfRows * EntityHeight));
+    InitCollisionGrid(&World->CollisionGrid, Start, (r32)Max(EntityWidth, EntityHeight), NumOfCols, NumOfRows);
+
+    // NOTE: The pieces are collected first and created in one go,
+    // so the entity storage is only grown once
+    std::vector<entity_desc> Pieces;
+    Pieces.reserve(NumOfCols * NumOfRows);
+    v2 PieceSize = V2i(EntityWidth - 4, EntityHeight - 4);
     for(u32 Y = 0;
         Y < NumOfRows;
         ++Y)
@@ -106,66 +270,201 @@ CreateLevel(u32 NumOfCols, u32 NumOfRows)
             ++X)
         {
             v2 Position = Start + V2(X * EntityWidth, Y * EntityHeight);
-            v4 Color;
-            if((Y % 2) == 0)
-            {
-                if((X % 2) == 0)
-                {
-                    Color = V4(255, 255, 255, 255);
-                }
-                else
-                {
-                    Color = V4(0, 0, 0, 255);
-                }
-            }
-            else
-            {
-                if((X % 2) == 0)
-                {
-                    Color = V4(0, 0, 0, 255);
-                }
-                else
-                {
-                    Color = V4(255, 255, 255, 255);
-                }
-            }
-            //CreateEntity(World, Position, V2(0, 0), EntityWidth, EntityHeight, EntityType_Structure, PackBGRA(Color));
-            DrawRect(ColorBuffer, Position, Position + V2(EntityWidth, EntityHeight), PackRGBA(Color));
 
             if((X < 3) && (Y < 3))
             {
-                CreateEntity(World, Position + 2, V2(0, 0), EntityWidth - 4, EntityHeight - 4, EntityType_PlayerChess, 0xFFFFFF00);
+                Pieces.push_back({Position + 2, V2(0, 0), PieceSize, EntityType_PlayerChess, 0xFFFFFF00});
             }
             else if((X > (NumOfRows - 4)) && (Y > (NumOfCols - 4)))
             {
-                CreateEntity(World, Position + 2, V2(0, 0), EntityWidth - 4, EntityHeight - 4, EntityType_EnemyChess, 0xFF00FFFF);
+                Pieces.push_back({Position + 2, V2(0, 0), PieceSize, EntityType_EnemyChess, 0xFF00FFFF});
             }
         }
     }
+
+    CreateEntities(World, Pieces.data(), (u32)Pieces.size());
 }
 
 void game::
 Setup()
 {
-    RenderEntry  = Renderer->CreateImage(ColorBuffer->Width, ColorBuffer->Height, 
-                                         VK_IMAGE_USAGE_TRANSFER_DST_BIT|VK_IMAGE_USAGE_SAMPLED_BIT, 
-                                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    RenderBuffer = Renderer->AllocateBuffer(ColorBuffer->Width*ColorBuffer->Height*sizeof(u32), 
-                                            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT|VK_BUFFER_USAGE_TRANSFER_SRC_BIT, 
-                                            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    for(u32 Index = 0;
+        Index < RENDER_FRAME_COUNT;
+        ++Index)
+    {
+        RenderEntries[Index] = Renderer->CreateImage(ColorBuffer->Width, ColorBuffer->Height, 
+                                                     VK_IMAGE_USAGE_TRANSFER_DST_BIT|VK_IMAGE_USAGE_SAMPLED_BIT, 
+                                                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        RenderBuffers[Index] = Renderer->AllocateBuffer(ColorBuffer->Width*ColorBuffer->Height*sizeof(u32), 
+                                                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT|VK_BUFFER_USAGE_TRANSFER_SRC_BIT, 
+                                                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    }
 
     TransientBuffer = Renderer->AllocateBuffer(1024, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
     VertexBuffer = Renderer->AllocateBuffer(1024, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT|VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
     IndexBuffer = Renderer->AllocateBuffer(1024, VK_BUFFER_USAGE_INDEX_BUFFER_BIT|VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-    ColorBuffer->Memory = (u32*)RenderBuffer.Data;
+    // NOTE: The window quad never changes, it is uploaded once here
+    AllocateMemoryBlock(&MainBlock, (u8*)TransientBuffer.Data, (memory_index)TransientBuffer.Size);
+
+#if 1
+    std::vector<v2> MainWindow;
+    MainWindow.push_back(V2(-1, -1));
+    MainWindow.push_back(V2( 1, -1));
+    MainWindow.push_back(V2( 1,  1));
+    MainWindow.push_back(V2(-1,  1));
+#else
+    std::vector<vertex_data> Vertices;
+    Vertices.push_back(CreateVertex(V2( 0.0, -0.5), V3(1, 0, 0)));
+    Vertices.push_back(CreateVertex(V2( 0.5,  0.5), V3(0, 1, 0)));
+    Vertices.push_back(CreateVertex(V2(-0.5,  0.5), V3(0, 0, 1)));
+#endif
+
+    std::vector<u32> MainWindowIndices = {0, 1, 2, 2, 3, 0};
+    //std::vector<u32> MainWindowIndices = {0, 1, 2};
+
+#if 0
+    Renderer->WaitForTransfers(TransientBuffer);
+    SubMemoryBlock(&MainBlock, &VertexBlock, Vertices.size()*sizeof(vertex_data));
+    SubMemoryBlock(&MainBlock, &IndexBlock, MainWindowIndices.size()*sizeof(u32));
+
+    PushData(&VertexBlock, Vertices.data(), VertexBlock.Size);
+    PushData(&IndexBlock, MainWindowIndices.data(), IndexBlock.Size);
+
+    Renderer->UpdateBuffer(VertexBuffer, TransientBuffer, VertexBlock.Size, GetOffsetFromMainBase(&MainBlock, &VertexBlock));
+    Renderer->UpdateBuffer(IndexBuffer, TransientBuffer, IndexBlock.Size, GetOffsetFromMainBase(&MainBlock, &IndexBlock));
+#else
+    Renderer->UpdateBuffer(VertexBuffer, TransientBuffer, MainWindow.data(), MainWindow.size()*sizeof(v2));
+    Renderer->UpdateBuffer(IndexBuffer, TransientBuffer, MainWindowIndices.data(), MainWindowIndices.size()*sizeof(u32));
+#endif
+
+    // NOTE: Filled from the entity storage when it changed. Every frame in flight
+    // has its own scratch buffer, it is only written after its last upload is done
+    InstanceBuffer = Renderer->AllocateBuffer(MAX_QUAD_INSTANCES*sizeof(quad_instance), 
+                                              VK_BUFFER_USAGE_STORAGE_BUFFER_BIT|VK_BUFFER_USAGE_TRANSFER_DST_BIT, 
+                                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    for(buffer& Buffer : InstanceScratch)
+    {
+        Buffer = Renderer->AllocateBuffer(MAX_QUAD_INSTANCES*sizeof(quad_instance), 
+                                          VK_BUFFER_USAGE_TRANSFER_SRC_BIT, 
+                                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    }
+    InstanceCount = 0;
+    InstanceChangeCount = 0;
+
+    // NOTE: Only the gpu touches these, the cull pass fills them every frame
+    CulledBuffer = Renderer->AllocateBuffer(MAX_QUAD_INSTANCES*sizeof(quad_instance), 
+                                            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, 
+                                            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    DrawBuffer = Renderer->AllocateBuffer(sizeof(indirect_quads), 
+                                          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT|VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT|VK_BUFFER_USAGE_TRANSFER_DST_BIT, 
+                                          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    // NOTE: Commands are written straight into the buffer the compute pass reads,
+    // the CPU backend executes them from there as well
+    for(buffer& Buffer : RasterBuffers)
+    {
+        Buffer = Renderer->AllocateBuffer(MAX_RASTER_COMMANDS*sizeof(raster_command), 
+                                          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, 
+                                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    }
+    SoftwareCommands = {};
+    SoftwareCommands.MaxCount = MAX_RASTER_COMMANDS;
+
+    ColorBuffer->Memory = (u32*)RenderBuffers[0].Data;
     //ColorBuffer->Memory = (u32*)malloc(sizeof(u32)*ColorBuffer->Width*ColorBuffer->Height);
 
+    // NOTE: Sprites are white, the instances tint them with their color
+    InitAtlas(&Atlas, ATLAS_SIZE, ATLAS_SIZE);
+
+    EntityStyles[EntityType_PlayerChess] = {V4(0), QuadShape_Crown, 0.0f};
+    EntityStyles[EntityType_EnemyChess]  = {V4(0), QuadShape_Ring, 0.3f};
+    EntityStyles[EntityType_Structure]   = {V4(0), QuadShape_None, 0.0f};
+    PieceQuery = EntityQuery(EntityTypeBit(EntityType_PlayerChess)|EntityTypeBit(EntityType_EnemyChess));
+
+    // NOTE: Baked once here, the distance field is scaled by the text shader
+    if(!BakeFont(&Font, &Atlas))
+    {
+        fprintf(stderr, "Error: font doesn't fit into the atlas\n");
+    }
+    TextCache = (text_cache*)calloc(1, sizeof(text_cache));
+
+    for(buffer& Buffer : TextBuffers)
+    {
+        Buffer = Renderer->AllocateBuffer(MAX_TEXT_GLYPHS*sizeof(quad_instance), 
+                                          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, 
+                                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    }
+    TextBatch = {};
+    TextBatch.MaxCount = MAX_TEXT_GLYPHS;
+
+    // NOTE: The software layer's staging buffer is borrowed for the upload,
+    // it is waited on before the software layer writes into it
+    Assert(ATLAS_SIZE*ATLAS_SIZE*sizeof(u32) <= RenderBuffers[0].Size);
+    AtlasImage = Renderer->CreateImage(ATLAS_SIZE, ATLAS_SIZE, 
+                                       VK_IMAGE_USAGE_TRANSFER_DST_BIT|VK_IMAGE_USAGE_SAMPLED_BIT, 
+                                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    memcpy(RenderBuffers[0].Data, Atlas.Texture.Memory, ATLAS_SIZE*ATLAS_SIZE*sizeof(u32));
+    Renderer->UpdateTexture(AtlasImage, RenderBuffers[0]);
+    Renderer->WaitForTransfers(RenderBuffers[0]);
+
+    atlas_usage AtlasUsage = GetAtlasUsage(&Atlas);
+    printf("Atlas: %u sprites, %.1f%% occupied, %.1f%% fragmented\n", 
+           AtlasUsage.SpriteCount, AtlasUsage.Occupancy*100.0f, AtlasUsage.Fragmentation*100.0f);
+
+    // NOTE: The software layer is transparent unless something is drawn into it,
+    // one upload here so the images are in a valid layout from the beginning
+    ClearColorBuffer(ColorBuffer, 0);
+    for(image& RenderEntry : RenderEntries)
+    {
+        Renderer->UpdateTexture(RenderEntry, RenderBuffers[0]);
+    }
+    SoftwareImage = RenderEntries;
+
+    IsZeroCopy = true;
+    for(image& HostImage : HostImages)
+    {
+        IsZeroCopy = IsZeroCopy && Renderer->CreateHostImage(&HostImage, ColorBuffer->Width, ColorBuffer->Height);
+        if(IsZeroCopy)
+        {
+            memset(HostImage.Data, 0, ColorBuffer->Width*ColorBuffer->Height*sizeof(u32));
+        }
+    }
+
     texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, 
                                 SDL_TEXTUREACCESS_STREAMING, 
                                 ColorBuffer->Width, ColorBuffer->Height);
 
+    MouseP = V2(-1, -1);
+
+    v2 ScreenSize = V2i(ColorBuffer->Width, ColorBuffer->Height);
+    SetCamera(&Camera, 0.5f*ScreenSize, 1.0f, ScreenSize);
+
     CreateLevel(8, 8);
+
+    if(IsCaptureRequested)
+    {
+        ToggleCapture();
+    }
+}
+
+// NOTE: The recording is a stream of PPM frames, ffmpeg plays it
+// back with -f image2pipe -vcodec ppm -i capture.ppm
+void game::
+ToggleCapture()
+{
+    if(Renderer->IsCapturing())
+    {
+        Renderer->EndCapture();
+    }
+    else if(Renderer->BeginCapture(CAPTURE_OUTPUT_PATH))
+    {
+        printf("Capture: recording into %s\n", CAPTURE_OUTPUT_PATH);
+    }
+    else
+    {
+        fprintf(stderr, "Error: can't capture into %s\n", CAPTURE_OUTPUT_PATH);
+    }
 }
 
 void game::
@@ -182,20 +481,93 @@ ProcessInput()
         case SDL_KEYDOWN:
             if(event.key.keysym.sym == SDLK_ESCAPE) IsRunning = false;
             if(event.key.keysym.sym == SDLK_r) IsDebug = !IsDebug;
+            if(event.key.keysym.sym == SDLK_g) UseGPURaster = !UseGPURaster;
+            if(event.key.keysym.sym == SDLK_f) UseSharpUpscale = !UseSharpUpscale;
+            if(event.key.keysym.sym == SDLK_c) ToggleCapture();
+            if(event.key.keysym.sym == SDLK_l)
+            {
+                IsLowLatency = !IsLowLatency;
+                Renderer->SetPresentation(IsLowLatency);
+            }
+            if(event.key.keysym.sym == SDLK_v)
+            {
+                // NOTE: Every view is its own pipeline, the first switch to
+                // one skips these layers until it is compiled in the background
+                DebugView = (DebugView + 1) % DebugView_Count;
+                SetSpecConstant(&MeshMaterialDesc, SpecConstant_DebugView, DebugView);
+                SetSpecConstant(&UpscaleMaterialDesc, SpecConstant_DebugView, DebugView);
+                SetSpecConstant(&QuadMaterialDesc, SpecConstant_DebugView, DebugView);
+                SetSpecConstant(&BoardMaterialDesc, SpecConstant_DebugView, DebugView);
+                SetSpecConstant(&TextMaterialDesc, SpecConstant_DebugView, DebugView);
+            }
             if(event.key.keysym.sym == SDLK_SPACE)
             break;
         case SDL_KEYUP:
             break;
+        case SDL_MOUSEMOTION:
+            // NOTE: Window is top-down, the board is bottom-up
+            MouseP = V2i(event.motion.x*ColorBuffer->Width / WindowWidth, 
+                         ColorBuffer->Height - event.motion.y*ColorBuffer->Height / WindowHeight);
+            break;
+        case SDL_MOUSEBUTTONDOWN:
+            if(event.button.button == SDL_BUTTON_RIGHT)
+            {
+                // NOTE: Right click takes the piece under the mouse off the board.
+                // Its slot goes back to the free list, the old handle must not reach whatever is created there next
+                v2 WorldP = Camera.Area.Min + MouseP / Camera.Scale;
+                entity_handle Handle = GetEntityAt(World, &PieceQuery, WorldP);
+                if(Handle != INVALID_ENTITY_HANDLE)
+                {
+                    RemoveEntity(World, Handle);
+                    Assert(!IsEntityValid(World, Handle));
+                    Assert(GetEntityIndex(World, Handle) == INVALID_ENTITY_INDEX);
+                }
+            }
+            break;
+        case SDL_MOUSEWHEEL:
+            if(event.wheel.y != 0)
+            {
+                // NOTE: Zooming in around the mouse, all the way out is the whole board again
+                v2 ScreenSize = V2i(ColorBuffer->Width, ColorBuffer->Height);
+                r32 Scale = Clamp(1.0f, Camera.Scale*((event.wheel.y > 0) ? 1.25f : 0.8f), 16.0f);
+                if(Scale > 1.0f)
+                {
+                    ZoomCamera(&Camera, MouseP, Scale, ScreenSize);
+                }
+                else
+                {
+                    SetCamera(&Camera, 0.5f*ScreenSize, 1.0f, ScreenSize);
+                }
+            }
+            break;
+        case SDL_WINDOWEVENT:
+            if((event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) && (event.window.data1 > 0) && (event.window.data2 > 0))
+            {
+                WindowWidth = event.window.data1;
+                WindowHeight = event.window.data2;
+                Renderer->ResizeSwapchain();
+            }
+            break;
     }
 }
 
 void game::
 Update()
 {
+    // NOTE: Headless frames don't wait and always step the same time,
+    // so runs can be timed and their output compared between runs
+    if(IsHeadless)
+    {
+        DeltaTime = FRAME_TARGET_TIME / 1000.0f;
+        UpdateEntities(World, DeltaTime);
+        ApplyCollisionContacts(World);
+        return;
+    }
+
     dtForFrame += TimeForFrame;
     int TimeToWait = FRAME_TARGET_TIME - (SDL_GetTicks() + PreviousFrameTime);
 
-    if(TimeToWait > 0 && (TimeToWait <= FRAME_TARGET_TIME))
+    if(!IsPresentPaced && TimeToWait > 0 && (TimeToWait <= FRAME_TARGET_TIME))
     {
         SDL_Delay(TimeToWait);
     }
@@ -205,108 +577,463 @@ Update()
     PreviousFrameTime = SDL_GetTicks();
 
     UpdateEntities(World, DeltaTime);
+    ApplyCollisionContacts(World);
 }
 
 void game::
 Render()
 {
-    Renderer->UpdateTexture(RenderEntry, RenderBuffer);
+    // NOTE: This waits for the frame whose host data is written below.
+    // A minimized window has nothing to render into.
+    if(!Renderer->BeginRendering())
+    {
+        return;
+    }
 
-#if 0
-    entity_storage* StorageToUpdate = World->EntityStorage;
-    for(u32 EntityIndex = 0;
-        EntityIndex < StorageToUpdate->EntityCount;
-        ++EntityIndex)
+    FrameIndex = Renderer->GetFrameIndex();
+    // NOTE: Pointers rather than copies, the bindless slot a buffer
+    // gets the first time it is drawn with has to stay with it
+    RasterBuffer = RasterBuffers + FrameIndex;
+    TextBuffer = TextBuffers + FrameIndex;
+    SoftwareCommands.Base = (raster_command*)RasterBuffer->Data;
+    TextBatch.Base = (quad_instance*)TextBuffer->Data;
+
+    // NOTE: The software layer is only used for the debug overlay,
+    // so it is uploaded only when there is something in it
+    if(IsDebug)
     {
-        // Use here stl to store entities
-        entity* Entity = StorageToUpdate->Entities + EntityIndex;
+        SoftwareCommands.Count = 0;
+        PushClear(&SoftwareCommands, 0);
 
-        v2 Start  = Entity->Component->P;
-        v2 Width  = Entity->Component->Width  * V2(1, 0);
-        v2 Height = Entity->Component->Height * V2(0, 1);
+        entity_storage* StorageToUse = &World->EntityStorage;
+        for(u32 EntityIndex = 0;
+            EntityIndex < StorageToUse->EntityCount;
+            ++EntityIndex)
+        {
+            v2 Min = CameraToScreen(&Camera, StorageToUse->P[EntityIndex]);
+            v2 Max = CameraToScreen(&Camera, StorageToUse->P[EntityIndex] + StorageToUse->Size[EntityIndex]);
 
-        u32 Color = Entity->Component->Color;
+            PushRect(&SoftwareCommands, Min, V2(Max.x, Min.y + 1), 0xFFFF0000);
+            PushRect(&SoftwareCommands, V2(Min.x, Max.y - 1), Max, 0xFFFF0000);
+            PushRect(&SoftwareCommands, Min, V2(Min.x + 1, Max.y), 0xFFFF0000);
+            PushRect(&SoftwareCommands, V2(Max.x - 1, Min.y), Max, 0xFFFF0000);
+        }
+        PushCircle(&SoftwareCommands, MouseP, 8.0f, 0xFFFF0000, false);
+        PushProfileOverlay();
 
-        switch(Entity->Component->Type)
+        // NOTE: Both backends produce the same pixels, 'g' switches between them.
+        // The gpu one is a pass of the frame, it is added with the others below.
+        if(!UseGPURaster)
         {
-            case EntityType_PlayerChess:
+            if(IsZeroCopy)
             {
-                DrawRotRect(ColorBuffer, Start, Width, Height, Color, nullptr);
-            } break;
-
-            case EntityType_EnemyChess:
+                SoftwareImage = HostImages + FrameIndex;
+                ColorBuffer->Memory = (u32*)SoftwareImage->Data;
+                ExecuteRasterCommands(ColorBuffer, &SoftwareCommands);
+            }
+            else
             {
-                DrawRotRect(ColorBuffer, Start, Width, Height, Color, nullptr);
-            } break;
+                // NOTE: The upload of this frame's buffer is from RENDER_FRAME_COUNT
+                // frames ago, it is normally done and this doesn't block
+                buffer* RenderBuffer = RenderBuffers + FrameIndex;
+                Renderer->WaitForTransfers(*RenderBuffer);
+                ColorBuffer->Memory = (u32*)RenderBuffer->Data;
+                ExecuteRasterCommands(ColorBuffer, &SoftwareCommands);
+                Renderer->UpdateTexture(RenderEntries[FrameIndex], *RenderBuffer);
+                SoftwareImage = RenderEntries + FrameIndex;
+            }
+        }
+    }
 
-            case EntityType_Structure:
-            {
-                DrawRotRect(ColorBuffer, Start, Width, Height, Color, nullptr);
-            } break;
+    Board.GridWidth = IsDebug ? 1.0f : 0.0f;
+    Board.BoardMin  = CameraToScreen(&Camera, BoardArea.Min);
+    Board.BoardSize = GetDim(BoardArea)*Camera.Scale;
+    Board.HighlightMask[0] = 0;
+    Board.HighlightMask[1] = 0;
+
+    v2 CellSize = Board.BoardSize / V2i(Board.Cols, Board.Rows);
+    v2 MouseCell = (MouseP - Board.BoardMin) / CellSize;
+    if((MouseCell.x >= 0) && (MouseCell.y >= 0) && (MouseCell.x < Board.Cols) && (MouseCell.y < Board.Rows))
+    {
+        u32 Square = (u32)MouseCell.y*Board.Cols + (u32)MouseCell.x;
+        if(Square < 64)
+        {
+            Board.HighlightMask[Square / 32] |= (1u << (Square % 32));
         }
     }
-#endif
-    //Renderer->DrawImage(RenderEntry);
-    //Renderer->BindBuffer(VertexBuffer, 0);
-    //Renderer->BindImage(RenderEntry, 1);
-    Renderer->DrawMeshes(VertexBuffer, IndexBuffer, RenderEntry);
+
+    // NOTE: Pieces are not rasterized into the ColorBuffer anymore, every
+    // entity is one instance of a quad drawn in a single call. The camera
+    // doesn't change the instances, so a frame where nothing moved doesn't
+    // touch them on the cpu at all.
+    if(World->EntityStorage.ChangeCount != InstanceChangeCount)
+    {
+        buffer& Scratch = InstanceScratch[FrameIndex];
+        Renderer->WaitForTransfers(Scratch);
+        InstanceCount = PushEntityInstances(World, &PieceQuery, (quad_instance*)Scratch.Data, MAX_QUAD_INSTANCES, EntityStyles);
+        if(InstanceCount)
+        {
+            Renderer->UpdateBuffer(InstanceBuffer, Scratch, InstanceCount*sizeof(quad_instance));
+        }
+        InstanceChangeCount = World->EntityStorage.ChangeCount;
+    }
+    View.ScreenSize = Board.ScreenSize;
+    View.ViewMin    = Camera.Area.Min;
+    View.ViewScale  = Camera.Scale;
+
+    BoardMaterial = Renderer->GetMaterial(BoardMaterialDesc);
+    QuadMaterial  = Renderer->GetMaterial(QuadMaterialDesc);
+    MeshMaterial  = Renderer->GetMaterial(MeshMaterialDesc);
+    UpscaleMaterial = Renderer->GetMaterial(UpscaleMaterialDesc);
+    OverlayMaterial = Renderer->GetMaterial(OverlayMaterialDesc);
+    TextMaterial  = Renderer->GetMaterial(TextMaterialDesc);
+
+    PushLabels();
+
+    if(IsDebug)
+    {
+        if(UseGPURaster)
+        {
+            SoftwareLayer = Renderer->CreateTransientImage(ColorBuffer->Width, ColorBuffer->Height, 
+                                                           VK_IMAGE_USAGE_STORAGE_BIT|VK_IMAGE_USAGE_SAMPLED_BIT);
+            u32 RasterPass = Renderer->AddPass("Raster", GraphPass_Compute, RecordRasterPass, this);
+            Renderer->PassRead(RasterPass, Renderer->ImportBuffer(*RasterBuffer), BufferUsage_ShaderRead);
+            Renderer->PassWrite(RasterPass, SoftwareLayer, ImageUsage_Storage);
+        }
+        else
+        {
+            SoftwareLayer = Renderer->ImportImage(*SoftwareImage);
+        }
+
+        image& Backbuffer = Renderer->GetImage(Renderer->GetBackbuffer());
+        OverlayLayer = Renderer->CreateTransientImage(Backbuffer.Width, Backbuffer.Height, 
+                                                      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT|VK_IMAGE_USAGE_SAMPLED_BIT);
+        u32 UpscalePass = Renderer->AddPass("Upscale", GraphPass_Graphics, RecordUpscalePass, this);
+        Renderer->PassRead(UpscalePass, SoftwareLayer, ImageUsage_Sampled);
+        Renderer->PassWrite(UpscalePass, OverlayLayer, ImageUsage_ColorAttachment);
+    }
+
+    // NOTE: The counts are cleared by a copy, then the cull pass
+    // appends the visible instances and the pieces are drawn from them
+    graph_resource Culled = Renderer->ImportBuffer(CulledBuffer);
+    graph_resource Draws  = Renderer->ImportBuffer(DrawBuffer);
+    u32 CullResetPass = Renderer->AddPass("Cull Reset", GraphPass_Transfer, RecordCullResetPass, this);
+    Renderer->PassWrite(CullResetPass, Draws, BufferUsage_TransferDst);
+
+    u32 CullPass = Renderer->AddPass("Cull", GraphPass_Compute, RecordCullPass, this);
+    Renderer->PassRead(CullPass, Renderer->ImportBuffer(InstanceBuffer), BufferUsage_ShaderRead);
+    Renderer->PassWrite(CullPass, Culled, BufferUsage_ShaderWrite);
+    Renderer->PassWrite(CullPass, Draws, BufferUsage_ShaderWrite);
+
+    u32 ScenePass = Renderer->AddLayerPass("Scene");
+    Renderer->PassRead(ScenePass, Culled, BufferUsage_ShaderRead);
+    Renderer->PassRead(ScenePass, Draws, BufferUsage_Indirect);
+    Renderer->PassRead(ScenePass, Renderer->ImportBuffer(*TextBuffer), BufferUsage_ShaderRead);
+    Renderer->PassRead(ScenePass, Renderer->ImportImage(AtlasImage), ImageUsage_Sampled);
+    Renderer->PassWrite(ScenePass, Renderer->GetBackbuffer(), ImageUsage_ColorAttachment);
+
+    Renderer->RecordLayer(RenderLayer_Board, RecordBoardLayer, this);
+    Renderer->RecordLayer(RenderLayer_Pieces, RecordPiecesLayer, this);
+    Renderer->RecordLayer(RenderLayer_UI, RecordUILayer, this);
+
+    if(IsDebug)
+    {
+        u32 OverlayPass = Renderer->AddPass("Overlay", GraphPass_Graphics, RecordOverlayPass, this);
+        Renderer->PassRead(OverlayPass, OverlayLayer, ImageUsage_Sampled);
+        Renderer->PassWrite(OverlayPass, Renderer->GetBackbuffer(), ImageUsage_ColorAttachment);
+    }
+
+    Renderer->EndRendering();
 }
 
+// NOTE: One bar per gpu scope from the top of the screen, half of the width is
+// one frame of FRAME_TARGET_TIME. The names and times go into the window title.
 void game::
-Run()
+PushProfileOverlay()
 {
-    while(IsRunning)
+    local_persist u32 ScopeColors[] = {0xFF3FA7D6, 0xFF59CD90, 0xFFFAC05E, 0xFFF79D84, 0xFFEE6352, 0xFFB084CC};
+
+    profile_result Results[MAX_PROFILE_SCOPES];
+    u32 ResultCount = Renderer->GetProfileResults(Results, ArraySize(Results));
+
+    r32 PixelsPerMillisecond = (ColorBuffer->Width * 0.5f) / FRAME_TARGET_TIME;
+    char Title[512];
+    u32 TitleLength = 0;
+    Title[0] = 0;
+    for(u32 ResultIndex = 0;
+        ResultIndex < ResultCount;
+        ++ResultIndex)
     {
-        AllocateMemoryBlock(&MainBlock, (u8*)TransientBuffer.Data, (memory_index)TransientBuffer.Size);
+        profile_result* Result = Results + ResultIndex;
 
-#if 1
-        std::vector<v2> MainWindow;
-        MainWindow.push_back(V2(-1, -1));
-        MainWindow.push_back(V2( 1, -1));
-        MainWindow.push_back(V2( 1,  1));
-        MainWindow.push_back(V2(-1,  1));
-#else
-        std::vector<vertex_data> Vertices;
-        Vertices.push_back(CreateVertex(V2( 0.0, -0.5), V3(1, 0, 0)));
-        Vertices.push_back(CreateVertex(V2( 0.5,  0.5), V3(0, 1, 0)));
-        Vertices.push_back(CreateVertex(V2(-0.5,  0.5), V3(0, 0, 1)));
-#endif
+        r32 BarTop = (r32)ColorBuffer->Height - 4 - ResultIndex*6;
+        r32 BarLength = Max((r32)Result->Milliseconds*PixelsPerMillisecond, 1.0f);
+        PushRect(&SoftwareCommands, V2(4, BarTop - 4), V2(4 + BarLength, BarTop), ScopeColors[ResultIndex % ArraySize(ScopeColors)]);
 
-        std::vector<u32> MainWindowIndices = {0, 1, 2, 2, 3, 0};
-        //std::vector<u32> MainWindowIndices = {0, 1, 2};
+        if(TitleLength < sizeof(Title))
+        {
+            TitleLength += snprintf(Title + TitleLength, sizeof(Title) - TitleLength, "%s%s %.3fms", 
+                                    ResultIndex ? " | " : "", Result->Name, Result->Milliseconds);
+        }
+    }
 
-#if 0
-        SubMemoryBlock(&MainBlock, &VertexBlock, Vertices.size()*sizeof(vertex_data));
-        SubMemoryBlock(&MainBlock, &IndexBlock, MainWindowIndices.size()*sizeof(u32));
+    profile_statistics Statistics;
+    if(Renderer->GetPipelineStatistics(&Statistics) && (TitleLength < sizeof(Title)))
+    {
+        snprintf(Title + TitleLength, sizeof(Title) - TitleLength, " | VS %llu FS %llu", 
+                 (unsigned long long)Statistics.VertexShaderInvocations, (unsigned long long)Statistics.FragmentShaderInvocations);
+    }
 
-        PushData(&VertexBlock, Vertices.data(), VertexBlock.Size);
-        PushData(&IndexBlock, MainWindowIndices.data(), IndexBlock.Size);
+    if(window)
+    {
+        SDL_SetWindowTitle(window, Title);
+    }
+}
 
-        Renderer->UpdateBuffer(VertexBuffer, TransientBuffer, VertexBlock.Size, GetOffsetFromMainBase(&MainBlock, &VertexBlock));
-        Renderer->UpdateBuffer(IndexBuffer, TransientBuffer, IndexBlock.Size, GetOffsetFromMainBase(&MainBlock, &IndexBlock));
-#else
-        Renderer->UpdateBuffer(VertexBuffer, TransientBuffer, MainWindow.data(), MainWindow.size()*sizeof(v2));
-        Renderer->UpdateBuffer(IndexBuffer, TransientBuffer, MainWindowIndices.data(), MainWindowIndices.size()*sizeof(u32));
-#endif
+// NOTE: Files along the bottom row and ranks along the left column, like on a
+// printed board. They follow the camera but keep their size in screen pixels.
+void game::
+PushLabels()
+{
+    local_persist const char* FileNames[] = {"a", "b", "c", "d", "e", "f", "g", "h"};
+    local_persist const char* RankNames[] = {"1", "2", "3", "4", "5", "6", "7", "8"};
 
-        ProcessInput();
+    TextBatch.Count = 0;
+    TextView.ScreenSize = Board.ScreenSize;
+    TextView.ViewMin    = V2(0, 0);
+    TextView.ViewScale  = 1.0f;
+
+    r32 LabelSize = 1.5f;
+    u32 LabelColor = 0xFF808080;
+    v2 CellSize = GetDim(BoardArea) / V2i(Board.Cols, Board.Rows);
+    for(u32 Col = 0;
+        Col < Min(Board.Cols, ArraySize(FileNames));
+        ++Col)
+    {
+        text_layout* Layout = GetTextLayout(TextCache, &Font, FileNames[Col], LabelSize);
+        v2 Corner = CameraToScreen(&Camera, BoardArea.Min + V2((Col + 1)*CellSize.x, 0));
+        PushTextLayout(&TextBatch, Layout, Corner + V2(-Layout->Dim.x - 2, Layout->Dim.y + 2), LabelColor);
+    }
+    for(u32 Row = 0;
+        Row < Min(Board.Rows, ArraySize(RankNames));
+        ++Row)
+    {
+        text_layout* Layout = GetTextLayout(TextCache, &Font, RankNames[Row], LabelSize);
+        v2 Corner = CameraToScreen(&Camera, BoardArea.Min + V2(0, (Row + 1)*CellSize.y));
+        PushTextLayout(&TextBatch, Layout, Corner + V2(2, -2), LabelColor);
+    }
+
+    // NOTE: Changes every frame, so it is laid out straight into the batch
+    if(IsDebug)
+    {
+        char Stats[128];
+        snprintf(Stats, sizeof(Stats), "Entities %u\nPairs %u\nZoom %.2fx\nDebug view %u", 
+                 World->EntityStorage.EntityCount, World->CollisionGrid.PairCount, Camera.Scale, DebugView);
+        PushText(&TextBatch, &Font, V2(4, Board.ScreenSize.y - 48), 1.0f, 0xFFFFFFFF, Stats);
+    }
+}
+
+void game::
+RecordBoardLayer(vulkan_renderer* Renderer, VkCommandBuffer CommandBuffer, void* Data)
+{
+    game* Game = (game*)Data;
+    Renderer->DrawBoard(CommandBuffer, Game->BoardMaterial, &Game->Board, sizeof(Game->Board));
+}
+
+void game::
+RecordPiecesLayer(vulkan_renderer* Renderer, VkCommandBuffer CommandBuffer, void* Data)
+{
+    game* Game = (game*)Data;
+    Renderer->DrawQuadsIndirect(CommandBuffer, Game->QuadMaterial, Game->CulledBuffer, Game->IndexBuffer, Game->AtlasImage, Game->DrawBuffer, Game->View);
+}
+
+void game::
+RecordUILayer(vulkan_renderer* Renderer, VkCommandBuffer CommandBuffer, void* Data)
+{
+    game* Game = (game*)Data;
+    Renderer->DrawQuads(CommandBuffer, Game->TextMaterial, *Game->TextBuffer, Game->IndexBuffer, Game->AtlasImage, Game->TextBatch.Count, Game->TextView);
+}
+
+void game::
+RecordRasterPass(vulkan_renderer* Renderer, VkCommandBuffer CommandBuffer, void* Data)
+{
+    game* Game = (game*)Data;
+    Renderer->RasterizeCommands(CommandBuffer, Game->RasterMaterial, Renderer->GetImage(Game->SoftwareLayer), *Game->RasterBuffer, Game->SoftwareCommands.Count);
+}
+
+// NOTE: The software layer covers the whole overlay, so this is where it gets
+// from the ColorBuffer size to the native one. 'f' switches between the sharp
+// upscale and plain bilinear filtering. The texels are copied as they are.
+void game::
+RecordUpscalePass(vulkan_renderer* Renderer, VkCommandBuffer CommandBuffer, void* Data)
+{
+    game* Game = (game*)Data;
+    material& Material = UseSharpUpscale ? Game->UpscaleMaterial : Game->MeshMaterial;
+    Renderer->DrawMeshes(CommandBuffer, Material, Game->VertexBuffer, Game->IndexBuffer, Renderer->GetImage(Game->SoftwareLayer), 6);
+}
+
+// NOTE: One texel per pixel, so the bilinear filter doesn't change anything
+void game::
+RecordOverlayPass(vulkan_renderer* Renderer, VkCommandBuffer CommandBuffer, void* Data)
+{
+    game* Game = (game*)Data;
+    Renderer->DrawMeshes(CommandBuffer, Game->OverlayMaterial, Game->VertexBuffer, Game->IndexBuffer, Renderer->GetImage(Game->OverlayLayer), 6);
+}
+
+void game::
+RecordCullResetPass(vulkan_renderer* Renderer, VkCommandBuffer CommandBuffer, void* Data)
+{
+    game* Game = (game*)Data;
+    Renderer->ResetQuadDraws(CommandBuffer, Game->DrawBuffer);
+}
+
+void game::
+RecordCullPass(vulkan_renderer* Renderer, VkCommandBuffer CommandBuffer, void* Data)
+{
+    game* Game = (game*)Data;
+    Renderer->CullQuads(CommandBuffer, Game->CullMaterial, Game->InstanceBuffer, Game->InstanceCount, Game->CulledBuffer, Game->DrawBuffer, Game->Camera.Area);
+}
+
+void game::
+Run()
+{
+    u32 FrameCount = 0;
+    u64 StartCounter = SDL_GetPerformanceCounter();
+
+    while(IsRunning)
+    {
+        // NOTE: Waiting for the display before the input is read
+        // keeps the time from input to the screen short
+        if(!IsHeadless)
+        {
+            IsPresentPaced = Renderer->WaitForPresent();
+            ProcessInput();
+        }
         Update();
         Render();
+
+        ++FrameCount;
+        if(IsHeadless && (FrameCount >= HeadlessFrameCount))
+        {
+            IsRunning = false;
+        }
+    }
+
+    if(IsHeadless)
+    {
+        r64 Seconds = (r64)(SDL_GetPerformanceCounter() - StartCounter) / (r64)SDL_GetPerformanceFrequency();
+        printf("Headless: %u frames, %.3f ms per frame\n", FrameCount, (Seconds * 1000.0) / Max(FrameCount, 1u));
+
+        profile_result Results[MAX_PROFILE_SCOPES];
+        u32 ResultCount = Renderer->GetProfileResults(Results, ArraySize(Results));
+        for(u32 ResultIndex = 0;
+            ResultIndex < ResultCount;
+            ++ResultIndex)
+        {
+            printf("  %-16s %8.3f ms (%u)\n", Results[ResultIndex].Name, Results[ResultIndex].Milliseconds, Results[ResultIndex].Count);
+        }
+
+        WriteHeadlessFrame(HEADLESS_OUTPUT_PATH);
     }
 }
 
+// NOTE: Binary PPM, the readback is B8G8R8A8 so every pixel is 0xAARRGGBB
+void game::
+WriteHeadlessFrame(const char* Path)
+{
+    void* Pixels = nullptr;
+    u64 FrameNumber = 0;
+    if(!Renderer->GetReadback(&Pixels, &FrameNumber, true))
+    {
+        fprintf(stderr, "Error: no frame was rendered\n");
+        return;
+    }
+
+    FILE* File = fopen(Path, "wb");
+    if(!File)
+    {
+        fprintf(stderr, "Error: opening %s\n", Path);
+        return;
+    }
+
+    u32 Width  = ColorBuffer->Width;
+    u32 Height = ColorBuffer->Height;
+    fprintf(File, "P6\n%u %u\n255\n", Width, Height);
+
+    std::vector<u8> Row(Width*3);
+    u32* Pixel = (u32*)Pixels;
+    for(u32 Y = 0;
+        Y < Height;
+        ++Y)
+    {
+        for(u32 X = 0;
+            X < Width;
+            ++X)
+        {
+            u32 Color = *Pixel++;
+            Row[X*3 + 0] = (u8)(Color >> 16);
+            Row[X*3 + 1] = (u8)(Color >> 8);
+            Row[X*3 + 2] = (u8)(Color >> 0);
+        }
+        fwrite(Row.data(), 1, Row.size(), File);
+    }
+
+    fclose(File);
+    printf("Headless: frame %llu written to %s\n", (unsigned long long)FrameNumber, Path);
+}
+
 game::
 ~game()
 {
+    // NOTE: The ColorBuffer lives in mapped memory of the renderer,
+    // the renderer also writes the pipeline cache back on the way out
+    ColorBuffer->Memory = nullptr;
+    delete Renderer;
+    DestroyAtlas(&Atlas);
+    free(TextCache);
+    DestroyEntityStorage(&World->EntityStorage);
+    DestroyCollisionGrid(&World->CollisionGrid);
+    free(World);
+
     DestroyWindow();
 }
 
 int 
 main(int argc, char** argv)
 {
-    game* NewGame = new game();
+    // NOTE: -headless [FrameCount] renders without a window, for benchmarks
+    // and golden images on machines that only have a cpu vulkan device.
+    // -lowlatency starts with the present mode that waits the least.
+    // -capture records every frame from the start, 'c' toggles it later.
+    bool IsHeadless = false;
+    u32 HeadlessFrameCount = HEADLESS_DEFAULT_FRAME_COUNT;
+    for(i32 ArgIndex = 1;
+        ArgIndex < argc;
+        ++ArgIndex)
+    {
+        if(strcmp(argv[ArgIndex], "-headless") == 0)
+        {
+            IsHeadless = true;
+            if(((ArgIndex + 1) < argc) && atoi(argv[ArgIndex + 1]) > 0)
+            {
+                HeadlessFrameCount = (u32)atoi(argv[++ArgIndex]);
+            }
+        }
+        else if(strcmp(argv[ArgIndex], "-lowlatency") == 0)
+        {
+            IsLowLatency = true;
+        }
+        else if(strcmp(argv[ArgIndex], "-capture") == 0)
+        {
+            IsCaptureRequested = true;
+        }
+    }
+
+    game* NewGame = new game(IsHeadless, HeadlessFrameCount);
 
     NewGame->Run();
 
+    delete NewGame;
+
     return 0;
 }
@@ -0,0 +1,246 @@
+#include "text.h"
+
+// NOTE: Classic 5x8 font from ' ' to '~'. One byte per column from
+// the left, the lowest bit is the top row and the last row is only
+// used by descenders.
+internal u8 FontColumns[GLYPH_COUNT][GLYPH_WIDTH] =
+{
+    {0x00, 0x00, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x5F, 0x00, 0x00}, {0x00, 0x07, 0x00, 0x07, 0x00}, {0x14, 0x7F, 0x14, 0x7F, 0x14},
+    {0x24, 0x2A, 0x7F, 0x2A, 0x12}, {0x23, 0x13, 0x08, 0x64, 0x62}, {0x36, 0x49, 0x56, 0x20, 0x50}, {0x00, 0x08, 0x07, 0x03, 0x00},
+    {0x00, 0x1C, 0x22, 0x41, 0x00}, {0x00, 0x41, 0x22, 0x1C, 0x00}, {0x2A, 0x1C, 0x7F, 0x1C, 0x2A}, {0x08, 0x08, 0x3E, 0x08, 0x08},
+    {0x00, 0x80, 0x70, 0x30, 0x00}, {0x08, 0x08, 0x08, 0x08, 0x08}, {0x00, 0x00, 0x60, 0x60, 0x00}, {0x20, 0x10, 0x08, 0x04, 0x02},
+    {0x3E, 0x51, 0x49, 0x45, 0x3E}, {0x00, 0x42, 0x7F, 0x40, 0x00}, {0x72, 0x49, 0x49, 0x49, 0x46}, {0x21, 0x41, 0x49, 0x4D, 0x33},
+    {0x18, 0x14, 0x12, 0x7F, 0x10}, {0x27, 0x45, 0x45, 0x45, 0x39}, {0x3C, 0x4A, 0x49, 0x49, 0x31}, {0x41, 0x21, 0x11, 0x09, 0x07},
+    {0x36, 0x49, 0x49, 0x49, 0x36}, {0x46, 0x49, 0x49, 0x29, 0x1E}, {0x00, 0x00, 0x14, 0x00, 0x00}, {0x00, 0x40, 0x34, 0x00, 0x00},
+    {0x00, 0x08, 0x14, 0x22, 0x41}, {0x14, 0x14, 0x14, 0x14, 0x14}, {0x00, 0x41, 0x22, 0x14, 0x08}, {0x02, 0x01, 0x59, 0x09, 0x06},
+    {0x3E, 0x41, 0x5D, 0x59, 0x4E}, {0x7C, 0x12, 0x11, 0x12, 0x7C}, {0x7F, 0x49, 0x49, 0x49, 0x36}, {0x3E, 0x41, 0x41, 0x41, 0x22},
+    {0x7F, 0x41, 0x41, 0x41, 0x3E}, {0x7F, 0x49, 0x49, 0x49, 0x41}, {0x7F, 0x09, 0x09, 0x09, 0x01}, {0x3E, 0x41, 0x41, 0x51, 0x73},
+    {0x7F, 0x08, 0x08, 0x08, 0x7F}, {0x00, 0x41, 0x7F, 0x41, 0x00}, {0x20, 0x40, 0x41, 0x3F, 0x01}, {0x7F, 0x08, 0x14, 0x22, 0x41},
+    {0x7F, 0x40, 0x40, 0x40, 0x40}, {0x7F, 0x02, 0x1C, 0x02, 0x7F}, {0x7F, 0x04, 0x08, 0x10, 0x7F}, {0x3E, 0x41, 0x41, 0x41, 0x3E},
+    {0x7F, 0x09, 0x09, 0x09, 0x06}, {0x3E, 0x41, 0x51, 0x21, 0x5E}, {0x7F, 0x09, 0x19, 0x29, 0x46}, {0x26, 0x49, 0x49, 0x49, 0x32},
+    {0x03, 0x01, 0x7F, 0x01, 0x03}, {0x3F, 0x40, 0x40, 0x40, 0x3F}, {0x1F, 0x20, 0x40, 0x20, 0x1F}, {0x3F, 0x40, 0x38, 0x40, 0x3F},
+    {0x63, 0x14, 0x08, 0x14, 0x63}, {0x03, 0x04, 0x78, 0x04, 0x03}, {0x61, 0x59, 0x49, 0x4D, 0x43}, {0x00, 0x7F, 0x41, 0x41, 0x41},
+    {0x02, 0x04, 0x08, 0x10, 0x20}, {0x00, 0x41, 0x41, 0x41, 0x7F}, {0x04, 0x02, 0x01, 0x02, 0x04}, {0x40, 0x40, 0x40, 0x40, 0x40},
+    {0x00, 0x03, 0x07, 0x08, 0x00}, {0x20, 0x54, 0x54, 0x78, 0x40}, {0x7F, 0x28, 0x44, 0x44, 0x38}, {0x38, 0x44, 0x44, 0x44, 0x28},
+    {0x38, 0x44, 0x44, 0x28, 0x7F}, {0x38, 0x54, 0x54, 0x54, 0x18}, {0x00, 0x08, 0x7E, 0x09, 0x02}, {0x18, 0xA4, 0xA4, 0x9C, 0x78},
+    {0x7F, 0x08, 0x04, 0x04, 0x78}, {0x00, 0x44, 0x7D, 0x40, 0x00}, {0x20, 0x40, 0x40, 0x3D, 0x00}, {0x7F, 0x10, 0x28, 0x44, 0x00},
+    {0x00, 0x41, 0x7F, 0x40, 0x00}, {0x7C, 0x04, 0x78, 0x04, 0x78}, {0x7C, 0x08, 0x04, 0x04, 0x78}, {0x38, 0x44, 0x44, 0x44, 0x38},
+    {0xFC, 0x18, 0x24, 0x24, 0x18}, {0x18, 0x24, 0x24, 0x18, 0xFC}, {0x7C, 0x08, 0x04, 0x04, 0x08}, {0x48, 0x54, 0x54, 0x54, 0x24},
+    {0x04, 0x04, 0x3F, 0x44, 0x24}, {0x3C, 0x40, 0x40, 0x20, 0x7C}, {0x1C, 0x20, 0x40, 0x20, 0x1C}, {0x3C, 0x40, 0x30, 0x40, 0x3C},
+    {0x44, 0x28, 0x10, 0x28, 0x44}, {0x4C, 0x90, 0x90, 0x90, 0x7C}, {0x44, 0x64, 0x54, 0x4C, 0x44}, {0x00, 0x08, 0x36, 0x41, 0x00},
+    {0x00, 0x00, 0x77, 0x00, 0x00}, {0x00, 0x41, 0x36, 0x08, 0x00}, {0x02, 0x01, 0x02, 0x04, 0x02},
+};
+
+internal b32
+IsFontPixelSet(u32 Glyph, i32 X, i32 Y)
+{
+    b32 Result = false;
+    if((X >= 0) && (Y >= 0) && (X < GLYPH_WIDTH) && (Y < GLYPH_HEIGHT))
+    {
+        Result = (FontColumns[Glyph][X] >> Y) & 1;
+    }
+    return Result;
+}
+
+// NOTE: Signed distance in font pixels from P to the edge of the glyph,
+// negative inside. P is measured from the top left of the bitmap. Every
+// font pixel of the other side is tested, the bitmaps are tiny and this
+// only runs at startup. Anything past the spread is clamped anyway.
+internal r32
+GlyphDistance(u32 Glyph, v2 P)
+{
+    b32 IsInside = IsFontPixelSet(Glyph, (i32)floorf(P.x), (i32)floorf(P.y));
+
+    r32 Closest = (r32)GLYPH_SDF_SPREAD;
+    for(i32 Y = -1;
+        Y <= GLYPH_HEIGHT;
+        ++Y)
+    {
+        for(i32 X = -1;
+            X <= GLYPH_WIDTH;
+            ++X)
+        {
+            if(IsFontPixelSet(Glyph, X, Y) != IsInside)
+            {
+                v2 D = V2(Max(fabsf(P.x - (X + 0.5f)) - 0.5f, 0.0f),
+                          Max(fabsf(P.y - (Y + 0.5f)) - 0.5f, 0.0f));
+                Closest = Min(Closest, Length(D));
+            }
+        }
+    }
+
+    r32 Result = IsInside ? -Closest : Closest;
+    return Result;
+}
+
+// NOTE: The first atlas row of a glyph is its bottom, like the
+// first row of the ColorBuffer is the bottom of the screen
+b32
+BakeFont(text_font* Font, texture_atlas* Atlas)
+{
+    u32 Width = (GLYPH_WIDTH + 2*GLYPH_SDF_SPREAD)*GLYPH_SDF_SCALE;
+    u32 Height = (GLYPH_HEIGHT + 2*GLYPH_SDF_SPREAD)*GLYPH_SDF_SCALE;
+    u32 Pitch = Atlas->Texture.Width;
+
+    for(u32 Glyph = 0;
+        Glyph < GLYPH_COUNT;
+        ++Glyph)
+    {
+        u32 Sprite = PackAtlasSprite(Atlas, Width, Height);
+        if(Sprite == INVALID_ATLAS_SPRITE)
+        {
+            return false;
+        }
+
+        atlas_sprite* Entry = Atlas->Sprites + Sprite;
+        Font->UVRects[Glyph] = Entry->UVRect;
+        for(u32 Y = 0;
+            Y < Height;
+            ++Y)
+        {
+            u32* Row = Atlas->Texture.Memory + (Entry->Y + Y)*Pitch + Entry->X;
+            for(u32 X = 0;
+                X < Width;
+                ++X)
+            {
+                v2 P = V2((X + 0.5f) / GLYPH_SDF_SCALE - GLYPH_SDF_SPREAD,
+                          GLYPH_HEIGHT + GLYPH_SDF_SPREAD - (Y + 0.5f) / GLYPH_SDF_SCALE);
+                r32 Value = Clamp01(0.5f - GlyphDistance(Glyph, P) / (2.0f*GLYPH_SDF_SPREAD));
+                Row[X] = ((u32)roundf(Value*255.0f) << 24) | 0x00FFFFFF;
+            }
+        }
+    }
+
+    return true;
+}
+
+// NOTE: Spaces take room but get no quad. Unknown characters are drawn as '?'.
+text_layout
+LayoutText(text_font* Font, quad_instance* Glyphs, u32 MaxGlyphs, const char* Text, r32 Size)
+{
+    text_layout Result = {};
+    Result.Glyphs = Glyphs;
+
+    v2 GlyphSize = Size*V2(GLYPH_WIDTH + 2*GLYPH_SDF_SPREAD, GLYPH_HEIGHT + 2*GLYPH_SDF_SPREAD);
+    u32 Column = 0;
+    u32 Line = 0;
+    u32 MaxColumn = 0;
+    for(const char* At = Text;
+        *At;
+        ++At)
+    {
+        if(*At == '\n')
+        {
+            Column = 0;
+            ++Line;
+            continue;
+        }
+
+        u32 Glyph = (u32)(*At - FIRST_GLYPH);
+        if(Glyph >= GLYPH_COUNT)
+        {
+            Glyph = '?' - FIRST_GLYPH;
+        }
+
+        if((*At != ' ') && (Result.GlyphCount < MaxGlyphs))
+        {
+            quad_instance* Instance = Glyphs + Result.GlyphCount++;
+            *Instance = {};
+            Instance->P = Size*V2i(Column*GLYPH_ADVANCE - GLYPH_SDF_SPREAD,
+                                   -(i32)(Line*GLYPH_LINE_HEIGHT + GLYPH_HEIGHT + GLYPH_SDF_SPREAD));
+            Instance->Size = GlyphSize;
+            Instance->UVRect = Font->UVRects[Glyph];
+            Instance->Shape = QuadShape_None;
+        }
+
+        ++Column;
+        MaxColumn = Max(MaxColumn, Column);
+    }
+
+    Result.Dim = Size*V2i(MaxColumn*GLYPH_ADVANCE, (Line + 1)*GLYPH_LINE_HEIGHT);
+    return Result;
+}
+
+// NOTE: The returned layout is only valid until the next call,
+// a full cache is cleared to make room
+text_layout*
+GetTextLayout(text_cache* Cache, text_font* Font, const char* Text, r32 Size)
+{
+    u64 Hash = 14695981039346656037ull;
+    for(const char* At = Text;
+        *At;
+        ++At)
+    {
+        Hash = (Hash ^ (u8)*At) * 1099511628211ull;
+    }
+    u32 SizeBits;
+    memcpy(&SizeBits, &Size, sizeof(SizeBits));
+    Hash = (Hash ^ SizeBits) * 1099511628211ull;
+    Hash = Hash ? Hash : 1;
+
+    // NOTE: Linear probing, the table is never more than three quarters full.
+    // Different labels can share a hash, so the text and size are compared too.
+    u32 Mask = MAX_TEXT_CACHE_ENTRIES - 1;
+    u32 Index = (u32)Hash & Mask;
+    while(Cache->Entries[Index].Hash)
+    {
+        text_cache_entry* Entry = Cache->Entries + Index;
+        if((Entry->Hash == Hash) && (Entry->Size == Size) && (strcmp(Entry->Text, Text) == 0))
+        {
+            return &Entry->Layout;
+        }
+        Index = (Index + 1) & Mask;
+    }
+
+    u32 TextLength = (u32)strlen(Text);
+    if(((Cache->EntryCount + 1)*4 > MAX_TEXT_CACHE_ENTRIES*3) ||
+       ((Cache->GlyphCount + TextLength) > MAX_TEXT_CACHE_GLYPHS) ||
+       ((Cache->CharCount + TextLength + 1) > MAX_TEXT_CACHE_CHARS))
+    {
+        *Cache = {};
+        Index = (u32)Hash & Mask;
+    }
+    Assert(TextLength < MAX_TEXT_CACHE_CHARS);
+
+    text_cache_entry* Entry = Cache->Entries + Index;
+    Entry->Hash = Hash;
+    Entry->Text = Cache->Chars + Cache->CharCount;
+    Entry->Size = Size;
+    memcpy(Entry->Text, Text, TextLength + 1);
+    Cache->CharCount += TextLength + 1;
+    Entry->Layout = LayoutText(Font, Cache->Glyphs + Cache->GlyphCount, MAX_TEXT_CACHE_GLYPHS - Cache->GlyphCount, Text, Size);
+    Cache->GlyphCount += Entry->Layout.GlyphCount;
+    ++Cache->EntryCount;
+
+    return &Entry->Layout;
+}
+
+// NOTE: Only copies the glyphs, P is the top left of the text
+void
+PushTextLayout(text_batch* Batch, text_layout* Layout, v2 P, u32 Color)
+{
+    for(u32 GlyphIndex = 0;
+        (GlyphIndex < Layout->GlyphCount) && (Batch->Count < Batch->MaxCount);
+        ++GlyphIndex)
+    {
+        quad_instance* Instance = Batch->Base + Batch->Count++;
+        *Instance = Layout->Glyphs[GlyphIndex];
+        Instance->P = P + Instance->P;
+        Instance->Color = Color;
+    }
+}
+
+// NOTE: Text that changes every frame is laid out straight into the batch
+void
+PushText(text_batch* Batch, text_font* Font, v2 P, r32 Size, u32 Color, const char* Text)
+{
+    text_layout Layout = LayoutText(Font, Batch->Base + Batch->Count, Batch->MaxCount - Batch->Count, Text, Size);
+    for(u32 GlyphIndex = 0;
+        GlyphIndex < Layout.GlyphCount;
+        ++GlyphIndex)
+    {
+        Layout.Glyphs[GlyphIndex].P = P + Layout.Glyphs[GlyphIndex].P;
+        Layout.Glyphs[GlyphIndex].Color = Color;
+    }
+    Batch->Count += Layout.GlyphCount;
+}
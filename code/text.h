@@ -0,0 +1,83 @@
+#if !defined(TEXT_H_)
+
+#include "intrinsics.h"
+#include "hmath.h"
+#include "display.h"
+#include "atlas.h"
+
+// NOTE: Glyphs come from a built in 5x8 bitmap font. They are baked into
+// the atlas once at startup as signed distance fields, so one glyph stays
+// sharp at any size. A texel holds 0.5 on the edge of the glyph, more
+// inside of it and less outside, in the alpha of a white pixel.
+#define FIRST_GLYPH ' '
+#define GLYPH_COUNT ('~' - ' ' + 1)
+#define GLYPH_WIDTH 5
+#define GLYPH_HEIGHT 8
+#define GLYPH_ADVANCE 6
+#define GLYPH_LINE_HEIGHT 10
+
+// NOTE: Atlas texels per font pixel, and how many font pixels
+// of distance are stored on both sides of the edge
+#define GLYPH_SDF_SCALE 4
+#define GLYPH_SDF_SPREAD 1
+
+struct text_font
+{
+    v4 UVRects[GLYPH_COUNT];
+};
+
+// NOTE: Glyph quads of a string with the origin at its top left, Size is
+// the screen pixels per font pixel. The color is set when it is pushed.
+struct text_layout
+{
+    quad_instance* Glyphs;
+    u32 GlyphCount;
+    v2 Dim;
+};
+
+// NOTE: Every string of the frame goes into one batch,
+// it is drawn with a single instanced draw
+#define MAX_TEXT_GLYPHS 1024
+
+struct text_batch
+{
+    quad_instance* Base;
+    u32 Count;
+    u32 MaxCount;
+};
+
+// NOTE: Layouts of labels that don't change, keyed by their text and size.
+// The glyphs and a copy of the text are kept in the cache itself, so when it
+// runs out of any of them it is cleared and the labels are laid out again.
+#define MAX_TEXT_CACHE_ENTRIES 64
+#define MAX_TEXT_CACHE_GLYPHS 2048
+#define MAX_TEXT_CACHE_CHARS 2048
+
+struct text_cache_entry
+{
+    u64 Hash;
+    char* Text;
+    r32 Size;
+    text_layout Layout;
+};
+
+struct text_cache
+{
+    text_cache_entry Entries[MAX_TEXT_CACHE_ENTRIES];
+    u32 EntryCount;
+
+    quad_instance Glyphs[MAX_TEXT_CACHE_GLYPHS];
+    u32 GlyphCount;
+
+    char Chars[MAX_TEXT_CACHE_CHARS];
+    u32 CharCount;
+};
+
+b32 BakeFont(text_font* Font, texture_atlas* Atlas);
+text_layout LayoutText(text_font* Font, quad_instance* Glyphs, u32 MaxGlyphs, const char* Text, r32 Size);
+text_layout* GetTextLayout(text_cache* Cache, text_font* Font, const char* Text, r32 Size);
+void PushTextLayout(text_batch* Batch, text_layout* Layout, v2 P, u32 Color);
+void PushText(text_batch* Batch, text_font* Font, v2 P, r32 Size, u32 Color, const char* Text);
+
+#define TEXT_H_
+#endif
@@ -1,5 +1,52 @@
 #include "vulkan_renderer.h"
 #include <algorithm>
+#include <string.h>
+#include <stddef.h>
+
+internal const char* RenderLayerNames[RenderLayer_Count] = 
+{
+    "Board",
+    "Pieces",
+    "Effects",
+    "UI",
+};
+
+// NOTE: How every use of an image is synchronized,
+// the barriers are built from the last and the next entry
+internal image_state ImageUsageStates[ImageUsage_Count] = 
+{
+    {VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT_KHR, 0},
+    {VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR, VK_ACCESS_2_TRANSFER_READ_BIT_KHR},
+    {VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR, VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR},
+    {VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT_KHR, VK_ACCESS_2_SHADER_READ_BIT_KHR},
+    {VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR, VK_ACCESS_2_SHADER_READ_BIT_KHR|VK_ACCESS_2_SHADER_WRITE_BIT_KHR},
+    {VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR, VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT_KHR|VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT_KHR},
+    {VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT_KHR, 0},
+};
+
+internal buffer_state BufferUsageStates[BufferUsage_Count] = 
+{
+    {VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR, VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR},
+    {VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT_KHR|VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT_KHR|VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR, VK_ACCESS_2_SHADER_READ_BIT_KHR},
+    {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR, VK_ACCESS_2_SHADER_READ_BIT_KHR|VK_ACCESS_2_SHADER_WRITE_BIT_KHR},
+    {VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT_KHR, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT_KHR},
+    {VK_PIPELINE_STAGE_2_VERTEX_INPUT_BIT_KHR, VK_ACCESS_2_INDEX_READ_BIT_KHR|VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT_KHR},
+};
+
+internal VkImageLayout
+GetSampledLayout(image& Image)
+{
+    VkImageLayout Result = Image.IsHostMapped ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    return Result;
+}
+
+#define MEMORY_WRITE_ACCESS (VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR| \
+                             VK_ACCESS_2_SHADER_WRITE_BIT_KHR| \
+                             VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT_KHR| \
+                             VK_ACCESS_2_HOST_WRITE_BIT_KHR| \
+                             VK_ACCESS_2_MEMORY_WRITE_BIT_KHR)
+
+#define PRESENT_WAIT_TIMEOUT 100000000ull
 
 vulkan_renderer::vulkan_renderer(SDL_Window* Window_, u32 Width_, u32 Height_)
 {
@@ -7,8 +54,35 @@ vulkan_renderer::vulkan_renderer(SDL_Window* Window_, u32 Width_, u32 Height_)
     Height = Height_;
     Window = Window_;
 
+    // NOTE: Without a window frames go into offscreen images
+    // and are read back instead of presented
+    IsHeadless = (Window_ == nullptr);
+
     ImageIndex = 0;
     Swapchain = 0;
+    Surface = VK_NULL_HANDLE;
+    FrameNumber = 0;
+    FrameIndex = 0;
+    ReadbackFrameNumber = 0;
+    ReadbackIndex = INVALID_READBACK_INDEX;
+    IsCaptureSupported = false;
+    Capture = nullptr;
+    Graph = {};
+    for(transient_image& Transient : Graph.Transients)
+    {
+        Transient.DescriptorIndex = INVALID_DESCRIPTOR_INDEX;
+    }
+
+    IsLowLatency = false;
+    DesiredImageCount = 0;
+    PresentMode = VK_PRESENT_MODE_FIFO_KHR;
+    IsSwapchainDirty = false;
+    RetiredSwapchain = VK_NULL_HANDLE;
+    IsPresentWaitEnabled = false;
+    PresentId = 0;
+    FirstPresentId = 1;
+    WaitForPresentKHR = nullptr;
+    IsDrawIndirectCountEnabled = false;
 }
 
 VkBool32 DebugReportCallback(VkDebugReportFlagsEXT Flags, VkDebugReportObjectTypeEXT ObjectType, 
@@ -20,7 +94,7 @@ VkBool32 DebugReportCallback(VkDebugReportFlagsEXT Flags, VkDebugReportObjectTyp
             "Performance Warning" : ((Flags & VK_DEBUG_REPORT_ERROR_BIT_EXT) ? "Error" : "Other")));
 
     char Message[2048];
-    sprintf_s(Message, 2047, "Error Type: %s / %s\n", Type, pMessage);
+    snprintf(Message, sizeof(Message), "Error Type: %s / %s\n", Type, pMessage);
     printf("%s", Message);
 
     return VK_FALSE;
@@ -47,10 +121,15 @@ InitVulkanRenderer()
 #endif
 
     std::vector<const char*> Extensions;
-    Extensions.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
+    if(!IsHeadless)
+    {
+        Extensions.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
 #if defined(VK_USE_PLATFORM_WIN32_KHR)
-    Extensions.push_back(VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
+        Extensions.push_back(VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
+#elif defined(VK_USE_PLATFORM_XLIB_KHR)
+        Extensions.push_back(VK_KHR_XLIB_SURFACE_EXTENSION_NAME);
 #endif
+    }
 #if CHESS_DEBUG
     Extensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
 #endif
@@ -78,19 +157,32 @@ InitVulkanRenderer()
     vkEnumeratePhysicalDevices(Instance, &DeviceCount, PhysicalDevices.data());
 
     // Pick physical device
-    // Picking first disrete gpu
+    // Preferring discrete gpu, but anything down to a cpu device (lavapipe, swiftshader)
+    // is accepted so the renderer can still run on machines without a gpu
     // Maybe picking gpu by user, but for that I should do another function
+    PhysicalDevice = VK_NULL_HANDLE;
+    u32 BestDeviceScore = 0;
     for(VkPhysicalDevice PhysDevice_ : PhysicalDevices)
     {
         VkPhysicalDeviceProperties PhysicalDeviceProperties = {};
         vkGetPhysicalDeviceProperties(PhysDevice_, &PhysicalDeviceProperties);
 
-        if(PhysicalDeviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)
+        u32 DeviceScore = 1;
+        switch(PhysicalDeviceProperties.deviceType)
+        {
+            case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:   DeviceScore = 5; break;
+            case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: DeviceScore = 4; break;
+            case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:    DeviceScore = 3; break;
+            case VK_PHYSICAL_DEVICE_TYPE_CPU:            DeviceScore = 2; break;
+        }
+
+        if(DeviceScore > BestDeviceScore)
         {
             PhysicalDevice = PhysDevice_;
-            break;
+            BestDeviceScore = DeviceScore;
         }
     }
+    Assert(PhysicalDevice != VK_NULL_HANDLE);
 
     // Create Device
     VkPhysicalDeviceFeatures DeviceFeatures;
@@ -111,6 +203,7 @@ InitVulkanRenderer()
     vkGetPhysicalDeviceQueueFamilyProperties(PhysicalDevice, &QueueFamiliesCount, QueueFamilies.data());
 
     QueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    TransferFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
     VkQueueFlags DesiredQueueCapabilities = VK_QUEUE_GRAPHICS_BIT;
     for(u32 Index = 0;
         Index < QueueFamiliesCount;
@@ -121,81 +214,237 @@ InitVulkanRenderer()
         {
             QueueFamilyIndex = Index;
         }
+
+        // NOTE: A family without graphics and compute is usually the dma engine
+        VkQueueFlags QueueFlags = QueueFamilyProperties_.queueFlags;
+        if((QueueFamilyProperties_.queueCount > 0) && (QueueFlags & VK_QUEUE_TRANSFER_BIT) && 
+           !(QueueFlags & (VK_QUEUE_GRAPHICS_BIT|VK_QUEUE_COMPUTE_BIT)))
+        {
+            TransferFamilyIndex = Index;
+        }
     }
+    Assert(QueueFamilyIndex != VK_QUEUE_FAMILY_IGNORED);
 
     std::vector<float> QueuePriorities;
     QueuePriorities.push_back(1.0f);
 
-    VkDeviceQueueCreateInfo DeviceQueueCreateInfo = {};
+    VkDeviceQueueCreateInfo DeviceQueueCreateInfos[2] = {};
+    u32 DeviceQueueCreateInfoCount = 0;
+
+    VkDeviceQueueCreateInfo& DeviceQueueCreateInfo = DeviceQueueCreateInfos[DeviceQueueCreateInfoCount++];
     DeviceQueueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    DeviceQueueCreateInfo.queueFamilyIndex = QueueFamilyIndex;
     DeviceQueueCreateInfo.queueCount = (u32)QueuePriorities.size();
     DeviceQueueCreateInfo.pQueuePriorities = QueuePriorities.data();
 
+    // NOTE: Without a transfer only family the uploads go to the graphics queue,
+    // they are still not waited on, but there is nothing to hand over then
+    if(TransferFamilyIndex != VK_QUEUE_FAMILY_IGNORED)
+    {
+        VkDeviceQueueCreateInfo& TransferQueueCreateInfo = DeviceQueueCreateInfos[DeviceQueueCreateInfoCount++];
+        TransferQueueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        TransferQueueCreateInfo.queueFamilyIndex = TransferFamilyIndex;
+        TransferQueueCreateInfo.queueCount = (u32)QueuePriorities.size();
+        TransferQueueCreateInfo.pQueuePriorities = QueuePriorities.data();
+    }
+    else
+    {
+        TransferFamilyIndex = QueueFamilyIndex;
+    }
+
+    u32 DeviceExtensionsCount;
+    vkEnumerateDeviceExtensionProperties(PhysicalDevice, nullptr, &DeviceExtensionsCount, nullptr);
+    std::vector<VkExtensionProperties> AvailableDeviceExtensions(DeviceExtensionsCount);
+    vkEnumerateDeviceExtensionProperties(PhysicalDevice, nullptr, &DeviceExtensionsCount, AvailableDeviceExtensions.data());
+
+    b32 IsPushDescriptorSupported = false;
+    b32 IsSynchronization2Available = false;
+    b32 IsPresentIdAvailable = false;
+    b32 IsPresentWaitAvailable = false;
+    for(VkExtensionProperties& Extension : AvailableDeviceExtensions)
+    {
+        if(strcmp(Extension.extensionName, VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME) == 0)
+        {
+            IsPushDescriptorSupported = true;
+        }
+        if(strcmp(Extension.extensionName, VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME) == 0)
+        {
+            IsSynchronization2Available = true;
+        }
+        if(strcmp(Extension.extensionName, VK_KHR_PRESENT_ID_EXTENSION_NAME) == 0)
+        {
+            IsPresentIdAvailable = true;
+        }
+        if(strcmp(Extension.extensionName, VK_KHR_PRESENT_WAIT_EXTENSION_NAME) == 0)
+        {
+            IsPresentWaitAvailable = true;
+        }
+    }
+    IsPresentWaitAvailable = IsPresentWaitAvailable && IsPresentIdAvailable && !IsHeadless;
+
     std::vector<const char*> DeviceExtensions;
-    DeviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
-    DeviceExtensions.push_back(VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME);
+    if(!IsHeadless)
+    {
+        DeviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+    }
+    if(IsPushDescriptorSupported)
+    {
+        DeviceExtensions.push_back(VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME);
+    }
+
+    VkPhysicalDevicePresentWaitFeaturesKHR FeaturesPresentWait = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR};
+    VkPhysicalDevicePresentIdFeaturesKHR FeaturesPresentId = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR};
+    VkPhysicalDeviceSynchronization2FeaturesKHR FeaturesSync2 = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR};
+    VkPhysicalDeviceVulkan12Features Features12 = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES};
+    VkPhysicalDeviceFeatures2 Features = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2};
+    Features.pNext = &Features12;
+    if(IsSynchronization2Available)
+    {
+        Features12.pNext = &FeaturesSync2;
+    }
+    if(IsPresentWaitAvailable)
+    {
+        FeaturesPresentId.pNext = Features12.pNext;
+        FeaturesPresentWait.pNext = &FeaturesPresentId;
+        Features12.pNext = &FeaturesPresentWait;
+    }
+    vkGetPhysicalDeviceFeatures2(PhysicalDevice, &Features);
+
+    // NOTE: Barriers are recorded with vkCmdPipelineBarrier when this is missing
+    b32 IsSynchronization2Supported = IsSynchronization2Available && FeaturesSync2.synchronization2;
+    if(IsSynchronization2Supported)
+    {
+        DeviceExtensions.push_back(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
+    }
+
+    // NOTE: Without present wait frames are only paced by the swapchain queue
+    IsPresentWaitEnabled = IsPresentWaitAvailable && FeaturesPresentId.presentId && FeaturesPresentWait.presentWait;
+    if(IsPresentWaitEnabled)
+    {
+        DeviceExtensions.push_back(VK_KHR_PRESENT_ID_EXTENSION_NAME);
+        DeviceExtensions.push_back(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+    }
+
+    // NOTE: Only what the bindless arrays need is enabled, the arrays are
+    // indexed with push constants so non uniform indexing is not needed
+    IsBindless = Features.features.shaderSampledImageArrayDynamicIndexing &&
+                 Features.features.shaderStorageBufferArrayDynamicIndexing &&
+                 Features12.descriptorBindingSampledImageUpdateAfterBind &&
+                 Features12.descriptorBindingStorageBufferUpdateAfterBind &&
+                 Features12.descriptorBindingUpdateUnusedWhilePending &&
+                 Features12.descriptorBindingPartiallyBound;
+    Assert(IsBindless || IsPushDescriptorSupported);
+
+    VkPhysicalDevicePresentWaitFeaturesKHR EnabledFeaturesPresentWait = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR};
+    VkPhysicalDevicePresentIdFeaturesKHR EnabledFeaturesPresentId = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR};
+    VkPhysicalDeviceSynchronization2FeaturesKHR EnabledFeaturesSync2 = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR};
+    VkPhysicalDeviceVulkan12Features EnabledFeatures12 = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES};
+    VkPhysicalDeviceFeatures2 EnabledFeatures = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2};
+    EnabledFeatures.pNext = &EnabledFeatures12;
+    if(IsSynchronization2Supported)
+    {
+        EnabledFeaturesSync2.synchronization2 = VK_TRUE;
+        EnabledFeatures12.pNext = &EnabledFeaturesSync2;
+    }
+    if(IsPresentWaitEnabled)
+    {
+        EnabledFeaturesPresentId.presentId = VK_TRUE;
+        EnabledFeaturesPresentId.pNext = EnabledFeatures12.pNext;
+        EnabledFeaturesPresentWait.presentWait = VK_TRUE;
+        EnabledFeaturesPresentWait.pNext = &EnabledFeaturesPresentId;
+        EnabledFeatures12.pNext = &EnabledFeaturesPresentWait;
+    }
+    EnabledFeatures.features.shaderSampledImageArrayDynamicIndexing = Features.features.shaderSampledImageArrayDynamicIndexing;
+    EnabledFeatures.features.shaderStorageBufferArrayDynamicIndexing = Features.features.shaderStorageBufferArrayDynamicIndexing;
+    b32 IsStatisticsSupported = Features.features.pipelineStatisticsQuery && Features.features.inheritedQueries;
+    EnabledFeatures.features.pipelineStatisticsQuery = IsStatisticsSupported;
+    EnabledFeatures.features.inheritedQueries = IsStatisticsSupported;
+    EnabledFeatures12.hostQueryReset = Features12.hostQueryReset;
+    EnabledFeatures12.timelineSemaphore = VK_TRUE;
+    EnabledFeatures12.drawIndirectCount = Features12.drawIndirectCount;
+    IsDrawIndirectCountEnabled = Features12.drawIndirectCount;
+    if(IsBindless)
+    {
+        EnabledFeatures12.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+        EnabledFeatures12.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+        EnabledFeatures12.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+        EnabledFeatures12.descriptorBindingPartiallyBound = VK_TRUE;
+    }
 
     VkDeviceCreateInfo DeviceCreateInfo = {};
     DeviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-    DeviceCreateInfo.queueCreateInfoCount = 1;
-    DeviceCreateInfo.pQueueCreateInfos = &DeviceQueueCreateInfo;
+    DeviceCreateInfo.pNext = &EnabledFeatures;
+    DeviceCreateInfo.queueCreateInfoCount = DeviceQueueCreateInfoCount;
+    DeviceCreateInfo.pQueueCreateInfos = DeviceQueueCreateInfos;
     DeviceCreateInfo.enabledExtensionCount = (u32)DeviceExtensions.size();
     DeviceCreateInfo.ppEnabledExtensionNames = DeviceExtensions.data();
 
     vkCreateDevice(PhysicalDevice, &DeviceCreateInfo, 0, &LogicalDevice);
 
+    // NOTE: Extension functions are resolved once for the device
+    CmdPushDescriptorSet = IsPushDescriptorSupported ? (PFN_vkCmdPushDescriptorSetKHR)vkGetDeviceProcAddr(LogicalDevice, "vkCmdPushDescriptorSetKHR") : nullptr;
+    CmdPipelineBarrier2 = IsSynchronization2Supported ? (PFN_vkCmdPipelineBarrier2KHR)vkGetDeviceProcAddr(LogicalDevice, "vkCmdPipelineBarrier2KHR") : nullptr;
+    WaitForPresentKHR = IsPresentWaitEnabled ? (PFN_vkWaitForPresentKHR)vkGetDeviceProcAddr(LogicalDevice, "vkWaitForPresentKHR") : nullptr;
+
     vkGetPhysicalDeviceMemoryProperties(PhysicalDevice, &MemProperty);
     vkGetDeviceQueue(LogicalDevice, QueueFamilyIndex, 0, &Queue);
+    vkGetDeviceQueue(LogicalDevice, TransferFamilyIndex, 0, &TransferQueue);
 
-    // Create Surface
-    VkWin32SurfaceCreateInfoKHR SurfaceCreateInfo = {};
-    SurfaceCreateInfo.sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR;
+    if(!IsHeadless)
+    {
+        // Create Surface
+        SDL_SysWMinfo WindowInfo;
+        SDL_VERSION(&WindowInfo.version);
+        SDL_GetWindowWMInfo(Window, &WindowInfo);
 
 #if defined(VK_USE_PLATFORM_WIN32_KHR)
-    SDL_SysWMinfo WindowInfo;
-    SDL_VERSION(&WindowInfo.version);
-    SDL_GetWindowWMInfo(Window, &WindowInfo);
-
-    SurfaceCreateInfo.hinstance = WindowInfo.info.win.hinstance;
-    SurfaceCreateInfo.hwnd = WindowInfo.info.win.window;
+        VkWin32SurfaceCreateInfoKHR SurfaceCreateInfo = {};
+        SurfaceCreateInfo.sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR;
+        SurfaceCreateInfo.hinstance = WindowInfo.info.win.hinstance;
+        SurfaceCreateInfo.hwnd = WindowInfo.info.win.window;
+
+        vkCreateWin32SurfaceKHR(Instance, &SurfaceCreateInfo, 0, &Surface);
+#elif defined(VK_USE_PLATFORM_XLIB_KHR)
+        VkXlibSurfaceCreateInfoKHR SurfaceCreateInfo = {};
+        SurfaceCreateInfo.sType = VK_STRUCTURE_TYPE_XLIB_SURFACE_CREATE_INFO_KHR;
+        SurfaceCreateInfo.dpy = WindowInfo.info.x11.display;
+        SurfaceCreateInfo.window = WindowInfo.info.x11.window;
+
+        vkCreateXlibSurfaceKHR(Instance, &SurfaceCreateInfo, 0, &Surface);
 #endif
 
-    vkCreateWin32SurfaceKHR(Instance, &SurfaceCreateInfo, 0, &Surface);
-
-    VkBool32 PresentSupported = VK_FALSE;
-    vkGetPhysicalDeviceSurfaceSupportKHR(PhysicalDevice, QueueFamilyIndex, Surface, &PresentSupported);
-
-    VkPresentModeKHR DesiredPresentMode;
-
-    u32 PresentModesCount;
-    vkGetPhysicalDeviceSurfacePresentModesKHR(PhysicalDevice, Surface, &PresentModesCount, nullptr);
-    std::vector<VkPresentModeKHR> PresentModes(PresentModesCount);
-    vkGetPhysicalDeviceSurfacePresentModesKHR(PhysicalDevice, Surface, &PresentModesCount, PresentModes.data());
+        VkBool32 PresentSupported = VK_FALSE;
+        vkGetPhysicalDeviceSurfaceSupportKHR(PhysicalDevice, QueueFamilyIndex, Surface, &PresentSupported);
 
-    DesiredPresentMode = PresentModes[PresentModes.size() - 1];
+        u32 SurfaceFormatCount;
+        vkGetPhysicalDeviceSurfaceFormatsKHR(PhysicalDevice, Surface, &SurfaceFormatCount, nullptr);
+        std::vector<VkSurfaceFormatKHR> SurfaceFormats(SurfaceFormatCount);
+        vkGetPhysicalDeviceSurfaceFormatsKHR(PhysicalDevice, Surface, &SurfaceFormatCount, SurfaceFormats.data());
 
-    u32 SurfaceFormatCount;
-    vkGetPhysicalDeviceSurfaceFormatsKHR(PhysicalDevice, Surface, &SurfaceFormatCount, nullptr);
-    std::vector<VkSurfaceFormatKHR> SurfaceFormats(SurfaceFormatCount);
-    vkGetPhysicalDeviceSurfaceFormatsKHR(PhysicalDevice, Surface, &SurfaceFormatCount, SurfaceFormats.data());
-
-    for(u32 SurfaceFormatIndex = 0;
-        SurfaceFormatIndex < SurfaceFormatCount;
-        ++SurfaceFormatIndex)
-    {
-        VkSurfaceFormatKHR SurfaceFormat_ = SurfaceFormats[SurfaceFormatIndex];
-        if(SurfaceFormat_.format == VK_FORMAT_B8G8R8A8_UNORM)
+        for(u32 SurfaceFormatIndex = 0;
+            SurfaceFormatIndex < SurfaceFormatCount;
+            ++SurfaceFormatIndex)
         {
-            SwapchainSurfaceFormat = SurfaceFormat_;
-            break;
+            VkSurfaceFormatKHR SurfaceFormat_ = SurfaceFormats[SurfaceFormatIndex];
+            if(SurfaceFormat_.format == VK_FORMAT_B8G8R8A8_UNORM)
+            {
+                SwapchainSurfaceFormat = SurfaceFormat_;
+                break;
+            }
         }
     }
+    else
+    {
+        // NOTE: Offscreen targets use the format the swapchain would have
+        SwapchainSurfaceFormat.format = VK_FORMAT_B8G8R8A8_UNORM;
+        SwapchainSurfaceFormat.colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
+    }
 
-    CreateSwapchain();
+    // NOTE: The passes only depend on the format, so they outlive the swapchain
+    RenderPass = CreateRenderPass(VK_ATTACHMENT_LOAD_OP_CLEAR);
+    LoadRenderPass = CreateRenderPass(VK_ATTACHMENT_LOAD_OP_LOAD);
 
-    AcquireSemaphore = CreateSemaphore();
-    ReleaseSemaphore = CreateSemaphore();
-    Fence = CreateFence();
+    CreateSwapchain();
 
     VkCommandPoolCreateInfo CommandPoolCreateInfo = {};
     CommandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
@@ -210,7 +459,50 @@ InitVulkanRenderer()
     CommandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
     CommandBufferAllocateInfo.commandBufferCount = 1;
 
-    vkAllocateCommandBuffers(LogicalDevice, &CommandBufferAllocateInfo, &CommandBuffer);
+    for(render_frame& Frame : Frames)
+    {
+        vkAllocateCommandBuffers(LogicalDevice, &CommandBufferAllocateInfo, &Frame.CommandBuffer);
+        Frame.Fence = CreateFence();
+        Frame.AcquireSemaphore = IsHeadless ? VK_NULL_HANDLE : CreateSemaphore();
+        Frame.IsPending = false;
+        Frame.FrameNumber = 0;
+    }
+    CommandBuffer = Frames[0].CommandBuffer;
+
+    CommandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    CommandPoolCreateInfo.queueFamilyIndex = TransferFamilyIndex;
+    VK_CHECK(vkCreateCommandPool(LogicalDevice, &CommandPoolCreateInfo, 0, &TransferCommandPool));
+    CommandPoolCreateInfo.queueFamilyIndex = QueueFamilyIndex;
+
+    TransferSemaphore = CreateTimelineSemaphore();
+    GraphicsSemaphore = CreateTimelineSemaphore();
+    TransferValue = 0;
+    GraphicsValue = 0;
+    AcquiredTransferValue = 0;
+    WaitedTransferValue = 0;
+
+    // NOTE: There is never more work than layers in a frame
+    u32 CoreCount = std::thread::hardware_concurrency();
+    u32 RecordThreadCount = (CoreCount > 1) ? (CoreCount - 1) : 1;
+    InitWorkQueue(&RecordQueue, Min(RecordThreadCount, (u32)RenderLayer_Count));
+    for(render_frame& Frame : Frames)
+    {
+        Frame.ThreadCommands.resize(GetThreadCount(&RecordQueue));
+        for(thread_commands& Commands : Frame.ThreadCommands)
+        {
+            CommandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+            VK_CHECK(vkCreateCommandPool(LogicalDevice, &CommandPoolCreateInfo, 0, &Commands.CommandPool));
+            Commands.UsedCount = 0;
+        }
+    }
+    for(render_layer_job& Job : LayerJobs)
+    {
+        Job = {};
+    }
+
+    TimestampPeriod = DeviceProperties.limits.timestampPeriod;
+    InitProfiler(QueueFamilies[QueueFamilyIndex].timestampValidBits, Features12.hostQueryReset, IsStatisticsSupported);
+    IsTransferProfilingEnabled = IsProfilingEnabled && (QueueFamilies[TransferFamilyIndex].timestampValidBits > 0);
 
     MainImageSampler = CreateSampler(VK_FILTER_LINEAR, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
 }
@@ -241,7 +533,7 @@ vulkan_renderer::WriteImage(VkDescriptorImageInfo* ImageInfo, VkDescriptorSet Se
     return WriteDescriptorResult;
 }
 
-void vulkan_renderer::
+shader vulkan_renderer::
 UploadShader(const char* Path, VkShaderStageFlagBits Stages)
 {
     FILE* ShaderFile = fopen(Path, "rb");
@@ -268,35 +560,311 @@ UploadShader(const char* Path, VkShaderStageFlagBits Stages)
 
         ShaderModules.push_back(ShaderResult);
     }
+
+    return ShaderResult;
 }
 
 void vulkan_renderer::
 InitGraphicsPipeline()
 {
-    VkDescriptorSetLayout DescriptorLayout = CreateDescriptorSetLayout();
+    MainDescriptorLayout = CreateDescriptorSetLayout();
+
+    VkPushConstantRange PushConstantRange = {};
+    PushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT|VK_SHADER_STAGE_FRAGMENT_BIT;
+    PushConstantRange.offset = 0;
+    PushConstantRange.size = MAX_PUSH_CONSTANTS_SIZE;
 
     VkPipelineLayoutCreateInfo PipelineLayoutCreateInfo = {VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
-    PipelineLayoutCreateInfo.pSetLayouts = &DescriptorLayout;
+    PipelineLayoutCreateInfo.pSetLayouts = &MainDescriptorLayout;
     PipelineLayoutCreateInfo.setLayoutCount = 1;
+    PipelineLayoutCreateInfo.pPushConstantRanges = &PushConstantRange;
+    PipelineLayoutCreateInfo.pushConstantRangeCount = 1;
 
     vkCreatePipelineLayout(LogicalDevice, &PipelineLayoutCreateInfo, 0, &MainPipelineLayout);
 
-    VkDescriptorPool DescriptorPool = CreateDescriptorPool();
+    MainDescriptorPool = CreateDescriptorPool();
+
+    // NOTE: One cache shared by every pipeline, it is internally synchronized
+    // so the worker threads can use it at the same time. The data of the last
+    // run is reused, the driver rejects it if it doesn't match the device.
+    std::vector<u8> PipelineCacheData;
+    FILE* PipelineCacheFile = fopen(PIPELINE_CACHE_PATH, "rb");
+    if(PipelineCacheFile)
+    {
+        fseek(PipelineCacheFile, 0, SEEK_END);
+        PipelineCacheData.resize(ftell(PipelineCacheFile));
+        fseek(PipelineCacheFile, 0, SEEK_SET);
+        fread(PipelineCacheData.data(), 1, PipelineCacheData.size(), PipelineCacheFile);
+        fclose(PipelineCacheFile);
+    }
+
+    VkPipelineCacheCreateInfo PipelineCacheCreateInfo = {VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO};
+    PipelineCacheCreateInfo.initialDataSize = PipelineCacheData.size();
+    PipelineCacheCreateInfo.pInitialData = PipelineCacheData.data();
+    VK_CHECK(vkCreatePipelineCache(LogicalDevice, &PipelineCacheCreateInfo, 0, &PipelineCache));
+
+    InitWorkQueue(&PipelineQueue);
 
     VkDescriptorSetAllocateInfo DescriptorAllocateInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
-    DescriptorAllocateInfo.descriptorPool = DescriptorPool;
-    DescriptorAllocateInfo.pSetLayouts = &DescriptorLayout;
+    DescriptorAllocateInfo.descriptorPool = MainDescriptorPool;
+
+    // NOTE: The bindless set is allocated once and bound by every draw,
+    // push descriptors don't need a set at all
+    MainDescriptor = VK_NULL_HANDLE;
+    BufferDescriptorCount = 0;
+    ImageDescriptorCount = 0;
+    if(IsBindless)
+    {
+        DescriptorAllocateInfo.pSetLayouts = &MainDescriptorLayout;
+        DescriptorAllocateInfo.descriptorSetCount = 1;
+        VK_CHECK(vkAllocateDescriptorSets(LogicalDevice, &DescriptorAllocateInfo, &MainDescriptor));
+    }
+
+    // NOTE: The raster compute pass reads the command stream
+    // and writes the target image as raw 32 bit pixels
+    VkDescriptorSetLayoutBinding RasterBindings[2] = {};
+    RasterBindings[0].binding = 0;
+    RasterBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    RasterBindings[0].descriptorCount = 1;
+    RasterBindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    RasterBindings[1].binding = 1;
+    RasterBindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    RasterBindings[1].descriptorCount = 1;
+    RasterBindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkDescriptorSetLayoutCreateInfo RasterLayoutCreateInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO};
+    RasterLayoutCreateInfo.pBindings = RasterBindings;
+    RasterLayoutCreateInfo.bindingCount = ArraySize(RasterBindings);
+    VK_CHECK(vkCreateDescriptorSetLayout(LogicalDevice, &RasterLayoutCreateInfo, 0, &RasterDescriptorLayout));
+
+    VkPushConstantRange RasterConstantRange = {};
+    RasterConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    RasterConstantRange.offset = 0;
+    RasterConstantRange.size = sizeof(u32);
+
+    VkPipelineLayoutCreateInfo RasterPipelineLayoutCreateInfo = {VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+    RasterPipelineLayoutCreateInfo.pSetLayouts = &RasterDescriptorLayout;
+    RasterPipelineLayoutCreateInfo.setLayoutCount = 1;
+    RasterPipelineLayoutCreateInfo.pPushConstantRanges = &RasterConstantRange;
+    RasterPipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    VK_CHECK(vkCreatePipelineLayout(LogicalDevice, &RasterPipelineLayoutCreateInfo, 0, &RasterPipelineLayout));
+
+    DescriptorAllocateInfo.pSetLayouts = &RasterDescriptorLayout;
+    DescriptorAllocateInfo.descriptorSetCount = 1;
+    for(render_frame& Frame : Frames)
+    {
+        VK_CHECK(vkAllocateDescriptorSets(LogicalDevice, &DescriptorAllocateInfo, &Frame.RasterDescriptor));
+        Frame.RasterTargetView = VK_NULL_HANDLE;
+        Frame.RasterCommandsBuffer = VK_NULL_HANDLE;
+    }
+
+    // NOTE: The cull pass reads the instances and writes
+    // the visible ones together with their indirect draw
+    VkDescriptorSetLayoutBinding CullBindings[3] = {};
+    for(u32 BindingIndex = 0;
+        BindingIndex < ArraySize(CullBindings);
+        ++BindingIndex)
+    {
+        CullBindings[BindingIndex].binding = BindingIndex;
+        CullBindings[BindingIndex].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        CullBindings[BindingIndex].descriptorCount = 1;
+        CullBindings[BindingIndex].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo CullLayoutCreateInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO};
+    CullLayoutCreateInfo.pBindings = CullBindings;
+    CullLayoutCreateInfo.bindingCount = ArraySize(CullBindings);
+    VK_CHECK(vkCreateDescriptorSetLayout(LogicalDevice, &CullLayoutCreateInfo, 0, &CullDescriptorLayout));
+
+    // NOTE: View rectangle followed by the instance count
+    VkPushConstantRange CullConstantRange = {};
+    CullConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    CullConstantRange.offset = 0;
+    CullConstantRange.size = sizeof(rectangle2) + sizeof(u32);
+
+    VkPipelineLayoutCreateInfo CullPipelineLayoutCreateInfo = {VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+    CullPipelineLayoutCreateInfo.pSetLayouts = &CullDescriptorLayout;
+    CullPipelineLayoutCreateInfo.setLayoutCount = 1;
+    CullPipelineLayoutCreateInfo.pPushConstantRanges = &CullConstantRange;
+    CullPipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    VK_CHECK(vkCreatePipelineLayout(LogicalDevice, &CullPipelineLayoutCreateInfo, 0, &CullPipelineLayout));
+
+    DescriptorAllocateInfo.pSetLayouts = &CullDescriptorLayout;
     DescriptorAllocateInfo.descriptorSetCount = 1;
+    for(render_frame& Frame : Frames)
+    {
+        VK_CHECK(vkAllocateDescriptorSets(LogicalDevice, &DescriptorAllocateInfo, &Frame.CullDescriptor));
+        for(u32 BufferIndex = 0;
+            BufferIndex < ArraySize(Frame.CullBuffers);
+            ++BufferIndex)
+        {
+            Frame.CullBuffers[BufferIndex] = VK_NULL_HANDLE;
+        }
+    }
+}
+
+material vulkan_renderer::
+CreateComputeMaterial(const shader& ComputeShader, compute_layout Layout)
+{
+    material Result = {};
+    Result.PipelineLayout = (Layout == ComputeLayout_Cull) ? CullPipelineLayout : RasterPipelineLayout;
+
+    VkComputePipelineCreateInfo ComputePipelineCreateInfo = {VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+    ComputePipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    ComputePipelineCreateInfo.stage.stage = ComputeShader.Stage;
+    ComputePipelineCreateInfo.stage.module = ComputeShader.Module;
+    ComputePipelineCreateInfo.stage.pName = "main";
+    ComputePipelineCreateInfo.layout = Result.PipelineLayout;
+
+    VK_CHECK(vkCreateComputePipelines(LogicalDevice, PipelineCache, 1, &ComputePipelineCreateInfo, 0, &Result.Pipeline));
+
+    return Result;
+}
+
+// NOTE: FNV-1a over the fields, padding of the description is never hashed
+u64 vulkan_renderer::
+HashMaterialDesc(const material_desc& Desc)
+{
+    u64 Hash = 14695981039346656037ull;
+    auto HashValue = [&Hash](u64 Value)
+    {
+        for(u32 ByteIndex = 0;
+            ByteIndex < sizeof(Value);
+            ++ByteIndex)
+        {
+            Hash ^= (Value >> (ByteIndex*8)) & 0xFF;
+            Hash *= 1099511628211ull;
+        }
+    };
+
+    for(u32 ShaderIndex = 0;
+        ShaderIndex < Desc.ShaderCount;
+        ++ShaderIndex)
+    {
+        HashValue((u64)Desc.Shaders[ShaderIndex].Module);
+        HashValue((u64)Desc.Shaders[ShaderIndex].Stage);
+    }
+    HashValue(Desc.BlendMode);
+    HashValue(Desc.Topology);
+    for(u32 ConstantIndex = 0;
+        ConstantIndex < Desc.SpecConstantCount;
+        ++ConstantIndex)
+    {
+        HashValue(Desc.SpecConstants[ConstantIndex]);
+    }
 
-    VK_CHECK(vkAllocateDescriptorSets(LogicalDevice, &DescriptorAllocateInfo, &MainDescriptor));
+    return Hash;
+}
+
+// NOTE: Compares the same fields the hash is built from
+b32 vulkan_renderer::
+AreMaterialDescsEqual(const material_desc& A, const material_desc& B)
+{
+    if((A.ShaderCount != B.ShaderCount) ||
+       (A.BlendMode != B.BlendMode) ||
+       (A.Topology != B.Topology) ||
+       (A.SpecConstantCount != B.SpecConstantCount))
+    {
+        return false;
+    }
+
+    for(u32 ShaderIndex = 0;
+        ShaderIndex < A.ShaderCount;
+        ++ShaderIndex)
+    {
+        if((A.Shaders[ShaderIndex].Module != B.Shaders[ShaderIndex].Module) ||
+           (A.Shaders[ShaderIndex].Stage != B.Shaders[ShaderIndex].Stage))
+        {
+            return false;
+        }
+    }
+    for(u32 ConstantIndex = 0;
+        ConstantIndex < A.SpecConstantCount;
+        ++ConstantIndex)
+    {
+        if(A.SpecConstants[ConstantIndex] != B.SpecConstants[ConstantIndex])
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// NOTE: Returns the material for the description right away. The first
+// request only queues the compilation, until it is done the pipeline
+// is null and draws with it are skipped instead of stalling the frame.
+material vulkan_renderer::
+GetMaterial(const material_desc& Desc)
+{
+    u64 Key = HashMaterialDesc(Desc);
+
+    material_entry*& FirstInHash = Materials[Key];
+    material_entry* Entry = FirstInHash;
+    while(Entry && !AreMaterialDescsEqual(Entry->Desc, Desc))
+    {
+        Entry = Entry->NextInHash;
+    }
+
+    if(!Entry)
+    {
+        Entry = new material_entry();
+        Entry->Desc = Desc;
+        Entry->PipelineLayout = MainPipelineLayout;
+        Entry->Pipeline = VK_NULL_HANDLE;
+        Entry->Renderer = this;
+        Entry->NextInHash = FirstInHash;
+        FirstInHash = Entry;
+
+        AddEntry(&PipelineQueue, CompileMaterial, Entry);
+    }
+
+    material Result = {};
+    Result.Pipeline = Entry->Pipeline;
+    Result.PipelineLayout = Entry->PipelineLayout;
+
+    return Result;
+}
+
+void vulkan_renderer::
+CompileMaterial(u32 ThreadIndex, void* Data)
+{
+    material_entry* Entry = (material_entry*)Data;
+    Entry->Pipeline = Entry->Renderer->CreatePipeline(Entry->Desc);
+}
+
+// NOTE: Called from the worker threads, it only reads state that
+// doesn't change after InitGraphicsPipeline
+VkPipeline vulkan_renderer::
+CreatePipeline(const material_desc& Desc)
+{
+    VkSpecializationMapEntry SpecMapEntries[SpecConstant_Count];
+    for(u32 ConstantIndex = 0;
+        ConstantIndex < Desc.SpecConstantCount;
+        ++ConstantIndex)
+    {
+        SpecMapEntries[ConstantIndex].constantID = ConstantIndex;
+        SpecMapEntries[ConstantIndex].offset = ConstantIndex*sizeof(u32);
+        SpecMapEntries[ConstantIndex].size = sizeof(u32);
+    }
+
+    VkSpecializationInfo SpecInfo = {};
+    SpecInfo.mapEntryCount = Desc.SpecConstantCount;
+    SpecInfo.pMapEntries = SpecMapEntries;
+    SpecInfo.dataSize = Desc.SpecConstantCount*sizeof(u32);
+    SpecInfo.pData = Desc.SpecConstants;
 
     std::vector<VkPipelineShaderStageCreateInfo> Stages;
-    for(shader Shader_ : ShaderModules)
+    for(u32 ShaderIndex = 0;
+        ShaderIndex < Desc.ShaderCount;
+        ++ShaderIndex)
     {
         VkPipelineShaderStageCreateInfo ShaderInfo = {VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO};
-        ShaderInfo.stage = Shader_.Stage;
-        ShaderInfo.module = Shader_.Module;
+        ShaderInfo.stage = Desc.Shaders[ShaderIndex].Stage;
+        ShaderInfo.module = Desc.Shaders[ShaderIndex].Module;
         ShaderInfo.pName = "main";
+        ShaderInfo.pSpecializationInfo = Desc.SpecConstantCount ? &SpecInfo : nullptr;
         Stages.push_back(ShaderInfo);
     }
 
@@ -304,7 +872,7 @@ InitGraphicsPipeline()
 
     VkPipelineInputAssemblyStateCreateInfo    InputAssemblyState = {VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO};
     //InputAssemblyState.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST_WITH_ADJACENCY;
-    InputAssemblyState.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    InputAssemblyState.topology = Desc.Topology;
 
     VkPipelineViewportStateCreateInfo         ViewportState = {VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO};
     ViewportState.viewportCount = 1;
@@ -322,6 +890,27 @@ InitGraphicsPipeline()
 
     VkPipelineColorBlendAttachmentState ColorBlendAttachment = {};
     ColorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    ColorBlendAttachment.blendEnable = (Desc.BlendMode != BlendMode_Opaque);
+    ColorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+    ColorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+    switch(Desc.BlendMode)
+    {
+        case BlendMode_Opaque:
+        case BlendMode_Alpha:
+        {
+            ColorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+            ColorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+            ColorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+            ColorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+        } break;
+        case BlendMode_Additive:
+        {
+            ColorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+            ColorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+            ColorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+            ColorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+        } break;
+    }
 
     VkPipelineColorBlendStateCreateInfo       ColorBlendState = {VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO};
     ColorBlendState.pAttachments = &ColorBlendAttachment;
@@ -347,11 +936,16 @@ InitGraphicsPipeline()
     GPCreateInfo.layout = MainPipelineLayout;
     GPCreateInfo.renderPass = RenderPass;
 
-    VkPipelineCache PipelineCache = 0;
-    vkCreateGraphicsPipelines(LogicalDevice, PipelineCache, 1, &GPCreateInfo, 0, &MainPipeline);
+    VkPipeline Result = VK_NULL_HANDLE;
+    VK_CHECK(vkCreateGraphicsPipelines(LogicalDevice, PipelineCache, 1, &GPCreateInfo, 0, &Result));
+
+    return Result;
 }
 
-void vulkan_renderer::
+// NOTE: Also recreates the swapchain, the old one is handed over so the image
+// it is showing stays valid. Returns false while the window has no area, the
+// swapchain stays dirty until it can be created again.
+b32 vulkan_renderer::
 CreateSwapchain(u32 WindowWidth_, u32 WindowHeight_)
 {
     if(!WindowWidth_)
@@ -364,129 +958,381 @@ CreateSwapchain(u32 WindowWidth_, u32 WindowHeight_)
         WindowHeight_ = Height;
     }
 
-    VkSurfaceCapabilitiesKHR SurfaceCapabilities;
-    vkGetPhysicalDeviceSurfaceCapabilitiesKHR(PhysicalDevice, Surface, &SurfaceCapabilities);
-
-    VkCompositeAlphaFlagBitsKHR SurfaceComposite = 
-        (SurfaceCapabilities.supportedCompositeAlpha & VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR) 
-        ? VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR : 
-        (SurfaceCapabilities.supportedCompositeAlpha & VK_COMPOSITE_ALPHA_PRE_MULTIPLIED_BIT_KHR) 
-        ? VK_COMPOSITE_ALPHA_PRE_MULTIPLIED_BIT_KHR : 
-        (SurfaceCapabilities.supportedCompositeAlpha & VK_COMPOSITE_ALPHA_POST_MULTIPLIED_BIT_KHR) 
-        ? VK_COMPOSITE_ALPHA_POST_MULTIPLIED_BIT_KHR
-        : VK_COMPOSITE_ALPHA_INHERIT_BIT_KHR;
-
-    VkSwapchainCreateInfoKHR SwapchainCreateInfo = {};
-    SwapchainCreateInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-    SwapchainCreateInfo.surface = Surface;
-    SwapchainCreateInfo.minImageCount = Max(2, SurfaceCapabilities.minImageCount);
-    SwapchainCreateInfo.imageFormat = SwapchainSurfaceFormat.format;
-    SwapchainCreateInfo.imageUsage  = SurfaceCapabilities.supportedUsageFlags;
-    SwapchainCreateInfo.imageColorSpace = SwapchainSurfaceFormat.colorSpace;
-    SwapchainCreateInfo.imageExtent.width = WindowWidth_;
-    SwapchainCreateInfo.imageExtent.height = WindowHeight_;
-    SwapchainCreateInfo.imageArrayLayers = 1;
-    //SwapchainCreateInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-    SwapchainCreateInfo.queueFamilyIndexCount = 1;
-    SwapchainCreateInfo.pQueueFamilyIndices = &QueueFamilyIndex;
-    SwapchainCreateInfo.preTransform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR; //SurfaceCapabilities.currentTransform;
-    SwapchainCreateInfo.compositeAlpha = SurfaceComposite;
-    SwapchainCreateInfo.presentMode = VK_PRESENT_MODE_FIFO_KHR;
-
-    if(Swapchain)
+    if(IsHeadless)
     {
-        SwapchainCreateInfo.oldSwapchain = Swapchain;
+        CreateOffscreenTargets(WindowWidth_, WindowHeight_);
+        IsCaptureSupported = true;
     }
+    else
+    {
+        VkSurfaceCapabilitiesKHR SurfaceCapabilities;
+        vkGetPhysicalDeviceSurfaceCapabilitiesKHR(PhysicalDevice, Surface, &SurfaceCapabilities);
+
+        // NOTE: The swapchain images get every usage the surface supports,
+        // capturing only needs them to be a copy source
+        IsCaptureSupported = (SurfaceCapabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT) != 0;
+
+        // NOTE: The surface decides the size, unless it leaves it to the swapchain
+        if(SurfaceCapabilities.currentExtent.width != ~0u)
+        {
+            WindowWidth_ = SurfaceCapabilities.currentExtent.width;
+            WindowHeight_ = SurfaceCapabilities.currentExtent.height;
+        }
+        else
+        {
+            i32 WindowWidth = 0;
+            i32 WindowHeight = 0;
+            SDL_GetWindowSize(Window, &WindowWidth, &WindowHeight);
+            WindowWidth_ = Max((u32)WindowWidth, SurfaceCapabilities.minImageExtent.width);
+            WindowWidth_ = Min(WindowWidth_, SurfaceCapabilities.maxImageExtent.width);
+            WindowHeight_ = Max((u32)WindowHeight, SurfaceCapabilities.minImageExtent.height);
+            WindowHeight_ = Min(WindowHeight_, SurfaceCapabilities.maxImageExtent.height);
+        }
 
-    VK_CHECK(vkCreateSwapchainKHR(LogicalDevice, &SwapchainCreateInfo, 0, &Swapchain));
+        if(!WindowWidth_ || !WindowHeight_)
+        {
+            IsSwapchainDirty = true;
+            return false;
+        }
 
-    u32 ImagesCount;
-    vkGetSwapchainImagesKHR(LogicalDevice, Swapchain, &ImagesCount, nullptr);
-    SwapchainImages.resize(ImagesCount);
-    vkGetSwapchainImagesKHR(LogicalDevice, Swapchain, &ImagesCount, SwapchainImages.data());
+        PresentMode = ChoosePresentMode();
 
-    for(u32 ImageViewIndex = 0;
-        ImageViewIndex < ImagesCount;
-        ++ImageViewIndex)
-    {
-        VkImageView ImageView = CreateImageView(SwapchainImages[ImageViewIndex]);
-        SwapchainImageViews.push_back(ImageView);
+        // NOTE: Mailbox needs a third image, one is on screen, one is queued
+        // and the next frame still needs one to render into
+        u32 ImageCount = DesiredImageCount;
+        if(!ImageCount)
+        {
+            ImageCount = (PresentMode == VK_PRESENT_MODE_MAILBOX_KHR) ? 3 : 2;
+        }
+        ImageCount = Max(ImageCount, SurfaceCapabilities.minImageCount);
+        if(SurfaceCapabilities.maxImageCount)
+        {
+            ImageCount = Min(ImageCount, SurfaceCapabilities.maxImageCount);
+        }
+
+        VkCompositeAlphaFlagBitsKHR SurfaceComposite = 
+            (SurfaceCapabilities.supportedCompositeAlpha & VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR) 
+            ? VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR : 
+            (SurfaceCapabilities.supportedCompositeAlpha & VK_COMPOSITE_ALPHA_PRE_MULTIPLIED_BIT_KHR) 
+            ? VK_COMPOSITE_ALPHA_PRE_MULTIPLIED_BIT_KHR : 
+            (SurfaceCapabilities.supportedCompositeAlpha & VK_COMPOSITE_ALPHA_POST_MULTIPLIED_BIT_KHR) 
+            ? VK_COMPOSITE_ALPHA_POST_MULTIPLIED_BIT_KHR
+            : VK_COMPOSITE_ALPHA_INHERIT_BIT_KHR;
+
+        VkSwapchainCreateInfoKHR SwapchainCreateInfo = {};
+        SwapchainCreateInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+        SwapchainCreateInfo.surface = Surface;
+        SwapchainCreateInfo.minImageCount = ImageCount;
+        SwapchainCreateInfo.imageFormat = SwapchainSurfaceFormat.format;
+        SwapchainCreateInfo.imageUsage  = SurfaceCapabilities.supportedUsageFlags;
+        SwapchainCreateInfo.imageColorSpace = SwapchainSurfaceFormat.colorSpace;
+        SwapchainCreateInfo.imageExtent.width = WindowWidth_;
+        SwapchainCreateInfo.imageExtent.height = WindowHeight_;
+        SwapchainCreateInfo.imageArrayLayers = 1;
+        //SwapchainCreateInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+        SwapchainCreateInfo.queueFamilyIndexCount = 1;
+        SwapchainCreateInfo.pQueueFamilyIndices = &QueueFamilyIndex;
+        SwapchainCreateInfo.preTransform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR; //SurfaceCapabilities.currentTransform;
+        SwapchainCreateInfo.compositeAlpha = SurfaceComposite;
+        SwapchainCreateInfo.presentMode = PresentMode;
+        SwapchainCreateInfo.oldSwapchain = Swapchain;
+
+        VkSwapchainKHR OldSwapchain = Swapchain;
+        VK_CHECK(vkCreateSwapchainKHR(LogicalDevice, &SwapchainCreateInfo, 0, &Swapchain));
+
+        // NOTE: BeginRendering waits for every frame before it gets here, so the
+        // views and framebuffers are not used by the gpu anymore. The old swapchain
+        // can still be on screen, it is destroyed after the next frame instead.
+        DestroySwapchainTargets();
+        if(RetiredSwapchain)
+        {
+            vkDestroySwapchainKHR(LogicalDevice, RetiredSwapchain, nullptr);
+        }
+        RetiredSwapchain = OldSwapchain;
+        FirstPresentId = PresentId + 1;
+
+        u32 ImagesCount;
+        vkGetSwapchainImagesKHR(LogicalDevice, Swapchain, &ImagesCount, nullptr);
+        SwapchainImages.resize(ImagesCount);
+        vkGetSwapchainImagesKHR(LogicalDevice, Swapchain, &ImagesCount, SwapchainImages.data());
+
+        for(u32 ImageViewIndex = 0;
+            ImageViewIndex < ImagesCount;
+            ++ImageViewIndex)
+        {
+            VkImageView ImageView = CreateImageView(SwapchainImages[ImageViewIndex]);
+            SwapchainImageViews.push_back(ImageView);
+        }
+
+        while(ReleaseSemaphores.size() < ImagesCount)
+        {
+            ReleaseSemaphores.push_back(CreateSemaphore());
+        }
     }
 
-    CreateRenderPass();
+    Width = WindowWidth_;
+    Height = WindowHeight_;
 
     for(u32 FramebufferIndex = 0;
-        FramebufferIndex < ImagesCount;
+        FramebufferIndex < SwapchainImageViews.size();
         ++FramebufferIndex)
     {
         VkFramebuffer Framebuffer_ = CreateFramebuffer(SwapchainImageViews[FramebufferIndex]);
         SwapchainFramebuffers.push_back(Framebuffer_);
     }
+
+    IsSwapchainDirty = false;
+    return true;
 }
 
 void vulkan_renderer::
 DestroySwapchain()
 {
+    DestroySwapchainTargets();
+
     if(Swapchain != VK_NULL_HANDLE)
     {
         vkDestroySwapchainKHR(LogicalDevice, Swapchain, nullptr);
         Swapchain = VK_NULL_HANDLE;
     }
-}
-
-VkSemaphore vulkan_renderer::
-CreateSemaphore()
-{
-    VkSemaphoreCreateInfo SemaphoreCreateInfo = {VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
-    
-    VkSemaphore ResultSemaphore = 0;
-    VK_CHECK(vkCreateSemaphore(LogicalDevice, &SemaphoreCreateInfo, 0, &ResultSemaphore));
-    return ResultSemaphore;
-}
-
-VkFence vulkan_renderer::
-CreateFence()
-{
-    VkFenceCreateInfo FenceCreateInfo = {VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
 
-    VkFence ResultFence = 0;
-    VK_CHECK(vkCreateFence(LogicalDevice, &FenceCreateInfo, 0, &ResultFence));
-    return ResultFence;
+    if(RetiredSwapchain != VK_NULL_HANDLE)
+    {
+        vkDestroySwapchainKHR(LogicalDevice, RetiredSwapchain, nullptr);
+        RetiredSwapchain = VK_NULL_HANDLE;
+    }
 }
 
-buffer vulkan_renderer::
-AllocateBuffer(size_t Size, VkBufferUsageFlags BufferUsage, VkMemoryPropertyFlags MemoryFlags)
+// NOTE: Everything that was made for the swapchain images, the images
+// themselves belong to the swapchain unless they are offscreen targets
+void vulkan_renderer::
+DestroySwapchainTargets()
 {
-    buffer Result = {};
-    Result.Size = Size;
-    
-    VkBufferCreateInfo BufferCreateInfo = {VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
-    BufferCreateInfo.size = Size;
-    BufferCreateInfo.usage = BufferUsage;
-    BufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    for(VkFramebuffer Framebuffer_ : SwapchainFramebuffers)
+    {
+        vkDestroyFramebuffer(LogicalDevice, Framebuffer_, 0);
+    }
 
-    vkCreateBuffer(LogicalDevice, &BufferCreateInfo, nullptr, &Result.Buffer);
+    if(IsHeadless)
+    {
+        for(image& Target : OffscreenTargets)
+        {
+            vkDestroyImageView(LogicalDevice, Target.View, 0);
+            vkDestroyImage(LogicalDevice, Target.Image, 0);
+            vkFreeMemory(LogicalDevice, Target.Memory, 0);
+        }
 
-    VkMemoryRequirements MemoryRequirements = {};
-    vkGetBufferMemoryRequirements(LogicalDevice, Result.Buffer, &MemoryRequirements);
+        for(buffer& Readback : ReadbackBuffers)
+        {
+            vkDestroyBuffer(LogicalDevice, Readback.Buffer, 0);
+            vkFreeMemory(LogicalDevice, Readback.Memory, 0);
+        }
 
-    u32 MemoryType = ~0u;
-    for(u32 Type = 0;
-        Type < MemProperty.memoryTypeCount;
-        ++Type)
+        OffscreenTargets.clear();
+        ReadbackBuffers.clear();
+        ReadbackIndex = INVALID_READBACK_INDEX;
+    }
+    else
     {
-        if((MemoryRequirements.memoryTypeBits & (1 << Type)) && ((MemProperty.memoryTypes[Type].propertyFlags & MemoryFlags) == MemoryFlags))
+        for(VkImageView ImageView : SwapchainImageViews)
         {
-            MemoryType = Type;
-            break;
+            vkDestroyImageView(LogicalDevice, ImageView, 0);
         }
     }
 
-    VkMemoryAllocateInfo BufferMemoryAllocateInfo = {VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
-    BufferMemoryAllocateInfo.allocationSize  = Size;
-    BufferMemoryAllocateInfo.memoryTypeIndex = MemoryType;
+    SwapchainFramebuffers.clear();
+    SwapchainImageViews.clear();
+    SwapchainImages.clear();
+}
 
-    vkAllocateMemory(LogicalDevice, &BufferMemoryAllocateInfo, nullptr, &Result.Memory);
+// NOTE: Fifo is always there and never tears. Mailbox doesn't tear either,
+// the queued image is replaced with the newest one. Immediate tears but
+// nothing waits for the display at all.
+VkPresentModeKHR vulkan_renderer::
+ChoosePresentMode()
+{
+    VkPresentModeKHR Result = VK_PRESENT_MODE_FIFO_KHR;
+    if(IsLowLatency)
+    {
+        u32 PresentModesCount;
+        vkGetPhysicalDeviceSurfacePresentModesKHR(PhysicalDevice, Surface, &PresentModesCount, nullptr);
+        std::vector<VkPresentModeKHR> PresentModes(PresentModesCount);
+        vkGetPhysicalDeviceSurfacePresentModesKHR(PhysicalDevice, Surface, &PresentModesCount, PresentModes.data());
+
+        b32 IsMailboxSupported = false;
+        b32 IsImmediateSupported = false;
+        for(VkPresentModeKHR Mode : PresentModes)
+        {
+            IsMailboxSupported = IsMailboxSupported || (Mode == VK_PRESENT_MODE_MAILBOX_KHR);
+            IsImmediateSupported = IsImmediateSupported || (Mode == VK_PRESENT_MODE_IMMEDIATE_KHR);
+        }
+
+        if(IsMailboxSupported)
+        {
+            Result = VK_PRESENT_MODE_MAILBOX_KHR;
+        }
+        else if(IsImmediateSupported)
+        {
+            Result = VK_PRESENT_MODE_IMMEDIATE_KHR;
+        }
+    }
+
+    return Result;
+}
+
+// NOTE: Takes effect on the next BeginRendering
+void vulkan_renderer::
+SetPresentation(b32 IsLowLatency_, u32 DesiredImageCount_)
+{
+    if((IsLowLatency != IsLowLatency_) || (DesiredImageCount != DesiredImageCount_))
+    {
+        IsLowLatency = IsLowLatency_;
+        DesiredImageCount = DesiredImageCount_;
+        IsSwapchainDirty = !IsHeadless;
+    }
+}
+
+void vulkan_renderer::
+ResizeSwapchain()
+{
+    IsSwapchainDirty = !IsHeadless;
+}
+
+// NOTE: Call it right before reading input, it blocks until the display has
+// caught up so the input is as fresh as it can be. Low latency keeps nothing
+// queued, otherwise one frame stays queued so a slow one still makes the
+// vblank. Returns false when the frames are not paced here.
+b32 vulkan_renderer::
+WaitForPresent()
+{
+    b32 Result = IsPresentWaitEnabled && !IsSwapchainDirty;
+    if(Result)
+    {
+        u64 QueuedCount = IsLowLatency ? 0 : 1;
+        if(PresentId >= (FirstPresentId + QueuedCount))
+        {
+            // NOTE: A hidden window may never show the frame, so it gives up after a while
+            VkResult WaitResult = WaitForPresentKHR(LogicalDevice, Swapchain, PresentId - QueuedCount, PRESENT_WAIT_TIMEOUT);
+            if(WaitResult == VK_ERROR_OUT_OF_DATE_KHR)
+            {
+                IsSwapchainDirty = true;
+            }
+        }
+    }
+
+    return Result;
+}
+
+// NOTE: Offscreen targets take the place of the swapchain images. Every target
+// has its own readback buffer, so the host can read one frame while the next
+// one is rendered into the other target.
+void vulkan_renderer::
+CreateOffscreenTargets(u32 TargetWidth, u32 TargetHeight)
+{
+    VkMemoryPropertyFlags ReadbackMemoryFlags = GetReadbackMemoryFlags();
+    for(u32 TargetIndex = 0;
+        TargetIndex < RENDER_FRAME_COUNT;
+        ++TargetIndex)
+    {
+        image Target = CreateImage(TargetWidth, TargetHeight, 
+                                   VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT|VK_IMAGE_USAGE_TRANSFER_SRC_BIT, 
+                                   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        buffer Readback = AllocateBuffer(TargetWidth*TargetHeight*sizeof(u32), BUFFER_TRANSFER_DST, ReadbackMemoryFlags);
+
+        OffscreenTargets.push_back(Target);
+        ReadbackBuffers.push_back(Readback);
+        SwapchainImages.push_back(Target.Image);
+        SwapchainImageViews.push_back(Target.View);
+    }
+}
+
+// NOTE: Cached memory is much faster to read from the host,
+// but it is not coherent, so it has to be invalidated before reading
+VkMemoryPropertyFlags vulkan_renderer::
+GetReadbackMemoryFlags()
+{
+    VkMemoryPropertyFlags Result = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+    if(!IsMemoryTypeAvailable(Result))
+    {
+        Result = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    }
+
+    return Result;
+}
+
+b32 vulkan_renderer::
+IsMemoryTypeAvailable(VkMemoryPropertyFlags MemoryFlags)
+{
+    b32 Result = false;
+    for(u32 Type = 0;
+        Type < MemProperty.memoryTypeCount;
+        ++Type)
+    {
+        if((MemProperty.memoryTypes[Type].propertyFlags & MemoryFlags) == MemoryFlags)
+        {
+            Result = true;
+            break;
+        }
+    }
+
+    return Result;
+}
+
+VkSemaphore vulkan_renderer::
+CreateSemaphore()
+{
+    VkSemaphoreCreateInfo SemaphoreCreateInfo = {VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
+    
+    VkSemaphore ResultSemaphore = 0;
+    VK_CHECK(vkCreateSemaphore(LogicalDevice, &SemaphoreCreateInfo, 0, &ResultSemaphore));
+    return ResultSemaphore;
+}
+
+VkFence vulkan_renderer::
+CreateFence()
+{
+    VkFenceCreateInfo FenceCreateInfo = {VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
+
+    VkFence ResultFence = 0;
+    VK_CHECK(vkCreateFence(LogicalDevice, &FenceCreateInfo, 0, &ResultFence));
+    return ResultFence;
+}
+
+buffer vulkan_renderer::
+AllocateBuffer(size_t Size, VkBufferUsageFlags BufferUsage, VkMemoryPropertyFlags MemoryFlags)
+{
+    buffer Result = {};
+    Result.Size = Size;
+    Result.DescriptorIndex = INVALID_DESCRIPTOR_INDEX;
+    Result.TransferValue = 0;
+    
+    VkBufferCreateInfo BufferCreateInfo = {VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+    BufferCreateInfo.size = Size;
+    BufferCreateInfo.usage = BufferUsage;
+    BufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    vkCreateBuffer(LogicalDevice, &BufferCreateInfo, nullptr, &Result.Buffer);
+
+    VkMemoryRequirements MemoryRequirements = {};
+    vkGetBufferMemoryRequirements(LogicalDevice, Result.Buffer, &MemoryRequirements);
+
+    u32 MemoryType = ~0u;
+    for(u32 Type = 0;
+        Type < MemProperty.memoryTypeCount;
+        ++Type)
+    {
+        if((MemoryRequirements.memoryTypeBits & (1 << Type)) && ((MemProperty.memoryTypes[Type].propertyFlags & MemoryFlags) == MemoryFlags))
+        {
+            MemoryType = Type;
+            break;
+        }
+    }
+
+    VkMemoryAllocateInfo BufferMemoryAllocateInfo = {VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
+    BufferMemoryAllocateInfo.allocationSize  = Size;
+    BufferMemoryAllocateInfo.memoryTypeIndex = MemoryType;
+
+    vkAllocateMemory(LogicalDevice, &BufferMemoryAllocateInfo, nullptr, &Result.Memory);
     vkBindBufferMemory(LogicalDevice, Result.Buffer, Result.Memory, 0);
 
     if(MemoryFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
@@ -497,58 +1343,56 @@ AllocateBuffer(size_t Size, VkBufferUsageFlags BufferUsage, VkMemoryPropertyFlag
     return Result;
 }
 
+// NOTE: Uploads don't wait for the copy. The scratch buffer is waited on
+// before it is written again, the destination is handed to the graphics
+// queue in the next graphics submission.
 void vulkan_renderer::
 UpdateBuffer(buffer& Buffer, buffer& Scratch, void* Data, size_t Size, size_t Offset)
 {
     Assert((Size + Offset) <= Buffer.Size);
+    Assert(Size <= Scratch.Size);
 
+    WaitForTransfers(Scratch);
     memcpy(Scratch.Data, Data, Size);
 
-    VkCommandBuffer UpdateCommandBuffer = BeginCommand();
+    VkCommandBuffer UpdateCommandBuffer = BeginTransfer();
+    u32 Scope = BeginTransferScope(UpdateCommandBuffer, "Upload Buffer");
 
-    VkBufferCopy CopyOffset = {Offset, 0, (VkDeviceSize)Size};
+    VkBufferCopy CopyOffset = {0, Offset, (VkDeviceSize)Size};
     vkCmdCopyBuffer(UpdateCommandBuffer, Scratch.Buffer, Buffer.Buffer, 1, &CopyOffset);
+    ReleaseBuffer(UpdateCommandBuffer, Buffer);
 
-#if 0
-    VkBufferMemoryBarrier MemoryBarrier = CreateMemoryBarrier(Buffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
-    vkCmdPipelineBarrier(CommandBuffer, 
-                         VK_PIPELINE_STAGE_TRANSFER_BIT, 
-                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 
-                         VK_DEPENDENCY_BY_REGION_BIT, 
-                         0, 0, 1, &MemoryBarrier, 0, 0);
-#endif
-
-    EndCommand(UpdateCommandBuffer);
+    EndProfileScope(UpdateCommandBuffer, Scope);
+    Scratch.TransferValue = Buffer.TransferValue = EndTransfer(UpdateCommandBuffer, Buffer.GraphicsValue);
 }
 
+// NOTE: Offset is where the data starts in the scratch buffer, the caller
+// has to WaitForTransfers on the scratch buffer before writing into it
 void vulkan_renderer::
 UpdateBuffer(buffer& Buffer, buffer& Scratch, size_t Size, size_t Offset)
 {
-    Assert((Size + Offset) <= Buffer.Size);
+    Assert(Size <= Buffer.Size);
+    Assert((Size + Offset) <= Scratch.Size);
 
-    VkCommandBuffer UpdateCommandBuffer = BeginCommand();
+    VkCommandBuffer UpdateCommandBuffer = BeginTransfer();
+    u32 Scope = BeginTransferScope(UpdateCommandBuffer, "Upload Buffer");
 
     VkBufferCopy CopyOffset = {Offset, 0, Size};
     vkCmdCopyBuffer(UpdateCommandBuffer, Scratch.Buffer, Buffer.Buffer, 1, &CopyOffset);
+    ReleaseBuffer(UpdateCommandBuffer, Buffer);
 
-#if 0
-    VkBufferMemoryBarrier MemoryBarrier = CreateMemoryBarrier(Buffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
-    vkCmdPipelineBarrier(CommandBuffer, 
-                         VK_PIPELINE_STAGE_TRANSFER_BIT, 
-                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 
-                         VK_DEPENDENCY_BY_REGION_BIT, 
-                         0, 0, 1, &MemoryBarrier, 0, 0);
-#endif
-
-    EndCommand(UpdateCommandBuffer);
+    EndProfileScope(UpdateCommandBuffer, Scope);
+    Scratch.TransferValue = Buffer.TransferValue = EndTransfer(UpdateCommandBuffer, Buffer.GraphicsValue);
 }
 
-VkBufferMemoryBarrier vulkan_renderer::
-CreateMemoryBarrier(buffer& Buffer, VkAccessFlags OldAccess, VkAccessFlags NewAccess)
+VkBufferMemoryBarrier2KHR vulkan_renderer::
+CreateMemoryBarrier(buffer& Buffer, VkPipelineStageFlags2KHR OldStage, VkAccessFlags2KHR OldAccess, VkPipelineStageFlags2KHR NewStage, VkAccessFlags2KHR NewAccess)
 {
-    VkBufferMemoryBarrier MemoryBarrier = {VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
+    VkBufferMemoryBarrier2KHR MemoryBarrier = {VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2_KHR};
 
+    MemoryBarrier.srcStageMask = OldStage;
     MemoryBarrier.srcAccessMask = OldAccess;
+    MemoryBarrier.dstStageMask = NewStage;
     MemoryBarrier.dstAccessMask = NewAccess;
     MemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
     MemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
@@ -559,15 +1403,18 @@ CreateMemoryBarrier(buffer& Buffer, VkAccessFlags OldAccess, VkAccessFlags NewAc
     return MemoryBarrier;
 }
 
-VkImageMemoryBarrier vulkan_renderer::
-CreateImageBarrier(image& Image, VkAccessFlags OldAccess, VkAccessFlags NewAccess, VkImageLayout OldLayout, VkImageLayout NewLayout)
+// NOTE: Only writes have to be made available, reads just need the execution dependency
+VkImageMemoryBarrier2KHR vulkan_renderer::
+CreateImageBarrier(image& Image, image_state OldState, image_state NewState)
 {
-    VkImageMemoryBarrier ImageBarrier = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
-
-    ImageBarrier.srcAccessMask = OldAccess;
-    ImageBarrier.dstAccessMask = NewAccess;
-    ImageBarrier.oldLayout = OldLayout;
-    ImageBarrier.newLayout = NewLayout;
+    VkImageMemoryBarrier2KHR ImageBarrier = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR};
+
+    ImageBarrier.srcStageMask = OldState.Stage;
+    ImageBarrier.srcAccessMask = OldState.Access & MEMORY_WRITE_ACCESS;
+    ImageBarrier.dstStageMask = NewState.Stage;
+    ImageBarrier.dstAccessMask = NewState.Access;
+    ImageBarrier.oldLayout = OldState.Layout;
+    ImageBarrier.newLayout = NewState.Layout;
     ImageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
     ImageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
     ImageBarrier.image = Image.Image;
@@ -578,15 +1425,216 @@ CreateImageBarrier(image& Image, VkAccessFlags OldAccess, VkAccessFlags NewAcces
     return ImageBarrier;
 }
 
+// NOTE: Nothing is recorded between two uses in the same batch, so they become
+// one barrier from the first old state to every new one of the same layout
+void vulkan_renderer::
+AddImageBarrier(barrier_batch* Batch, image& Image, image_state OldState, image_state NewState)
+{
+    for(VkImageMemoryBarrier2KHR& Barrier : Batch->ImageBarriers)
+    {
+        if(Barrier.image == Image.Image)
+        {
+            if(Barrier.newLayout == NewState.Layout)
+            {
+                Barrier.dstStageMask |= NewState.Stage;
+                Barrier.dstAccessMask |= NewState.Access;
+            }
+            else
+            {
+                Barrier.dstStageMask = NewState.Stage;
+                Barrier.dstAccessMask = NewState.Access;
+                Barrier.newLayout = NewState.Layout;
+            }
+            return;
+        }
+    }
+
+    Batch->ImageBarriers.push_back(CreateImageBarrier(Image, OldState, NewState));
+}
+
+// NOTE: Adds the barrier the new use needs, if any. ShouldDiscard is for uses
+// that overwrite the whole image, the old content isn't kept then. Reads of
+// the same layout only wait for the last write, and only once per stage.
+void vulkan_renderer::
+TrackImage(barrier_batch* Batch, image& Image, image_usage Usage, b32 ShouldDiscard)
+{
+    image_state OldState = Image.State;
+    image_state NewState = ImageUsageStates[Usage];
+    if(Image.IsHostMapped)
+    {
+        NewState.Layout = VK_IMAGE_LAYOUT_GENERAL;
+    }
+
+    b32 IsLayoutChange = ShouldDiscard || (OldState.Layout != NewState.Layout);
+    b32 IsWrite = (NewState.Access & MEMORY_WRITE_ACCESS) != 0;
+    if(!IsLayoutChange && !IsWrite)
+    {
+        b32 IsVisible = ((OldState.Stage & NewState.Stage) == NewState.Stage) && 
+                        ((OldState.Access & NewState.Access) == NewState.Access);
+        if(OldState.WriteStage && !IsVisible)
+        {
+            image_state WriteState = {OldState.Layout, OldState.WriteStage, OldState.WriteAccess};
+            AddImageBarrier(Batch, Image, WriteState, NewState);
+        }
+
+        Image.State.Stage |= NewState.Stage;
+        Image.State.Access |= NewState.Access;
+        return;
+    }
+
+    if(ShouldDiscard)
+    {
+        OldState.Layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    }
+
+    AddImageBarrier(Batch, Image, OldState, NewState);
+
+    // NOTE: A write isn't visible to anything yet, not even to later uses
+    // at its own stage. A layout change is a write the reads are ordered after.
+    Image.State = NewState;
+    Image.State.WriteStage = NewState.Stage;
+    Image.State.WriteAccess = NewState.Access & MEMORY_WRITE_ACCESS;
+    if(IsWrite)
+    {
+        Image.State.Access = Image.State.WriteAccess;
+    }
+}
+
+// NOTE: The same as TrackImage for a buffer of the graph, without the layout
+void vulkan_renderer::
+TrackBuffer(barrier_batch* Batch, buffer& Buffer, buffer_state* State, buffer_usage Usage)
+{
+    buffer_state OldState = *State;
+    buffer_state NewState = BufferUsageStates[Usage];
+
+    b32 IsWrite = (NewState.Access & MEMORY_WRITE_ACCESS) != 0;
+    if(!IsWrite)
+    {
+        b32 IsVisible = ((OldState.Stage & NewState.Stage) == NewState.Stage) && 
+                        ((OldState.Access & NewState.Access) == NewState.Access);
+        if(OldState.WriteStage && !IsVisible)
+        {
+            Batch->BufferBarriers.push_back(CreateMemoryBarrier(Buffer, OldState.WriteStage, OldState.WriteAccess, 
+                                                                NewState.Stage, NewState.Access));
+        }
+
+        State->Stage |= NewState.Stage;
+        State->Access |= NewState.Access;
+        return;
+    }
+
+    if(OldState.Stage)
+    {
+        Batch->BufferBarriers.push_back(CreateMemoryBarrier(Buffer, OldState.Stage, OldState.Access & MEMORY_WRITE_ACCESS, 
+                                                            NewState.Stage, NewState.Access));
+    }
+
+    State->Stage = NewState.Stage;
+    State->Access = NewState.Access & MEMORY_WRITE_ACCESS;
+    State->WriteStage = NewState.Stage;
+    State->WriteAccess = NewState.Access & MEMORY_WRITE_ACCESS;
+}
+
+// NOTE: Without synchronization2 the batch goes into one vkCmdPipelineBarrier
+// with the union of the stages. The flags used here have the same values in both.
+void vulkan_renderer::
+FlushBarriers(VkCommandBuffer CommandBuffer_, barrier_batch* Batch)
+{
+    if(Batch->BufferBarriers.empty() && Batch->ImageBarriers.empty())
+    {
+        return;
+    }
+
+    if(CmdPipelineBarrier2)
+    {
+        VkDependencyInfoKHR DependencyInfo = {VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR};
+        DependencyInfo.bufferMemoryBarrierCount = (u32)Batch->BufferBarriers.size();
+        DependencyInfo.pBufferMemoryBarriers = Batch->BufferBarriers.data();
+        DependencyInfo.imageMemoryBarrierCount = (u32)Batch->ImageBarriers.size();
+        DependencyInfo.pImageMemoryBarriers = Batch->ImageBarriers.data();
+
+        CmdPipelineBarrier2(CommandBuffer_, &DependencyInfo);
+    }
+    else
+    {
+        VkPipelineStageFlags SrcStages = 0;
+        VkPipelineStageFlags DstStages = 0;
+
+        std::vector<VkBufferMemoryBarrier> BufferBarriers;
+        for(VkBufferMemoryBarrier2KHR& Barrier2 : Batch->BufferBarriers)
+        {
+            VkBufferMemoryBarrier Barrier = {VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
+            Barrier.srcAccessMask = (VkAccessFlags)Barrier2.srcAccessMask;
+            Barrier.dstAccessMask = (VkAccessFlags)Barrier2.dstAccessMask;
+            Barrier.srcQueueFamilyIndex = Barrier2.srcQueueFamilyIndex;
+            Barrier.dstQueueFamilyIndex = Barrier2.dstQueueFamilyIndex;
+            Barrier.buffer = Barrier2.buffer;
+            Barrier.offset = Barrier2.offset;
+            Barrier.size = Barrier2.size;
+            BufferBarriers.push_back(Barrier);
+
+            SrcStages |= (VkPipelineStageFlags)Barrier2.srcStageMask;
+            DstStages |= (VkPipelineStageFlags)Barrier2.dstStageMask;
+        }
+
+        std::vector<VkImageMemoryBarrier> ImageBarriers;
+        for(VkImageMemoryBarrier2KHR& Barrier2 : Batch->ImageBarriers)
+        {
+            VkImageMemoryBarrier Barrier = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+            Barrier.srcAccessMask = (VkAccessFlags)Barrier2.srcAccessMask;
+            Barrier.dstAccessMask = (VkAccessFlags)Barrier2.dstAccessMask;
+            Barrier.oldLayout = Barrier2.oldLayout;
+            Barrier.newLayout = Barrier2.newLayout;
+            Barrier.srcQueueFamilyIndex = Barrier2.srcQueueFamilyIndex;
+            Barrier.dstQueueFamilyIndex = Barrier2.dstQueueFamilyIndex;
+            Barrier.image = Barrier2.image;
+            Barrier.subresourceRange = Barrier2.subresourceRange;
+            ImageBarriers.push_back(Barrier);
+
+            SrcStages |= (VkPipelineStageFlags)Barrier2.srcStageMask;
+            DstStages |= (VkPipelineStageFlags)Barrier2.dstStageMask;
+        }
+
+        // NOTE: Empty masks are only valid with synchronization2
+        vkCmdPipelineBarrier(CommandBuffer_, 
+                             SrcStages ? SrcStages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 
+                             DstStages ? DstStages : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 
+                             0, 0, 0, 
+                             (u32)BufferBarriers.size(), BufferBarriers.data(), 
+                             (u32)ImageBarriers.size(), ImageBarriers.data());
+    }
+
+    Batch->BufferBarriers.clear();
+    Batch->ImageBarriers.clear();
+}
+
+// NOTE: The image has no memory yet, transients are bound into shared memory
 image vulkan_renderer::
-CreateImage(u32 ImageWidth, u32 ImageHeight, VkImageUsageFlags Usage, VkMemoryPropertyFlags MemoryFlags, u32 LayersCount, VkBool32 ShouldBeCubemap)
+CreateUnboundImage(u32 ImageWidth, u32 ImageHeight, VkImageUsageFlags Usage, u32 LayersCount, VkBool32 ShouldBeCubemap, VkImageTiling Tiling)
 {
     image Result  = {};
     Result.Width  = ImageWidth;
     Result.Height = ImageHeight;
+    Result.DescriptorIndex = INVALID_DESCRIPTOR_INDEX;
+    Result.State = ImageUsageStates[ImageUsage_Undefined];
+
+    // NOTE: Linear images are written by the host before their first use,
+    // PREINITIALIZED keeps that content through the first transition
+    b32 IsLinear = (Tiling == VK_IMAGE_TILING_LINEAR);
+    if(IsLinear)
+    {
+        Result.State = {VK_IMAGE_LAYOUT_PREINITIALIZED, VK_PIPELINE_STAGE_2_HOST_BIT_KHR, VK_ACCESS_2_HOST_WRITE_BIT_KHR, 
+                        VK_PIPELINE_STAGE_2_HOST_BIT_KHR, VK_ACCESS_2_HOST_WRITE_BIT_KHR};
+    }
 
     VkImageCreateInfo ImageCreateInfo = {VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO};
     ImageCreateInfo.flags = ShouldBeCubemap ? VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT : 0;
+    if(Usage & VK_IMAGE_USAGE_STORAGE_BIT)
+    {
+        // NOTE: Storage writes go through a R32_UINT view, because the
+        // swapchain format doesn't have to support storage at all
+        ImageCreateInfo.flags |= VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT|VK_IMAGE_CREATE_EXTENDED_USAGE_BIT;
+    }
     ImageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
     ImageCreateInfo.format = SwapchainSurfaceFormat.format;
     ImageCreateInfo.extent.width = ImageWidth;
@@ -595,48 +1643,134 @@ CreateImage(u32 ImageWidth, u32 ImageHeight, VkImageUsageFlags Usage, VkMemoryPr
     ImageCreateInfo.mipLevels = 1;
     ImageCreateInfo.arrayLayers = ShouldBeCubemap ? 6 * LayersCount : LayersCount; // 1 by default
     ImageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-    ImageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    ImageCreateInfo.tiling = Tiling;
     ImageCreateInfo.usage = Usage;
     ImageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    ImageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    ImageCreateInfo.initialLayout = IsLinear ? VK_IMAGE_LAYOUT_PREINITIALIZED : VK_IMAGE_LAYOUT_UNDEFINED;
 
     vkCreateImage(LogicalDevice, &ImageCreateInfo, 0, &Result.Image);
 
-    VkMemoryRequirements MemoryRequirements = {};
-    vkGetImageMemoryRequirements(LogicalDevice, Result.Image, &MemoryRequirements);
+    return Result;
+}
 
+u32 vulkan_renderer::
+FindMemoryType(u32 MemoryTypeBits, VkMemoryPropertyFlags MemoryFlags)
+{
     u32 MemoryType = ~0u;
     for(u32 Type = 0;
         Type < MemProperty.memoryTypeCount;
         ++Type)
     {
-        if((MemoryRequirements.memoryTypeBits & (1 << Type)) && ((MemProperty.memoryTypes[Type].propertyFlags & MemoryFlags) == MemoryFlags))
+        if((MemoryTypeBits & (1 << Type)) && ((MemProperty.memoryTypes[Type].propertyFlags & MemoryFlags) == MemoryFlags))
         {
             MemoryType = Type;
             break;
         }
     }
 
+    return MemoryType;
+}
+
+image vulkan_renderer::
+CreateImage(u32 ImageWidth, u32 ImageHeight, VkImageUsageFlags Usage, VkMemoryPropertyFlags MemoryFlags, u32 LayersCount, VkBool32 ShouldBeCubemap)
+{
+    image Result = CreateUnboundImage(ImageWidth, ImageHeight, Usage, LayersCount, ShouldBeCubemap);
+
+    VkMemoryRequirements MemoryRequirements = {};
+    vkGetImageMemoryRequirements(LogicalDevice, Result.Image, &MemoryRequirements);
+
     VkMemoryAllocateInfo ImageAllocateInfo = {VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
     ImageAllocateInfo.allocationSize  = MemoryRequirements.size;
-    ImageAllocateInfo.memoryTypeIndex = MemoryType;
+    ImageAllocateInfo.memoryTypeIndex = FindMemoryType(MemoryRequirements.memoryTypeBits, MemoryFlags);
     vkAllocateMemory(LogicalDevice, &ImageAllocateInfo, nullptr, &Result.Memory);
 
     vkBindImageMemory(LogicalDevice, Result.Image, Result.Memory, 0);
 
     Result.View = CreateImageView(Result.Image);
+    if(Usage & VK_IMAGE_USAGE_STORAGE_BIT)
+    {
+        Result.StorageView = CreateImageView(Result.Image, VK_FORMAT_R32_UINT);
+    }
 
     return Result;
 }
 
+// NOTE: Zero copy path for devices where device local memory is host visible,
+// like integrated gpus or software rasterizers. The host writes the pixels
+// straight into the image the fragment shader samples. Fails when the format
+// can't be sampled with linear tiling, when there is no such memory or when
+// the rows aren't tightly packed like the software rasterizer writes them.
+b32 vulkan_renderer::
+CreateHostImage(image* Result, u32 ImageWidth, u32 ImageHeight)
+{
+    VkFormatProperties FormatProperties;
+    vkGetPhysicalDeviceFormatProperties(PhysicalDevice, SwapchainSurfaceFormat.format, &FormatProperties);
+    if(!(FormatProperties.linearTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT))
+    {
+        return false;
+    }
+
+    VkImageFormatProperties ImageFormatProperties;
+    if((vkGetPhysicalDeviceImageFormatProperties(PhysicalDevice, SwapchainSurfaceFormat.format, VK_IMAGE_TYPE_2D, VK_IMAGE_TILING_LINEAR, 
+                                                 VK_IMAGE_USAGE_SAMPLED_BIT, 0, &ImageFormatProperties) != VK_SUCCESS) ||
+       (ImageFormatProperties.maxExtent.width < ImageWidth) || (ImageFormatProperties.maxExtent.height < ImageHeight))
+    {
+        return false;
+    }
+
+    image Image = CreateUnboundImage(ImageWidth, ImageHeight, VK_IMAGE_USAGE_SAMPLED_BIT, 1, 0, VK_IMAGE_TILING_LINEAR);
+
+    VkMemoryRequirements MemoryRequirements = {};
+    vkGetImageMemoryRequirements(LogicalDevice, Image.Image, &MemoryRequirements);
+    u32 MemoryType = FindMemoryType(MemoryRequirements.memoryTypeBits, 
+                                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT|VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+    VkImageSubresource Subresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0};
+    VkSubresourceLayout SubresourceLayout;
+    vkGetImageSubresourceLayout(LogicalDevice, Image.Image, &Subresource, &SubresourceLayout);
+
+    if((MemoryType == ~0u) || (SubresourceLayout.rowPitch != ImageWidth*sizeof(u32)))
+    {
+        vkDestroyImage(LogicalDevice, Image.Image, 0);
+        return false;
+    }
+
+    VkMemoryAllocateInfo ImageAllocateInfo = {VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
+    ImageAllocateInfo.allocationSize  = MemoryRequirements.size;
+    ImageAllocateInfo.memoryTypeIndex = MemoryType;
+    VK_CHECK(vkAllocateMemory(LogicalDevice, &ImageAllocateInfo, nullptr, &Image.Memory));
+    vkBindImageMemory(LogicalDevice, Image.Image, Image.Memory, 0);
+
+    void* Mapped = nullptr;
+    VK_CHECK(vkMapMemory(LogicalDevice, Image.Memory, 0, VK_WHOLE_SIZE, 0, &Mapped));
+    Image.Data = (u8*)Mapped + SubresourceLayout.offset;
+    Image.IsHostMapped = true;
+    Image.View = CreateImageView(Image.Image);
+
+    *Result = Image;
+    return true;
+}
+
+// NOTE: The whole image is written, so its old content is discarded. It is
+// ready for sampling once the graphics queue has acquired it.
 void vulkan_renderer::
 UpdateTexture(image& Image, buffer& Scratch, size_t Offset)
 {
-    VkCommandBuffer UpdateCommandBuffer = BeginCommand();
-    UpdateImageLayout(Image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    VkCommandBuffer UpdateCommandBuffer = BeginTransfer();
+    u32 Scope = BeginTransferScope(UpdateCommandBuffer, "Upload Texture");
+
+    // NOTE: The transfer waits for the last frame that used the image on the
+    // graphics timeline, so the old uses don't need to be in the barrier. Their stages
+    // aren't even supported on a transfer queue.
+    Image.State.Stage = VK_PIPELINE_STAGE_2_NONE_KHR;
+    Image.State.Access = 0;
+
+    barrier_batch Barriers;
+    TrackImage(&Barriers, Image, ImageUsage_TransferDst, true);
+    FlushBarriers(UpdateCommandBuffer, &Barriers);
 
     VkBufferImageCopy BufferImageCopy = {};
-    BufferImageCopy.bufferOffset = 0;
+    BufferImageCopy.bufferOffset = Offset;
     BufferImageCopy.bufferRowLength = Image.Width;
     BufferImageCopy.bufferImageHeight = Image.Height;
     BufferImageCopy.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
@@ -644,33 +1778,14 @@ UpdateTexture(image& Image, buffer& Scratch, size_t Offset)
     BufferImageCopy.imageExtent = {Image.Width, Image.Height, 1};
 
     vkCmdCopyBufferToImage(UpdateCommandBuffer, Scratch.Buffer, Image.Image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &BufferImageCopy);
+    ReleaseImage(UpdateCommandBuffer, Image, ImageUsage_Sampled);
 
-    EndCommand(UpdateCommandBuffer);
-}
-
-void vulkan_renderer::
-UpdateImageLayout(image& Image, VkImageLayout OldLayout, VkImageLayout NewLayout)
-{
-    VkCommandBuffer UpdateCommandBuffer = BeginCommand();
-    VkImageMemoryBarrier ImageBarrier;
-    if(OldLayout == VK_IMAGE_LAYOUT_UNDEFINED && NewLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
-    {
-        ImageBarrier = CreateImageBarrier(Image, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, OldLayout, NewLayout);
-    }
-    else if(OldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
-    {
-        ImageBarrier = CreateImageBarrier(Image, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, OldLayout, NewLayout);
-    }
-    vkCmdPipelineBarrier(UpdateCommandBuffer, 
-                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 
-                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 
-                         VK_DEPENDENCY_BY_REGION_BIT, 
-                         0, 0, 0, 0, 1, &ImageBarrier);
-    EndCommand(UpdateCommandBuffer);
+    EndProfileScope(UpdateCommandBuffer, Scope);
+    Scratch.TransferValue = EndTransfer(UpdateCommandBuffer, Image.GraphicsValue);
 }
 
 VkImageView vulkan_renderer::
-CreateImageView(VkImage Image)
+CreateImageView(VkImage Image, VkFormat Format)
 {
     VkImageSubresourceRange Range = {};
     Range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -680,7 +1795,7 @@ CreateImageView(VkImage Image)
     VkImageViewCreateInfo ImageViewCreateInfo = {VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO};
     ImageViewCreateInfo.image = Image;
     ImageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-    ImageViewCreateInfo.format = SwapchainSurfaceFormat.format;
+    ImageViewCreateInfo.format = (Format != VK_FORMAT_UNDEFINED) ? Format : SwapchainSurfaceFormat.format;
     ImageViewCreateInfo.subresourceRange = Range;
 
     VkImageView ImageViewResult = 0;
@@ -690,14 +1805,14 @@ CreateImageView(VkImage Image)
 }
 
 VkFramebuffer vulkan_renderer::
-CreateFramebuffer(VkImageView ImageView_)
+CreateFramebuffer(VkImageView ImageView_, u32 FramebufferWidth, u32 FramebufferHeight)
 {
     VkFramebufferCreateInfo FbCreateInfo = {VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO};
     FbCreateInfo.renderPass = RenderPass;
     FbCreateInfo.attachmentCount = 1;
     FbCreateInfo.pAttachments = &ImageView_;
-    FbCreateInfo.width = Width;
-    FbCreateInfo.height = Height;
+    FbCreateInfo.width = FramebufferWidth ? FramebufferWidth : Width;
+    FbCreateInfo.height = FramebufferHeight ? FramebufferHeight : Height;
     FbCreateInfo.layers = 1;
 
     VkFramebuffer FramebufferResult;
@@ -732,16 +1847,36 @@ CreateDescriptorSetLayout()
     std::vector<VkDescriptorSetLayoutBinding> Bindings(2);
     Bindings[0].binding = 0;
     Bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    Bindings[0].descriptorCount = 1;
+    Bindings[0].descriptorCount = MAX_BINDLESS_RESOURCES;
     Bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
     Bindings[1].binding = 1;
     Bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    Bindings[1].descriptorCount = 1;
+    Bindings[1].descriptorCount = MAX_BINDLESS_RESOURCES;
     Bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
+    // NOTE: Slots are filled when a resource is first used,
+    // the rest of the array stays unwritten
+    VkDescriptorBindingFlags BindingFlags[] = 
+    {
+        VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT|VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT|VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT,
+        VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT|VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT|VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT
+    };
+
+    VkDescriptorSetLayoutBindingFlagsCreateInfo BindingFlagsCreateInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO};
+    BindingFlagsCreateInfo.pBindingFlags = BindingFlags;
+    BindingFlagsCreateInfo.bindingCount = ArraySize(BindingFlags);
+
     VkDescriptorSetLayoutCreateInfo DescriptorSetLayoutCreateInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO};
-    //DescriptorSetLayoutCreateInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR;
+    if(IsBindless)
+    {
+        DescriptorSetLayoutCreateInfo.pNext = &BindingFlagsCreateInfo;
+        DescriptorSetLayoutCreateInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+    }
+    else
+    {
+        DescriptorSetLayoutCreateInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR;
+    }
     DescriptorSetLayoutCreateInfo.pBindings = Bindings.data();
     DescriptorSetLayoutCreateInfo.bindingCount = (u32)Bindings.size();
 
@@ -756,12 +1891,17 @@ CreateDescriptorPool()
 {
     std::vector<VkDescriptorPoolSize> Sizes = 
     {
-        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 10},
-        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 10}
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, MAX_BINDLESS_RESOURCES + 10},
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, MAX_BINDLESS_RESOURCES + 10},
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 10}
     };
 
     VkDescriptorPoolCreateInfo DescriptorPoolCreateInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
     DescriptorPoolCreateInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+    if(IsBindless)
+    {
+        DescriptorPoolCreateInfo.flags |= VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+    }
     DescriptorPoolCreateInfo.maxSets = 10;
     DescriptorPoolCreateInfo.poolSizeCount = (u32)Sizes.size();
     DescriptorPoolCreateInfo.pPoolSizes = Sizes.data();
@@ -771,18 +1911,20 @@ CreateDescriptorPool()
     return DescriptorPoolResult;
 }
 
-void vulkan_renderer::
-CreateRenderPass()
+// NOTE: The render graph moves the attachment in and out of
+// COLOR_ATTACHMENT_OPTIMAL, the pass itself never changes the layout
+VkRenderPass vulkan_renderer::
+CreateRenderPass(VkAttachmentLoadOp LoadOp)
 {
     VkAttachmentDescription Attachment = {};
     Attachment.format = SwapchainSurfaceFormat.format;
     Attachment.samples = VK_SAMPLE_COUNT_1_BIT;
-    Attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    Attachment.loadOp = LoadOp;
     Attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
     Attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     Attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    Attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    Attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    Attachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    Attachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
     VkAttachmentReference AttachmentReference;
     AttachmentReference.attachment = 0;
@@ -810,17 +1952,280 @@ CreateRenderPass()
     RenderPassCreateInfo.pDependencies = &Dependency;
     RenderPassCreateInfo.dependencyCount = 0;
 
-    VK_CHECK(vkCreateRenderPass(LogicalDevice, &RenderPassCreateInfo, 0, &RenderPass));
+    VkRenderPass RenderPassResult;
+    VK_CHECK(vkCreateRenderPass(LogicalDevice, &RenderPassCreateInfo, 0, &RenderPassResult));
+    return RenderPassResult;
 }
 
-void vulkan_renderer::
-BeginCommands()
+VkSemaphore vulkan_renderer::
+CreateTimelineSemaphore()
 {
-    //vkResetCommandBuffer(CommandBuffer, VK_COMMAND_BUFFER_RESET_RELEASE_RESOURCES_BIT);
-    // NOTE: I could create command buffer and command pool here if I want to.
-    // Any advantages, if so?
-    VkCommandBufferBeginInfo CommandBufferBeginInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
-    CommandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VkSemaphoreTypeCreateInfo SemaphoreTypeCreateInfo = {VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO};
+    SemaphoreTypeCreateInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    SemaphoreTypeCreateInfo.initialValue = 0;
+
+    VkSemaphoreCreateInfo SemaphoreCreateInfo = {VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
+    SemaphoreCreateInfo.pNext = &SemaphoreTypeCreateInfo;
+
+    VkSemaphore ResultSemaphore = 0;
+    VK_CHECK(vkCreateSemaphore(LogicalDevice, &SemaphoreCreateInfo, 0, &ResultSemaphore));
+    return ResultSemaphore;
+}
+
+// NOTE: Transfer command buffers are freed once the timeline has passed them
+void vulkan_renderer::
+CollectTransfers()
+{
+    u64 CompletedValue = 0;
+    vkGetSemaphoreCounterValue(LogicalDevice, TransferSemaphore, &CompletedValue);
+    while(!TransferSubmissions.empty() && (TransferSubmissions.front().Value <= CompletedValue))
+    {
+        vkFreeCommandBuffers(LogicalDevice, TransferCommandPool, 1, &TransferSubmissions.front().CommandBuffer);
+        TransferSubmissions.pop_front();
+    }
+}
+
+void vulkan_renderer::
+WaitForTransfer(u64 Value)
+{
+    if(Value)
+    {
+        VkSemaphoreWaitInfo WaitInfo = {VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO};
+        WaitInfo.semaphoreCount = 1;
+        WaitInfo.pSemaphores = &TransferSemaphore;
+        WaitInfo.pValues = &Value;
+        VK_CHECK(vkWaitSemaphores(LogicalDevice, &WaitInfo, ~0ull));
+    }
+}
+
+// NOTE: Blocks until every upload that used the buffer is done,
+// needed before the host writes into a scratch buffer again
+void vulkan_renderer::
+WaitForTransfers(buffer& Buffer)
+{
+    WaitForTransfer(Buffer.TransferValue);
+}
+
+VkCommandBuffer vulkan_renderer::
+BeginTransfer()
+{
+    CollectTransfers();
+
+    VkCommandBufferAllocateInfo CommandBufferAllocateInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+    CommandBufferAllocateInfo.commandPool = TransferCommandPool;
+    CommandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    CommandBufferAllocateInfo.commandBufferCount = 1;
+
+    VkCommandBuffer TransferCommandBuffer;
+    VK_CHECK(vkAllocateCommandBuffers(LogicalDevice, &CommandBufferAllocateInfo, &TransferCommandBuffer));
+
+    VkCommandBufferBeginInfo CommandBufferBeginInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    CommandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(TransferCommandBuffer, &CommandBufferBeginInfo);
+
+    return TransferCommandBuffer;
+}
+
+// NOTE: Timestamps are only written when the transfer family has them
+u32 vulkan_renderer::
+BeginTransferScope(VkCommandBuffer CommandBuffer_, const char* Name)
+{
+    u32 Scope = INVALID_PROFILE_SCOPE;
+    if(IsTransferProfilingEnabled)
+    {
+        Scope = BeginProfileScope(CommandBuffer_, Name);
+        ProfileFrames[ProfileFrameIndex].TransferValue = TransferValue + 1;
+    }
+
+    return Scope;
+}
+
+// NOTE: The copy waits for the graphics submission in WaitValue, the last one
+// that used the destination, so nothing that is still read by the gpu gets
+// overwritten. Only frames whose graph imports a resource are seen, anything
+// uploaded more than once has to be imported where it is used. Returns the
+// timeline value that is reached when the copy is done.
+u64 vulkan_renderer::
+EndTransfer(VkCommandBuffer TransferCommandBuffer, u64 WaitValue)
+{
+    vkEndCommandBuffer(TransferCommandBuffer);
+
+    u64 SignalValue = ++TransferValue;
+    VkPipelineStageFlags WaitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+
+    VkTimelineSemaphoreSubmitInfo TimelineSubmitInfo = {VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO};
+    TimelineSubmitInfo.waitSemaphoreValueCount = WaitValue ? 1 : 0;
+    TimelineSubmitInfo.pWaitSemaphoreValues = &WaitValue;
+    TimelineSubmitInfo.signalSemaphoreValueCount = 1;
+    TimelineSubmitInfo.pSignalSemaphoreValues = &SignalValue;
+
+    VkSubmitInfo SubmitInfo = {VK_STRUCTURE_TYPE_SUBMIT_INFO};
+    SubmitInfo.pNext = &TimelineSubmitInfo;
+    SubmitInfo.commandBufferCount = 1;
+    SubmitInfo.pCommandBuffers = &TransferCommandBuffer;
+    SubmitInfo.waitSemaphoreCount = WaitValue ? 1 : 0;
+    SubmitInfo.pWaitSemaphores = &GraphicsSemaphore;
+    SubmitInfo.pWaitDstStageMask = &WaitStage;
+    SubmitInfo.signalSemaphoreCount = 1;
+    SubmitInfo.pSignalSemaphores = &TransferSemaphore;
+
+    VK_CHECK(vkQueueSubmit(TransferQueue, 1, &SubmitInfo, VK_NULL_HANDLE));
+
+    TransferSubmissions.push_back({TransferCommandBuffer, SignalValue});
+    return SignalValue;
+}
+
+// NOTE: With two queue families the release on the transfer queue is paired
+// with an acquire on the graphics queue, the same barrier with both family
+// indices. On one family the semaphore is enough for the buffer.
+void vulkan_renderer::
+ReleaseBuffer(VkCommandBuffer TransferCommandBuffer, buffer& Buffer)
+{
+    if(TransferFamilyIndex != QueueFamilyIndex)
+    {
+        barrier_batch Barriers;
+        VkBufferMemoryBarrier2KHR Release = CreateMemoryBarrier(Buffer, VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR, VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR, 
+                                                                VK_PIPELINE_STAGE_2_NONE_KHR, 0);
+        Release.srcQueueFamilyIndex = TransferFamilyIndex;
+        Release.dstQueueFamilyIndex = QueueFamilyIndex;
+        Barriers.BufferBarriers.push_back(Release);
+        FlushBarriers(TransferCommandBuffer, &Barriers);
+
+        VkBufferMemoryBarrier2KHR Acquire = CreateMemoryBarrier(Buffer, VK_PIPELINE_STAGE_2_NONE_KHR, 0, 
+                                                                UPLOAD_CONSUMER_STAGES, UPLOAD_CONSUMER_ACCESS);
+        Acquire.srcQueueFamilyIndex = TransferFamilyIndex;
+        Acquire.dstQueueFamilyIndex = QueueFamilyIndex;
+        AcquireBarriers.BufferBarriers.push_back(Acquire);
+    }
+}
+
+// NOTE: The layout change is done by the release and by the acquire, so the
+// image is already in the layout of its next use on the graphics queue
+void vulkan_renderer::
+ReleaseImage(VkCommandBuffer TransferCommandBuffer, image& Image, image_usage Usage)
+{
+    barrier_batch Barriers;
+    if(TransferFamilyIndex != QueueFamilyIndex)
+    {
+        VkImageMemoryBarrier2KHR Release = CreateImageBarrier(Image, Image.State, ImageUsageStates[Usage]);
+        Release.dstStageMask = VK_PIPELINE_STAGE_2_NONE_KHR;
+        Release.dstAccessMask = 0;
+        Release.srcQueueFamilyIndex = TransferFamilyIndex;
+        Release.dstQueueFamilyIndex = QueueFamilyIndex;
+        Barriers.ImageBarriers.push_back(Release);
+
+        VkImageMemoryBarrier2KHR Acquire = CreateImageBarrier(Image, Image.State, ImageUsageStates[Usage]);
+        Acquire.srcStageMask = VK_PIPELINE_STAGE_2_NONE_KHR;
+        Acquire.srcAccessMask = 0;
+        Acquire.srcQueueFamilyIndex = TransferFamilyIndex;
+        Acquire.dstQueueFamilyIndex = QueueFamilyIndex;
+        AcquireBarriers.ImageBarriers.push_back(Acquire);
+
+        // NOTE: The acquire changes the layout on the graphics queue,
+        // reads at the other stages are ordered after it
+        Image.State = ImageUsageStates[Usage];
+        Image.State.WriteStage = Image.State.Stage;
+    }
+    else
+    {
+        // NOTE: The layout is changed before the semaphore is
+        // signaled, its wait covers every stage that reads uploads
+        TrackImage(&Barriers, Image, Usage);
+        Image.State.WriteStage = VK_PIPELINE_STAGE_2_NONE_KHR;
+        Image.State.WriteAccess = 0;
+    }
+
+    // NOTE: The stages of the next use aren't on the transfer queue,
+    // the semaphore wait covers them instead
+    for(VkImageMemoryBarrier2KHR& Barrier : Barriers.ImageBarriers)
+    {
+        Barrier.dstStageMask = VK_PIPELINE_STAGE_2_NONE_KHR;
+        Barrier.dstAccessMask = 0;
+    }
+    FlushBarriers(TransferCommandBuffer, &Barriers);
+}
+
+// NOTE: Recorded before the first command that can use an upload,
+// the submission of it waits for the transfers on the timeline
+void vulkan_renderer::
+AcquireTransfers(VkCommandBuffer CommandBuffer_)
+{
+    AcquiredTransferValue = TransferValue;
+    FlushBarriers(CommandBuffer_, &AcquireBarriers);
+}
+
+// NOTE: Every graphics submission signals the graphics timeline and waits
+// for the uploads that were not waited on yet
+void vulkan_renderer::
+SubmitGraphics(VkCommandBuffer CommandBuffer_, VkSemaphore* AcquireSemaphore_, VkSemaphore* ReleaseSemaphore_, VkFence Fence_)
+{
+    VkSemaphore WaitSemaphores[2];
+    u64 WaitValues[2];
+    VkPipelineStageFlags WaitStages[2];
+    u32 WaitCount = 0;
+
+    if(AcquireSemaphore_)
+    {
+        WaitSemaphores[WaitCount] = *AcquireSemaphore_;
+        WaitValues[WaitCount] = 0;
+        WaitStages[WaitCount] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        ++WaitCount;
+    }
+
+    // NOTE: Later submissions on the queue are ordered after this wait as well
+    if(AcquiredTransferValue > WaitedTransferValue)
+    {
+        WaitSemaphores[WaitCount] = TransferSemaphore;
+        WaitValues[WaitCount] = AcquiredTransferValue;
+        WaitStages[WaitCount] = UPLOAD_CONSUMER_STAGES;
+        ++WaitCount;
+
+        WaitedTransferValue = AcquiredTransferValue;
+    }
+
+    VkSemaphore SignalSemaphores[2];
+    u64 SignalValues[2];
+    u32 SignalCount = 0;
+
+    if(ReleaseSemaphore_)
+    {
+        SignalSemaphores[SignalCount] = *ReleaseSemaphore_;
+        SignalValues[SignalCount] = 0;
+        ++SignalCount;
+    }
+
+    SignalSemaphores[SignalCount] = GraphicsSemaphore;
+    SignalValues[SignalCount] = ++GraphicsValue;
+    ++SignalCount;
+
+    // NOTE: Values of binary semaphores are ignored
+    VkTimelineSemaphoreSubmitInfo TimelineSubmitInfo = {VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO};
+    TimelineSubmitInfo.waitSemaphoreValueCount = WaitCount;
+    TimelineSubmitInfo.pWaitSemaphoreValues = WaitValues;
+    TimelineSubmitInfo.signalSemaphoreValueCount = SignalCount;
+    TimelineSubmitInfo.pSignalSemaphoreValues = SignalValues;
+
+    VkSubmitInfo SubmitInfo = {VK_STRUCTURE_TYPE_SUBMIT_INFO};
+    SubmitInfo.pNext = &TimelineSubmitInfo;
+    SubmitInfo.commandBufferCount = 1;
+    SubmitInfo.pCommandBuffers = &CommandBuffer_;
+    SubmitInfo.waitSemaphoreCount = WaitCount;
+    SubmitInfo.pWaitSemaphores = WaitSemaphores;
+    SubmitInfo.pWaitDstStageMask = WaitStages;
+    SubmitInfo.signalSemaphoreCount = SignalCount;
+    SubmitInfo.pSignalSemaphores = SignalSemaphores;
+
+    VK_CHECK(vkQueueSubmit(Queue, 1, &SubmitInfo, Fence_));
+}
+
+void vulkan_renderer::
+BeginCommands()
+{
+    //vkResetCommandBuffer(CommandBuffer, VK_COMMAND_BUFFER_RESET_RELEASE_RESOURCES_BIT);
+    // NOTE: I could create command buffer and command pool here if I want to.
+    // Any advantages, if so?
+    VkCommandBufferBeginInfo CommandBufferBeginInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    CommandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
     vkBeginCommandBuffer(CommandBuffer, &CommandBufferBeginInfo);
 }
@@ -842,6 +2247,7 @@ BeginCommand()
     CommandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
     vkBeginCommandBuffer(CommandBufferResult, &CommandBufferBeginInfo);
+    AcquireTransfers(CommandBufferResult);
 
     return CommandBufferResult;
 }
@@ -851,62 +2257,396 @@ EndCommand(VkCommandBuffer CommandBufferResult)
 {
     vkEndCommandBuffer(CommandBufferResult);
 
-    VkSubmitInfo SubmitInfo = {VK_STRUCTURE_TYPE_SUBMIT_INFO};
-    SubmitInfo.commandBufferCount = 1;
-    SubmitInfo.pCommandBuffers = &CommandBufferResult;
-
-    vkQueueSubmit(Queue, 1, &SubmitInfo, VK_NULL_HANDLE);
+    SubmitGraphics(CommandBufferResult, nullptr, nullptr, VK_NULL_HANDLE);
     VK_CHECK(vkDeviceWaitIdle(LogicalDevice));
 
     vkFreeCommandBuffers(LogicalDevice, CommandPool, 1, &CommandBufferResult);
 }
 
 void vulkan_renderer::
-EndCommands(VkSemaphore* AcquireSemaphore_, VkSemaphore* ReleaseSemaphore_)
+EndCommands(VkSemaphore* AcquireSemaphore_, VkSemaphore* ReleaseSemaphore_, VkFence Fence_)
 {
     vkEndCommandBuffer(CommandBuffer);
 
-    VkPipelineStageFlags SubmitStageFlags = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    // NOTE: With a fence the caller decides when to wait for the submission
+    SubmitGraphics(CommandBuffer, AcquireSemaphore_, ReleaseSemaphore_, Fence_);
+    if(!Fence_)
+    {
+        VK_CHECK(vkDeviceWaitIdle(LogicalDevice));
+    }
+}
 
-    VkSubmitInfo SubmitInfo = {VK_STRUCTURE_TYPE_SUBMIT_INFO};
-    SubmitInfo.commandBufferCount = 1;
-    SubmitInfo.pCommandBuffers = &CommandBuffer;
-    SubmitInfo.pWaitDstStageMask = &SubmitStageFlags;
+// NOTE: Waits for the frame, after that everything it recorded into can be
+// reused and an offscreen frame has its pixels in the readback buffer
+void vulkan_renderer::
+CompleteFrame(render_frame* Frame)
+{
+    if(Frame->IsPending)
+    {
+        VK_CHECK(vkWaitForFences(LogicalDevice, 1, &Frame->Fence, VK_TRUE, ~0ull));
+        VK_CHECK(vkResetFences(LogicalDevice, 1, &Frame->Fence));
 
-    SubmitInfo.waitSemaphoreCount = (AcquireSemaphore_) ? 1 : 0;
-    SubmitInfo.pWaitSemaphores = AcquireSemaphore_;
-    SubmitInfo.signalSemaphoreCount = (ReleaseSemaphore_) ? 1 : 0;
-    SubmitInfo.pSignalSemaphores = ReleaseSemaphore_;
+        Frame->IsPending = false;
+        if(IsHeadless)
+        {
+            ReadbackIndex = (u32)(Frame - Frames);
+            ReadbackFrameNumber = Frame->FrameNumber;
+        }
+        CollectCaptures(Frame->FrameNumber);
+    }
+}
 
-    vkQueueSubmit(Queue, 1, &SubmitInfo, VK_NULL_HANDLE);
-    VK_CHECK(vkDeviceWaitIdle(LogicalDevice));
+// NOTE: Oldest first, so the readback ends up with the newest frame
+void vulkan_renderer::
+CompleteFrames()
+{
+    for(u32 FrameOffset = 0;
+        FrameOffset < RENDER_FRAME_COUNT;
+        ++FrameOffset)
+    {
+        CompleteFrame(Frames + ((FrameIndex + FrameOffset) % RENDER_FRAME_COUNT));
+    }
+}
+
+// NOTE: The frame the host records into next. BeginRendering waits for
+// the one of this index, the host data of it can be written after that
+u32 vulkan_renderer::
+GetFrameIndex()
+{
+    return FrameIndex;
+}
+
+// NOTE: Never blocks unless it is asked to. The pixels are the last finished
+// frame in the target format, rows are tightly packed and the first one is
+// the top of the frame. They stay valid until RENDER_FRAME_COUNT more frames
+// are rendered.
+b32 vulkan_renderer::
+GetReadback(void** Pixels, u64* FrameNumber_, b32 ShouldWait)
+{
+    Assert(IsHeadless);
+
+    // NOTE: Frames finish in the order they were submitted in
+    for(u32 FrameOffset = 0;
+        FrameOffset < RENDER_FRAME_COUNT;
+        ++FrameOffset)
+    {
+        render_frame* Frame = Frames + ((FrameIndex + FrameOffset) % RENDER_FRAME_COUNT);
+        if(Frame->IsPending)
+        {
+            if(!ShouldWait && (vkGetFenceStatus(LogicalDevice, Frame->Fence) != VK_SUCCESS))
+            {
+                break;
+            }
+            CompleteFrame(Frame);
+        }
+    }
+
+    b32 Result = (ReadbackIndex != INVALID_READBACK_INDEX);
+    if(Result)
+    {
+        buffer& Readback = ReadbackBuffers[ReadbackIndex];
+
+        VkMappedMemoryRange Range = {VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE};
+        Range.memory = Readback.Memory;
+        Range.size = VK_WHOLE_SIZE;
+        vkInvalidateMappedMemoryRanges(LogicalDevice, 1, &Range);
+
+        *Pixels = Readback.Data;
+        *FrameNumber_ = ReadbackFrameNumber;
+    }
+
+    return Result;
+}
+
+// NOTE: Frames are appended to Path as binary PPMs, one after the other, so
+// the file can be played back as an image stream. The recording keeps the
+// size of the backbuffer it started with.
+b32 vulkan_renderer::
+BeginCapture(const char* Path)
+{
+    if(Capture || !IsCaptureSupported)
+    {
+        return false;
+    }
+
+    FILE* File = fopen(Path, "wb");
+    if(!File)
+    {
+        return false;
+    }
+
+    Capture = new frame_capture();
+    Capture->File = File;
+    Capture->Width = Width;
+    Capture->Height = Height;
+    Capture->IsBGRA = (SwapchainSurfaceFormat.format == VK_FORMAT_B8G8R8A8_UNORM) || (SwapchainSurfaceFormat.format == VK_FORMAT_B8G8R8A8_SRGB);
+    Capture->Row.resize(Width*3);
+
+    VkMemoryPropertyFlags ReadbackMemoryFlags = GetReadbackMemoryFlags();
+    for(capture_slot& Slot : Capture->Slots)
+    {
+        Slot.Capture = Capture;
+        Slot.Readback = AllocateBuffer(Width*Height*sizeof(u32), BUFFER_TRANSFER_DST, ReadbackMemoryFlags);
+        Slot.State = CaptureSlot_Free;
+    }
+
+    InitWorkQueue(&Capture->Writer, 1);
+    return true;
+}
+
+// NOTE: Waits until every captured frame is on disk
+void vulkan_renderer::
+EndCapture()
+{
+    if(!Capture)
+    {
+        return;
+    }
+
+    CompleteFrames();
+    DestroyWorkQueue(&Capture->Writer);
+
+    for(capture_slot& Slot : Capture->Slots)
+    {
+        vkDestroyBuffer(LogicalDevice, Slot.Readback.Buffer, 0);
+        vkFreeMemory(LogicalDevice, Slot.Readback.Memory, 0);
+    }
+    fclose(Capture->File);
+
+    printf("Capture: %llu frames, %llu dropped\n", 
+           (unsigned long long)(Capture->FrameCount - Capture->DroppedCount), (unsigned long long)Capture->DroppedCount);
+
+    delete Capture;
+    Capture = nullptr;
+}
+
+b32 vulkan_renderer::
+IsCapturing()
+{
+    return Capture != nullptr;
+}
+
+// NOTE: Called after the fence of a frame is waited on, the copies
+// of that frame and of the ones before it are done then
+void vulkan_renderer::
+CollectCaptures(u64 CompletedFrameNumber)
+{
+    if(!Capture)
+    {
+        return;
+    }
+
+    for(u32 SlotOffset = 0;
+        SlotOffset < CAPTURE_SLOT_COUNT;
+        ++SlotOffset)
+    {
+        capture_slot* Slot = Capture->Slots + ((Capture->NextSlot + SlotOffset) % CAPTURE_SLOT_COUNT);
+        if((Slot->State == CaptureSlot_Copying) && (Slot->FrameNumber <= CompletedFrameNumber))
+        {
+            VkMappedMemoryRange Range = {VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE};
+            Range.memory = Slot->Readback.Memory;
+            Range.size = VK_WHOLE_SIZE;
+            vkInvalidateMappedMemoryRanges(LogicalDevice, 1, &Range);
+
+            Slot->State = CaptureSlot_Writing;
+            AddEntry(&Capture->Writer, WriteCaptureJob, Slot);
+        }
+    }
 }
 
+// NOTE: Runs on the writer thread, the slot is free again when it returns
 void vulkan_renderer::
+WriteCaptureJob(u32 ThreadIndex, void* Data)
+{
+    capture_slot* Slot = (capture_slot*)Data;
+    frame_capture* Capture = Slot->Capture;
+
+    u32 RedShift  = Capture->IsBGRA ? 16 : 0;
+    u32 BlueShift = Capture->IsBGRA ? 0 : 16;
+
+    fprintf(Capture->File, "P6\n# frame %llu\n%u %u\n255\n", (unsigned long long)Slot->FrameIndex, Capture->Width, Capture->Height);
+    u32* Pixel = (u32*)Slot->Readback.Data;
+    u8* Row = Capture->Row.data();
+    for(u32 Y = 0;
+        Y < Capture->Height;
+        ++Y)
+    {
+        for(u32 X = 0;
+            X < Capture->Width;
+            ++X)
+        {
+            u32 Color = *Pixel++;
+            Row[X*3 + 0] = (u8)(Color >> RedShift);
+            Row[X*3 + 1] = (u8)(Color >> 8);
+            Row[X*3 + 2] = (u8)(Color >> BlueShift);
+        }
+        fwrite(Row, 1, Capture->Width*3, Capture->File);
+    }
+
+    Slot->State = CaptureSlot_Free;
+}
+
+// NOTE: Starts the frame graph, the backbuffer is the only resource in it.
+// Returns false when there is nothing to render into, the frame is skipped then.
+b32 vulkan_renderer::
 BeginRendering()
 {
-    vkAcquireNextImageKHR(LogicalDevice, Swapchain, ~0ull, AcquireSemaphore, VK_NULL_HANDLE/*Here could be a fence*/, &ImageIndex);
+    // NOTE: Only the frame that is reused is waited on, the one
+    // before this stays queued while this one is recorded. A
+    // headless frame was already waited on in EndRendering.
+    render_frame* Frame = Frames + FrameIndex;
+    CompleteFrame(Frame);
+    CommandBuffer = Frame->CommandBuffer;
+
+    image* Target = nullptr;
+    if(IsHeadless)
+    {
+        ImageIndex = FrameIndex;
+        Target = &OffscreenTargets[ImageIndex];
+    }
+    else
+    {
+        // NOTE: The other frame in flight still renders into the old
+        // swapchain, it has to be done before that is recreated
+        if(IsSwapchainDirty)
+        {
+            CompleteFrames();
+            if(!CreateSwapchain())
+            {
+                return false;
+            }
+        }
 
+        // NOTE: An out of date swapchain can't be presented to anymore, a
+        // suboptimal one still can, so it is recreated after this frame
+        VkResult AcquireResult = vkAcquireNextImageKHR(LogicalDevice, Swapchain, ~0ull, Frame->AcquireSemaphore, VK_NULL_HANDLE/*Here could be a fence*/, &ImageIndex);
+        if(AcquireResult == VK_ERROR_OUT_OF_DATE_KHR)
+        {
+            CompleteFrames();
+            if(!CreateSwapchain())
+            {
+                return false;
+            }
+            AcquireResult = vkAcquireNextImageKHR(LogicalDevice, Swapchain, ~0ull, Frame->AcquireSemaphore, VK_NULL_HANDLE, &ImageIndex);
+        }
+
+        if(AcquireResult == VK_SUBOPTIMAL_KHR)
+        {
+            IsSwapchainDirty = true;
+        }
+        else if(AcquireResult != VK_SUCCESS)
+        {
+            return false;
+        }
+
+        // NOTE: The first write waits for the acquire semaphore,
+        // which is waited on at the color attachment output stage
+        FrameTarget = {};
+        FrameTarget.Image = SwapchainImages[ImageIndex];
+        FrameTarget.View = SwapchainImageViews[ImageIndex];
+        FrameTarget.Width = Width;
+        FrameTarget.Height = Height;
+        FrameTarget.DescriptorIndex = INVALID_DESCRIPTOR_INDEX;
+        FrameTarget.State = {VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR, 0};
+        Target = &FrameTarget;
+    }
+
+    NextProfileFrame();
     BeginCommands();
 
-    VkClearColorValue Color = {0.086, 0.086, 0.113, 1};
-    VkClearValue ClearColor = {Color};
+    Graph.PassCount = 0;
+    Graph.ResourceCount = 0;
+    Graph.TransientCount = 0;
+
+    Backbuffer = AddResource(Target, nullptr, true);
+    Graph.Resources[Backbuffer].IsDiscardable = true;
+    Graph.Resources[Backbuffer].Framebuffer = SwapchainFramebuffers[ImageIndex];
+
+    for(thread_commands& Commands : Frame->ThreadCommands)
+    {
+        vkResetCommandPool(LogicalDevice, Commands.CommandPool, 0);
+        Commands.UsedCount = 0;
+    }
+
+    return true;
+}
+
+// NOTE: Dynamic state is not inherited, every secondary sets its own
+void vulkan_renderer::
+SetViewport(VkCommandBuffer CommandBuffer_, u32 ViewportWidth, u32 ViewportHeight)
+{
+    if(!ViewportWidth)
+    {
+        ViewportWidth = Width;
+    }
+
+    if(!ViewportHeight)
+    {
+        ViewportHeight = Height;
+    }
+
+    VkViewport Viewport = {0, (r32)ViewportHeight, (r32)ViewportWidth, -(r32)ViewportHeight};
+    VkRect2D   Scissor  = {{0, 0}, {ViewportWidth, ViewportHeight}};
+
+    vkCmdSetViewport(CommandBuffer_, 0, 1, &Viewport);
+    vkCmdSetScissor(CommandBuffer_, 0, 1, &Scissor);
+}
+
+// NOTE: The callback runs on a worker thread, it can only record into
+// the command buffer it gets. Materials have to be looked up before.
+void vulkan_renderer::
+RecordLayer(render_layer Layer, render_layer_callback* Callback, void* Data)
+{
+    render_layer_job* Job = LayerJobs + Layer;
+    Assert(!Job->Callback);
+
+    Job->Renderer = this;
+    Job->Callback = Callback;
+    Job->Data = Data;
+    Job->CommandBuffer = VK_NULL_HANDLE;
+
+    AddEntry(&RecordQueue, RecordLayerJob, Job);
+}
+
+void vulkan_renderer::
+RecordLayerJob(u32 ThreadIndex, void* Data)
+{
+    render_layer_job* Job = (render_layer_job*)Data;
+    vulkan_renderer* Renderer = Job->Renderer;
+    thread_commands* Commands = &Renderer->Frames[Renderer->FrameIndex].ThreadCommands[ThreadIndex];
 
-    VkRenderPassBeginInfo RenderPassBeginInfo = {VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO};
-    RenderPassBeginInfo.renderPass = RenderPass;
-    RenderPassBeginInfo.framebuffer = SwapchainFramebuffers[ImageIndex];
-    RenderPassBeginInfo.renderArea.extent.width = Width;
-    RenderPassBeginInfo.renderArea.extent.height = Height;
-    RenderPassBeginInfo.clearValueCount = 1;
-    RenderPassBeginInfo.pClearValues = &ClearColor;
+    if(Commands->UsedCount == Commands->CommandBuffers.size())
+    {
+        VkCommandBufferAllocateInfo CommandBufferAllocateInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+        CommandBufferAllocateInfo.commandPool = Commands->CommandPool;
+        CommandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        CommandBufferAllocateInfo.commandBufferCount = 1;
+
+        VkCommandBuffer NewCommandBuffer;
+        VK_CHECK(vkAllocateCommandBuffers(Renderer->LogicalDevice, &CommandBufferAllocateInfo, &NewCommandBuffer));
+        Commands->CommandBuffers.push_back(NewCommandBuffer);
+    }
+    VkCommandBuffer LayerCommandBuffer = Commands->CommandBuffers[Commands->UsedCount++];
 
-    vkCmdBeginRenderPass(CommandBuffer, &RenderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+    VkCommandBufferInheritanceInfo InheritanceInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO};
+    InheritanceInfo.renderPass = Renderer->RenderPass;
+    InheritanceInfo.subpass = 0;
+    // NOTE: The layers are recorded before the graph knows where they go
+    InheritanceInfo.framebuffer = VK_NULL_HANDLE;
+    InheritanceInfo.pipelineStatistics = Renderer->IsStatisticsEnabled ? PROFILE_STATISTICS_FLAGS : 0;
+
+    VkCommandBufferBeginInfo CommandBufferBeginInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    CommandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT|VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    CommandBufferBeginInfo.pInheritanceInfo = &InheritanceInfo;
 
-    VkViewport Viewport = {0, (r32)Height, (r32)Width, -(r32)Height};
-    VkRect2D   Scissor  = {{0, 0}, {Width, Height}};
+    vkBeginCommandBuffer(LayerCommandBuffer, &CommandBufferBeginInfo);
+    Renderer->SetViewport(LayerCommandBuffer);
+    u32 Scope = Renderer->BeginProfileScope(LayerCommandBuffer, RenderLayerNames[Job - Renderer->LayerJobs]);
+    Job->Callback(Renderer, LayerCommandBuffer, Job->Data);
+    Renderer->EndProfileScope(LayerCommandBuffer, Scope);
+    vkEndCommandBuffer(LayerCommandBuffer);
 
-    vkCmdSetViewport(CommandBuffer, 0, 1, &Viewport);
-    vkCmdSetScissor(CommandBuffer, 0, 1, &Scissor);
+    Job->CommandBuffer = LayerCommandBuffer;
 }
 
 void vulkan_renderer::
@@ -926,112 +2666,1236 @@ DrawImage(image Image, v3 StartPointSrc, v3 StartPointDst)
                    1, &ImageCopy);
 }
 
+// NOTE: Gives the buffer a slot in the bindless array, the slot is written
+// only once, so nothing is updated per frame
 void vulkan_renderer::
-BindBuffer(buffer& VertexBuffer, u32 Binding)
+BindBuffer(buffer& Buffer)
 {
-    PFN_vkCmdPushDescriptorSetKHR vkCmdPushDescriptorSetKHR = (PFN_vkCmdPushDescriptorSetKHR)vkGetInstanceProcAddr(Instance, "vkCmdPushDescriptorSetKHR");
+    // NOTE: Layers are recorded on several threads at once
+    std::lock_guard<std::mutex> Lock(DescriptorMutex);
+    if(!IsBindless || (Buffer.DescriptorIndex != INVALID_DESCRIPTOR_INDEX))
+    {
+        return;
+    }
 
-    vkCmdBindPipeline(CommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, MainPipeline);
+    Assert(BufferDescriptorCount < MAX_BINDLESS_RESOURCES);
+    Buffer.DescriptorIndex = BufferDescriptorCount++;
 
     VkDescriptorBufferInfo BufferInfo = {};
-    BufferInfo.buffer = VertexBuffer.Buffer;
+    BufferInfo.buffer = Buffer.Buffer;
     BufferInfo.offset = 0;
-    BufferInfo.range  = VertexBuffer.Size;
+    BufferInfo.range  = Buffer.Size;
 
-    VkWriteDescriptorSet WriteDescriptor = WriteBuffer(&BufferInfo, MainDescriptor, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, Binding);
+    VkWriteDescriptorSet WriteDescriptor = WriteBuffer(&BufferInfo, MainDescriptor, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0);
+    WriteDescriptor.dstArrayElement = Buffer.DescriptorIndex;
 
-    //vkCmdPushDescriptorSetKHR(CommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, MainPipelineLayout, 0, 1, &WriteDescriptor);
     vkUpdateDescriptorSets(LogicalDevice, 1, &WriteDescriptor, 0, nullptr);
 }
 
 void vulkan_renderer::
-BindImage(image& Image, u32 Binding)
+BindImage(image& Image)
 {
-    PFN_vkCmdPushDescriptorSetKHR vkCmdPushDescriptorSetKHR = (PFN_vkCmdPushDescriptorSetKHR)vkGetInstanceProcAddr(Instance, "vkCmdPushDescriptorSetKHR");
+    std::lock_guard<std::mutex> Lock(DescriptorMutex);
+    if(!IsBindless || (Image.DescriptorIndex != INVALID_DESCRIPTOR_INDEX))
+    {
+        return;
+    }
 
+    Assert(ImageDescriptorCount < MAX_BINDLESS_RESOURCES);
+    Image.DescriptorIndex = ImageDescriptorCount++;
+    WriteImageDescriptor(Image);
+}
+
+// NOTE: Points the bindless slot of the image at its view
+void vulkan_renderer::
+WriteImageDescriptor(image& Image)
+{
     VkDescriptorImageInfo ImageInfo = {};
     ImageInfo.sampler = MainImageSampler;
     ImageInfo.imageView = Image.View;
-    ImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    ImageInfo.imageLayout = GetSampledLayout(Image);
 
-    VkWriteDescriptorSet WriteDescriptor;// = WriteImage(&ImageInfo, MainDescriptor, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, Binding);
+    VkWriteDescriptorSet WriteDescriptor = WriteImage(&ImageInfo, MainDescriptor, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1);
+    WriteDescriptor.dstArrayElement = Image.DescriptorIndex;
 
-    vkUpdateDescriptorSets(LogicalDevice, 1, &WriteDescriptor, 0, 0);
-
-    //vkCmdPushDescriptorSetKHR(CommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, MainPipelineLayout, 0, 1, &WriteDescriptor);
-    //vkCmdBindDescriptorSets(CommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, MainPipelineLayout, 0, 1, &MainDescriptor, 0, nullptr);
+    vkUpdateDescriptorSets(LogicalDevice, 1, &WriteDescriptor, 0, nullptr);
 }
 
+// NOTE: Makes the buffer and the image visible to the next draw. With
+// bindless only their indices are pushed, otherwise both descriptors
+// are pushed into slot 0 of their arrays.
 void vulkan_renderer::
-DrawMeshes(buffer& VertexBuffer, buffer& IndexBuffer, image& Image)
+BindResources(VkCommandBuffer CommandBuffer_, material& Material, buffer& Buffer, image& Image)
 {
-    BeginRendering();
+    // NOTE: Sampled images have to be read by the graph pass that draws them
+    Assert(Image.State.Layout == GetSampledLayout(Image));
 
-    PFN_vkCmdPushDescriptorSetKHR vkCmdPushDescriptorSetKHR = (PFN_vkCmdPushDescriptorSetKHR)vkGetInstanceProcAddr(Instance, "vkCmdPushDescriptorSetKHR");
+    u32 DescriptorIndices[2] = {};
+    if(IsBindless)
+    {
+        BindBuffer(Buffer);
+        BindImage(Image);
 
-    UpdateImageLayout(Image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        DescriptorIndices[0] = Buffer.DescriptorIndex;
+        DescriptorIndices[1] = Image.DescriptorIndex;
+        vkCmdBindDescriptorSets(CommandBuffer_, VK_PIPELINE_BIND_POINT_GRAPHICS, Material.PipelineLayout, 0, 1, &MainDescriptor, 0, nullptr);
+    }
+    else
+    {
+        VkDescriptorBufferInfo BufferInfo = {};
+        BufferInfo.buffer = Buffer.Buffer;
+        BufferInfo.offset = 0;
+        BufferInfo.range  = Buffer.Size;
 
-    vkCmdBindPipeline(CommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, MainPipeline);
-    VkWriteDescriptorSet WriteDescriptor[2];
+        VkDescriptorImageInfo ImageInfo = {};
+        ImageInfo.sampler = MainImageSampler;
+        ImageInfo.imageView = Image.View;
+        ImageInfo.imageLayout = GetSampledLayout(Image);
 
-    VkDescriptorBufferInfo BufferInfo = {};
-    BufferInfo.buffer = VertexBuffer.Buffer;
-    BufferInfo.offset = 0;
-    BufferInfo.range  = VertexBuffer.Size;
+        VkWriteDescriptorSet WriteDescriptor[2];
+        WriteDescriptor[0] = WriteBuffer(&BufferInfo, VK_NULL_HANDLE, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0);
+        WriteDescriptor[1] = WriteImage(&ImageInfo, VK_NULL_HANDLE, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1);
 
-    VkDescriptorImageInfo ImageInfo = {};
-    ImageInfo.sampler = MainImageSampler;
-    ImageInfo.imageView = Image.View;
-    ImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        CmdPushDescriptorSet(CommandBuffer_, VK_PIPELINE_BIND_POINT_GRAPHICS, Material.PipelineLayout, 0, ArraySize(WriteDescriptor), WriteDescriptor);
+    }
 
-    WriteDescriptor[0] = WriteBuffer(&BufferInfo, MainDescriptor, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0);
-    WriteDescriptor[1] = WriteImage(&ImageInfo, MainDescriptor, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1);
+    vkCmdPushConstants(CommandBuffer_, Material.PipelineLayout, VK_SHADER_STAGE_VERTEX_BIT|VK_SHADER_STAGE_FRAGMENT_BIT, 
+                       DESCRIPTOR_INDICES_OFFSET, sizeof(DescriptorIndices), DescriptorIndices);
+}
 
-    vkUpdateDescriptorSets(LogicalDevice, ArraySize(WriteDescriptor), WriteDescriptor, 0, 0);
-    vkCmdBindDescriptorSets(CommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, MainPipelineLayout, 0, 1, &MainDescriptor, 0, nullptr);
+void vulkan_renderer::
+DrawMeshes(VkCommandBuffer CommandBuffer_, material& Material, buffer& VertexBuffer, buffer& IndexBuffer, image& Image, u32 IndexCount)
+{
+    if(!Material.Pipeline)
+    {
+        return;
+    }
 
-    vkCmdBindIndexBuffer(CommandBuffer, IndexBuffer.Buffer, 0, VK_INDEX_TYPE_UINT32);
-    vkCmdDrawIndexed(CommandBuffer, 6, 1, 0, 0, 0); 
+    vkCmdBindPipeline(CommandBuffer_, VK_PIPELINE_BIND_POINT_GRAPHICS, Material.Pipeline);
+    BindResources(CommandBuffer_, Material, VertexBuffer, Image);
 
-    EndRendering();
+    vkCmdBindIndexBuffer(CommandBuffer_, IndexBuffer.Buffer, 0, VK_INDEX_TYPE_UINT32);
+    vkCmdDrawIndexed(CommandBuffer_, IndexCount, 1, 0, 0, 0); 
 }
 
+// NOTE: Every instance is one quad, so the index buffer
+// only has to hold the 6 indices of a single quad
+void vulkan_renderer::
+DrawQuads(VkCommandBuffer CommandBuffer_, material& Material, buffer& InstanceBuffer, buffer& IndexBuffer, image& Image, u32 InstanceCount, view_constants& View)
+{
+    if(!InstanceCount || !Material.Pipeline)
+    {
+        return;
+    }
+
+    vkCmdBindPipeline(CommandBuffer_, VK_PIPELINE_BIND_POINT_GRAPHICS, Material.Pipeline);
+    BindResources(CommandBuffer_, Material, InstanceBuffer, Image);
+    vkCmdPushConstants(CommandBuffer_, Material.PipelineLayout, VK_SHADER_STAGE_VERTEX_BIT|VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(view_constants), &View);
+
+    vkCmdBindIndexBuffer(CommandBuffer_, IndexBuffer.Buffer, 0, VK_INDEX_TYPE_UINT32);
+    vkCmdDrawIndexed(CommandBuffer_, 6, InstanceCount, 0, 0, 0);
+}
+
+// NOTE: Same as DrawQuads, but the instance count comes from the cull pass.
+// Without drawIndirectCount the single record is drawn anyway, a fully
+// culled view then costs one draw with zero instances.
+void vulkan_renderer::
+DrawQuadsIndirect(VkCommandBuffer CommandBuffer_, material& Material, buffer& InstanceBuffer, buffer& IndexBuffer, image& Image, buffer& Draws, view_constants& View)
+{
+    if(!Material.Pipeline)
+    {
+        return;
+    }
+
+    vkCmdBindPipeline(CommandBuffer_, VK_PIPELINE_BIND_POINT_GRAPHICS, Material.Pipeline);
+    BindResources(CommandBuffer_, Material, InstanceBuffer, Image);
+    vkCmdPushConstants(CommandBuffer_, Material.PipelineLayout, VK_SHADER_STAGE_VERTEX_BIT|VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(view_constants), &View);
+
+    vkCmdBindIndexBuffer(CommandBuffer_, IndexBuffer.Buffer, 0, VK_INDEX_TYPE_UINT32);
+    if(IsDrawIndirectCountEnabled)
+    {
+        vkCmdDrawIndexedIndirectCount(CommandBuffer_, Draws.Buffer, offsetof(indirect_quads, Command), Draws.Buffer, offsetof(indirect_quads, DrawCount),
+                                      1, sizeof(VkDrawIndexedIndirectCommand));
+    }
+    else
+    {
+        vkCmdDrawIndexedIndirect(CommandBuffer_, Draws.Buffer, offsetof(indirect_quads, Command), 1, sizeof(VkDrawIndexedIndirectCommand));
+    }
+}
+
+// NOTE: Clears the counts before the cull pass appends to them.
+// It is recorded from a transfer pass that writes Draws as BufferUsage_TransferDst.
+void vulkan_renderer::
+ResetQuadDraws(VkCommandBuffer CommandBuffer_, buffer& Draws)
+{
+    indirect_quads Reset = {};
+    Reset.Command.indexCount = 6;
+    vkCmdUpdateBuffer(CommandBuffer_, Draws.Buffer, 0, sizeof(indirect_quads), &Reset);
+}
+
+// NOTE: Compacts the instances that overlap the view area into Culled and
+// counts them in Draws, one invocation per instance. The order of the
+// survivors is not kept. It is recorded from a compute pass that reads
+// Instances and writes Culled and Draws as BufferUsage_ShaderWrite.
+void vulkan_renderer::
+CullQuads(VkCommandBuffer CommandBuffer_, material& Material, buffer& Instances, u32 InstanceCount, buffer& Culled, buffer& Draws, rectangle2 ViewArea)
+{
+    if(!InstanceCount || !Material.Pipeline)
+    {
+        return;
+    }
+
+    buffer* Buffers[3] = {&Instances, &Culled, &Draws};
+    render_frame* Frame = Frames + FrameIndex;
+
+    // NOTE: The set is rewritten only when the pass gets different resources
+    b32 IsChanged = false;
+    for(u32 BufferIndex = 0;
+        BufferIndex < ArraySize(Buffers);
+        ++BufferIndex)
+    {
+        IsChanged |= (Frame->CullBuffers[BufferIndex] != Buffers[BufferIndex]->Buffer);
+    }
+
+    if(IsChanged)
+    {
+        VkDescriptorBufferInfo BufferInfo[3] = {};
+        VkWriteDescriptorSet WriteDescriptor[3];
+        for(u32 BufferIndex = 0;
+            BufferIndex < ArraySize(Buffers);
+            ++BufferIndex)
+        {
+            BufferInfo[BufferIndex].buffer = Buffers[BufferIndex]->Buffer;
+            BufferInfo[BufferIndex].offset = 0;
+            BufferInfo[BufferIndex].range  = Buffers[BufferIndex]->Size;
+            WriteDescriptor[BufferIndex] = WriteBuffer(&BufferInfo[BufferIndex], Frame->CullDescriptor, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, BufferIndex);
+            Frame->CullBuffers[BufferIndex] = Buffers[BufferIndex]->Buffer;
+        }
+        vkUpdateDescriptorSets(LogicalDevice, ArraySize(WriteDescriptor), WriteDescriptor, 0, 0);
+    }
+
+    struct
+    {
+        rectangle2 ViewArea;
+        u32 InstanceCount;
+    } Constants = {ViewArea, InstanceCount};
+
+    vkCmdBindPipeline(CommandBuffer_, VK_PIPELINE_BIND_POINT_COMPUTE, Material.Pipeline);
+    vkCmdBindDescriptorSets(CommandBuffer_, VK_PIPELINE_BIND_POINT_COMPUTE, Material.PipelineLayout, 0, 1, &Frame->CullDescriptor, 0, nullptr);
+    vkCmdPushConstants(CommandBuffer_, Material.PipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(Constants), &Constants);
+    vkCmdDispatch(CommandBuffer_, (InstanceCount + 63) / 64, 1, 1);
+}
+
+// NOTE: The board is generated in the fragment shader from the
+// push constants only, it is one fullscreen triangle without any
+// textures or buffers bound
+void vulkan_renderer::
+DrawBoard(VkCommandBuffer CommandBuffer_, material& Material, void* Constants, u32 ConstantsSize)
+{
+    Assert(ConstantsSize <= DESCRIPTOR_INDICES_OFFSET);
+    if(!Material.Pipeline)
+    {
+        return;
+    }
+
+    vkCmdBindPipeline(CommandBuffer_, VK_PIPELINE_BIND_POINT_GRAPHICS, Material.Pipeline);
+    vkCmdPushConstants(CommandBuffer_, Material.PipelineLayout, VK_SHADER_STAGE_VERTEX_BIT|VK_SHADER_STAGE_FRAGMENT_BIT, 0, ConstantsSize, Constants);
+    vkCmdDraw(CommandBuffer_, 3, 1, 0, 0);
+}
+
+// NOTE: Rasterizes the command stream into the target with one workgroup
+// per 16x16 tile. The target keeps its content, uncovered pixels are
+// loaded back. It is recorded from a compute pass of the render graph,
+// which writes the target as ImageUsage_Storage.
+void vulkan_renderer::
+RasterizeCommands(VkCommandBuffer CommandBuffer_, material& Material, image& Target, buffer& Commands, u32 CommandCount)
+{
+    Assert(Target.State.Layout == VK_IMAGE_LAYOUT_GENERAL);
+
+    VkDescriptorBufferInfo BufferInfo = {};
+    BufferInfo.buffer = Commands.Buffer;
+    BufferInfo.offset = 0;
+    BufferInfo.range  = Commands.Size;
+
+    VkDescriptorImageInfo ImageInfo = {};
+    ImageInfo.imageView = Target.StorageView;
+    ImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    // NOTE: The set is rewritten only when the pass gets different resources
+    render_frame* Frame = Frames + FrameIndex;
+    if((Frame->RasterTargetView != Target.StorageView) || (Frame->RasterCommandsBuffer != Commands.Buffer))
+    {
+        VkWriteDescriptorSet WriteDescriptor[2];
+        WriteDescriptor[0] = WriteBuffer(&BufferInfo, Frame->RasterDescriptor, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0);
+        WriteDescriptor[1] = WriteImage(&ImageInfo, Frame->RasterDescriptor, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1);
+        vkUpdateDescriptorSets(LogicalDevice, ArraySize(WriteDescriptor), WriteDescriptor, 0, 0);
+
+        Frame->RasterTargetView = Target.StorageView;
+        Frame->RasterCommandsBuffer = Commands.Buffer;
+    }
+
+    vkCmdBindPipeline(CommandBuffer_, VK_PIPELINE_BIND_POINT_COMPUTE, Material.Pipeline);
+    vkCmdBindDescriptorSets(CommandBuffer_, VK_PIPELINE_BIND_POINT_COMPUTE, Material.PipelineLayout, 0, 1, &Frame->RasterDescriptor, 0, nullptr);
+    vkCmdPushConstants(CommandBuffer_, Material.PipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(u32), &CommandCount);
+    vkCmdDispatch(CommandBuffer_, (Target.Width + 15) / 16, (Target.Height + 15) / 16, 1);
+}
+
+// NOTE: Everything of the frame is recorded here, after the layers are done
 void vulkan_renderer::
 EndRendering()
 {
-    vkCmdEndRenderPass(CommandBuffer);
+    CompleteAllWork(&RecordQueue);
+
+    // NOTE: The copy is a pass as well, so it is ordered after every write
+    if(IsHeadless)
+    {
+        u32 ReadbackPass = AddPass("Readback", GraphPass_Transfer, RecordReadback, nullptr);
+        PassRead(ReadbackPass, Backbuffer, ImageUsage_TransferSrc);
+        PassWrite(ReadbackPass, ImportBuffer(ReadbackBuffers[ImageIndex]), BufferUsage_TransferDst);
+    }
+
+    // NOTE: Frames of another size than the recording are left out of it,
+    // the same as the ones that find the next slot still being written
+    if(Capture)
+    {
+        capture_slot* Slot = Capture->Slots + Capture->NextSlot;
+        image& Target = GetImage(Backbuffer);
+        if((Slot->State == CaptureSlot_Free) && (Target.Width == Capture->Width) && (Target.Height == Capture->Height))
+        {
+            Slot->State = CaptureSlot_Copying;
+            Slot->FrameIndex = Capture->FrameCount;
+            Slot->FrameNumber = FrameNumber;
+            Capture->NextSlot = (Capture->NextSlot + 1) % CAPTURE_SLOT_COUNT;
+
+            u32 CapturePass = AddPass("Capture", GraphPass_Transfer, RecordCapture, Slot);
+            PassRead(CapturePass, Backbuffer, ImageUsage_TransferSrc);
+            PassWrite(CapturePass, ImportBuffer(Slot->Readback), BufferUsage_TransferDst);
+        }
+        else
+        {
+            ++Capture->DroppedCount;
+        }
+        ++Capture->FrameCount;
+    }
+
+    // NOTE: Uploads can be made until here, the whole frame is recorded after them
+    AcquireTransfers(CommandBuffer);
+    ExecuteGraph();
 
-    EndCommands(&AcquireSemaphore, &ReleaseSemaphore);
+    for(render_layer_job& Job : LayerJobs)
+    {
+        Job = {};
+    }
+
+    render_frame* Frame = Frames + FrameIndex;
+    if(IsHeadless)
+    {
+        // NOTE: Nothing to present. The frame before this one is waited on
+        // only now, so the gpu always has the next frame queued while the
+        // host reads back or records. GetReadback can collect it sooner.
+        EndCommands(nullptr, nullptr, Frame->Fence);
+        Frame->IsPending = true;
+        Frame->FrameNumber = FrameNumber++;
+
+        FrameIndex = (FrameIndex + 1) % RENDER_FRAME_COUNT;
+        CompleteFrame(Frames + FrameIndex);
+        return;
+    }
+
+    barrier_batch Barriers;
+    TrackImage(&Barriers, FrameTarget, ImageUsage_Present);
+    FlushBarriers(CommandBuffer, &Barriers);
+
+    VkSemaphore ReleaseSemaphore = ReleaseSemaphores[ImageIndex];
+    EndCommands(&Frame->AcquireSemaphore, &ReleaseSemaphore, Frame->Fence);
+    Frame->IsPending = true;
+    Frame->FrameNumber = FrameNumber++;
+
+    ++PresentId;
+    VkPresentIdKHR PresentIdInfo = {VK_STRUCTURE_TYPE_PRESENT_ID_KHR};
+    PresentIdInfo.swapchainCount = 1;
+    PresentIdInfo.pPresentIds = &PresentId;
 
     VkPresentInfoKHR PresentInfo = {};
     PresentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-    PresentInfo.waitSemaphoreCount = (u32)RenderingSemaphores.size();
-    PresentInfo.pWaitSemaphores = (RenderingSemaphores.size() > 0) ? &RenderingSemaphores[0] : nullptr;
+    PresentInfo.pNext = IsPresentWaitEnabled ? &PresentIdInfo : nullptr;
     PresentInfo.swapchainCount = 1;
     PresentInfo.pSwapchains = &Swapchain;
     PresentInfo.pImageIndices = &ImageIndex;
     PresentInfo.waitSemaphoreCount = 1;
     PresentInfo.pWaitSemaphores = &ReleaseSemaphore;
 
-    VK_CHECK(vkQueuePresentKHR(Queue, &PresentInfo));
+    VkResult PresentResult = vkQueuePresentKHR(Queue, &PresentInfo);
+    if((PresentResult == VK_ERROR_OUT_OF_DATE_KHR) || (PresentResult == VK_SUBOPTIMAL_KHR))
+    {
+        IsSwapchainDirty = true;
+    }
+    else
+    {
+        VK_CHECK(PresentResult);
+    }
+
+    // NOTE: Nothing is waited on here, the next BeginRendering
+    // waits for the frame before this one
+    FrameIndex = (FrameIndex + 1) % RENDER_FRAME_COUNT;
 
-    VK_CHECK(vkDeviceWaitIdle(LogicalDevice));
+    // NOTE: The old swapchain had its last present queued before this frame
+    if(RetiredSwapchain && !IsSwapchainDirty)
+    {
+        vkDestroySwapchainKHR(LogicalDevice, RetiredSwapchain, nullptr);
+        RetiredSwapchain = VK_NULL_HANDLE;
+    }
+}
+
+// NOTE: Layers can finish in any order, they are executed by their index
+void vulkan_renderer::
+ExecuteLayers(vulkan_renderer* Renderer, VkCommandBuffer CommandBuffer_, void* Data)
+{
+    VkCommandBuffer LayerCommandBuffers[RenderLayer_Count];
+    u32 LayerCount = 0;
+    for(render_layer_job& Job : Renderer->LayerJobs)
+    {
+        if(Job.CommandBuffer)
+        {
+            LayerCommandBuffers[LayerCount++] = Job.CommandBuffer;
+        }
+    }
+
+    if(LayerCount)
+    {
+        vkCmdExecuteCommands(CommandBuffer_, LayerCount, LayerCommandBuffers);
+    }
+}
+
+// NOTE: The host isn't a pass of the graph, so the copy is made visible to it here
+void vulkan_renderer::
+RecordReadback(vulkan_renderer* Renderer, VkCommandBuffer CommandBuffer_, void* Data)
+{
+    image& Target = Renderer->OffscreenTargets[Renderer->ImageIndex];
+    buffer& Readback = Renderer->ReadbackBuffers[Renderer->ImageIndex];
+
+    VkBufferImageCopy ImageBufferCopy = {};
+    ImageBufferCopy.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    ImageBufferCopy.imageExtent = {Target.Width, Target.Height, 1};
+    vkCmdCopyImageToBuffer(CommandBuffer_, Target.Image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, Readback.Buffer, 1, &ImageBufferCopy);
+
+    barrier_batch Barriers;
+    Barriers.BufferBarriers.push_back(Renderer->CreateMemoryBarrier(Readback, VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR, VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR, 
+                                                                    VK_PIPELINE_STAGE_2_HOST_BIT_KHR, VK_ACCESS_2_HOST_READ_BIT_KHR));
+    Renderer->FlushBarriers(CommandBuffer_, &Barriers);
+}
+
+void vulkan_renderer::
+RecordCapture(vulkan_renderer* Renderer, VkCommandBuffer CommandBuffer_, void* Data)
+{
+    capture_slot* Slot = (capture_slot*)Data;
+    image& Target = Renderer->GetImage(Renderer->Backbuffer);
+
+    VkBufferImageCopy ImageBufferCopy = {};
+    ImageBufferCopy.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    ImageBufferCopy.imageExtent = {Target.Width, Target.Height, 1};
+    vkCmdCopyImageToBuffer(CommandBuffer_, Target.Image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, Slot->Readback.Buffer, 1, &ImageBufferCopy);
+
+    barrier_batch Barriers;
+    Barriers.BufferBarriers.push_back(Renderer->CreateMemoryBarrier(Slot->Readback, VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR, VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR, 
+                                                                    VK_PIPELINE_STAGE_2_HOST_BIT_KHR, VK_ACCESS_2_HOST_READ_BIT_KHR));
+    Renderer->FlushBarriers(CommandBuffer_, &Barriers);
+}
+
+graph_resource vulkan_renderer::
+AddResource(image* Image, buffer* Buffer, b32 IsImported)
+{
+    Assert(Graph.ResourceCount < MAX_GRAPH_RESOURCES);
+    graph_resource Result = Graph.ResourceCount++;
+
+    graph_resource_entry* Entry = Graph.Resources + Result;
+    *Entry = {};
+    Entry->Image = Image;
+    Entry->Buffer = Buffer;
+    Entry->IsImported = IsImported;
+    Entry->IsDiscardable = !IsImported;
+    Entry->FirstPass = INVALID_GRAPH_PASS;
+    Entry->LastPass = INVALID_GRAPH_PASS;
+
+    // NOTE: Buffers don't keep their state between frames. The last frame
+    // can still run on the queue, so the first write waits for all of it.
+    if(Buffer)
+    {
+        Entry->BufferState.Stage = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR;
+        Entry->BufferState.Access = 0;
+    }
+
+    return Result;
+}
+
+// NOTE: Cleared by the first pass that draws into it
+graph_resource vulkan_renderer::
+GetBackbuffer()
+{
+    return Backbuffer;
+}
+
+// NOTE: The image has to stay where it is until EndRendering
+graph_resource vulkan_renderer::
+ImportImage(image& Image)
+{
+    return AddResource(&Image, nullptr, true);
+}
+
+graph_resource vulkan_renderer::
+ImportBuffer(buffer& Buffer)
+{
+    return AddResource(nullptr, &Buffer, true);
+}
+
+// NOTE: The content is undefined until the first pass that uses it writes it.
+// Transients are matched to last frame's ones by the order they are created in.
+graph_resource vulkan_renderer::
+CreateTransientImage(u32 ImageWidth, u32 ImageHeight, VkImageUsageFlags Usage)
+{
+    Assert(Graph.TransientCount < MAX_TRANSIENT_IMAGES);
+    u32 TransientIndex = Graph.TransientCount++;
+
+    transient_image* Transient = Graph.Transients + TransientIndex;
+    Transient->Width = ImageWidth;
+    Transient->Height = ImageHeight;
+    Transient->Usage = Usage;
+
+    graph_resource Result = AddResource(&Transient->Image, nullptr, false);
+    Graph.Resources[Result].TransientIndex = TransientIndex;
+
+    return Result;
+}
+
+u32 vulkan_renderer::
+AddPass(const char* Name, graph_pass_type Type, graph_pass_callback* Callback, void* Data)
+{
+    Assert(Graph.PassCount < MAX_GRAPH_PASSES);
+    u32 Result = Graph.PassCount++;
+
+    graph_pass* Pass = Graph.Passes + Result;
+    *Pass = {};
+    Pass->Name = Name;
+    Pass->Type = Type;
+    Pass->Callback = Callback;
+    Pass->Data = Data;
+
+    return Result;
+}
+
+// NOTE: Executes the layers recorded for this frame, so there can only be one
+u32 vulkan_renderer::
+AddLayerPass(const char* Name)
+{
+    for(u32 PassIndex = 0;
+        PassIndex < Graph.PassCount;
+        ++PassIndex)
+    {
+        Assert(Graph.Passes[PassIndex].Type != GraphPass_Layers);
+    }
+
+    return AddPass(Name, GraphPass_Layers, ExecuteLayers, nullptr);
+}
+
+void vulkan_renderer::
+AddAccess(u32 Pass, graph_resource Resource, u32 Usage, b32 IsWrite)
+{
+    Assert(Pass < Graph.PassCount);
+    Assert(Resource < Graph.ResourceCount);
+
+    graph_pass* Entry = Graph.Passes + Pass;
+    Assert(Entry->AccessCount < MAX_GRAPH_ACCESSES);
+    Entry->Accesses[Entry->AccessCount++] = {Resource, Usage, IsWrite};
+}
+
+void vulkan_renderer::
+PassRead(u32 Pass, graph_resource Resource, image_usage Usage)
+{
+    Assert(Graph.Resources[Resource].Image);
+    AddAccess(Pass, Resource, Usage, false);
+}
+
+void vulkan_renderer::
+PassRead(u32 Pass, graph_resource Resource, buffer_usage Usage)
+{
+    Assert(Graph.Resources[Resource].Buffer);
+    AddAccess(Pass, Resource, Usage, false);
+}
+
+void vulkan_renderer::
+PassWrite(u32 Pass, graph_resource Resource, image_usage Usage)
+{
+    Assert(Graph.Resources[Resource].Image);
+    AddAccess(Pass, Resource, Usage, true);
+}
+
+void vulkan_renderer::
+PassWrite(u32 Pass, graph_resource Resource, buffer_usage Usage)
+{
+    Assert(Graph.Resources[Resource].Buffer);
+    AddAccess(Pass, Resource, Usage, true);
+}
+
+// NOTE: Transients only have an image once the graph is executed,
+// so this is meant for the pass callbacks
+image& vulkan_renderer::
+GetImage(graph_resource Resource)
+{
+    Assert(Graph.Resources[Resource].Image);
+    return *Graph.Resources[Resource].Image;
+}
+
+// NOTE: Walks the passes backwards. A pass is needed when it writes something
+// that outlives the frame, or something a needed pass after it uses. Writes
+// may keep the old content, so they need the passes before them as well.
+void vulkan_renderer::
+CullPasses()
+{
+    b32 IsNeeded[MAX_GRAPH_RESOURCES] = {};
+    for(u32 PassIndex = Graph.PassCount;
+        PassIndex > 0;
+        --PassIndex)
+    {
+        graph_pass* Pass = Graph.Passes + PassIndex - 1;
+
+        Pass->IsCulled = true;
+        for(u32 AccessIndex = 0;
+            AccessIndex < Pass->AccessCount;
+            ++AccessIndex)
+        {
+            graph_access* Access = Pass->Accesses + AccessIndex;
+            if(Access->IsWrite && (Graph.Resources[Access->Resource].IsImported || IsNeeded[Access->Resource]))
+            {
+                Pass->IsCulled = false;
+            }
+        }
+
+        if(!Pass->IsCulled)
+        {
+            for(u32 AccessIndex = 0;
+                AccessIndex < Pass->AccessCount;
+                ++AccessIndex)
+            {
+                IsNeeded[Pass->Accesses[AccessIndex].Resource] = true;
+            }
+        }
+    }
+}
+
+internal b32
+IsTransientAliveWith(transient_image* A, transient_image* B)
+{
+    b32 Result = (A->FirstPass <= B->LastPass) && (B->FirstPass <= A->LastPass);
+    return Result;
+}
+
+internal b32
+IsTransientMemoryShared(transient_image* A, transient_image* B)
+{
+    b32 Result = (A->Offset < (B->Offset + B->Size)) && (B->Offset < (A->Offset + A->Size));
+    return Result;
+}
+
+// NOTE: Biggest first, every transient goes to the lowest offset where it doesn't
+// overlap a transient that is alive at the same time. The frames still in
+// flight use the old images, so they are waited on before those are destroyed.
+void vulkan_renderer::
+AllocateTransients()
+{
+    u64 Hash = 14695981039346656037ull;
+    for(u32 TransientIndex = 0;
+        TransientIndex < Graph.TransientCount;
+        ++TransientIndex)
+    {
+        transient_image* Transient = Graph.Transients + TransientIndex;
+        u32 Values[] = {Transient->Width, Transient->Height, Transient->Usage, Transient->FirstPass, Transient->LastPass};
+        for(u32 Value : Values)
+        {
+            Hash = (Hash ^ Value) * 1099511628211ull;
+        }
+    }
+
+    if((Hash == Graph.TransientHash) && (Graph.TransientCount == Graph.AllocatedTransientCount))
+    {
+        return;
+    }
+
+    CompleteFrames();
+    DestroyTransients();
+    Graph.TransientHash = Hash;
+    if(!Graph.TransientCount)
+    {
+        return;
+    }
+
+    u32 MemoryTypeBits = ~0u;
+    VkDeviceSize Alignments[MAX_TRANSIENT_IMAGES];
+    u32 Order[MAX_TRANSIENT_IMAGES];
+    for(u32 TransientIndex = 0;
+        TransientIndex < Graph.TransientCount;
+        ++TransientIndex)
+    {
+        transient_image* Transient = Graph.Transients + TransientIndex;
+        Transient->Image = CreateUnboundImage(Transient->Width, Transient->Height, Transient->Usage);
+
+        VkMemoryRequirements MemoryRequirements = {};
+        vkGetImageMemoryRequirements(LogicalDevice, Transient->Image.Image, &MemoryRequirements);
+        Transient->Size = MemoryRequirements.size;
+        Alignments[TransientIndex] = MemoryRequirements.alignment;
+        MemoryTypeBits &= MemoryRequirements.memoryTypeBits;
+        Order[TransientIndex] = TransientIndex;
+    }
+
+    std::sort(Order, Order + Graph.TransientCount, [this](u32 A, u32 B) { return Graph.Transients[A].Size > Graph.Transients[B].Size; });
+
+    VkDeviceSize MemorySize = 0;
+    for(u32 OrderIndex = 0;
+        OrderIndex < Graph.TransientCount;
+        ++OrderIndex)
+    {
+        transient_image* Transient = Graph.Transients + Order[OrderIndex];
+        VkDeviceSize Alignment = Alignments[Order[OrderIndex]];
+
+        Transient->Offset = 0;
+        b32 IsPlaced = false;
+        while(!IsPlaced)
+        {
+            IsPlaced = true;
+            for(u32 PlacedIndex = 0;
+                PlacedIndex < OrderIndex;
+                ++PlacedIndex)
+            {
+                transient_image* Placed = Graph.Transients + Order[PlacedIndex];
+                if(IsTransientAliveWith(Transient, Placed) && IsTransientMemoryShared(Transient, Placed))
+                {
+                    Transient->Offset = ((Placed->Offset + Placed->Size + Alignment - 1) / Alignment) * Alignment;
+                    IsPlaced = false;
+                }
+            }
+        }
+
+        MemorySize = Max(MemorySize, Transient->Offset + Transient->Size);
+    }
+
+    VkMemoryAllocateInfo MemoryAllocateInfo = {VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
+    MemoryAllocateInfo.allocationSize  = MemorySize;
+    MemoryAllocateInfo.memoryTypeIndex = FindMemoryType(MemoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    Assert(MemoryAllocateInfo.memoryTypeIndex != ~0u);
+    VK_CHECK(vkAllocateMemory(LogicalDevice, &MemoryAllocateInfo, nullptr, &Graph.TransientMemory));
+
+    for(u32 TransientIndex = 0;
+        TransientIndex < Graph.TransientCount;
+        ++TransientIndex)
+    {
+        transient_image* Transient = Graph.Transients + TransientIndex;
+        vkBindImageMemory(LogicalDevice, Transient->Image.Image, Graph.TransientMemory, Transient->Offset);
+
+        Transient->Image.View = CreateImageView(Transient->Image.Image);
+        if(Transient->Usage & VK_IMAGE_USAGE_STORAGE_BIT)
+        {
+            Transient->Image.StorageView = CreateImageView(Transient->Image.Image, VK_FORMAT_R32_UINT);
+        }
+        if(Transient->Usage & VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT)
+        {
+            Transient->Framebuffer = CreateFramebuffer(Transient->Image.View, Transient->Width, Transient->Height);
+        }
+        if(IsBindless && (Transient->Usage & VK_IMAGE_USAGE_SAMPLED_BIT))
+        {
+            if(Transient->DescriptorIndex == INVALID_DESCRIPTOR_INDEX)
+            {
+                Assert(ImageDescriptorCount < MAX_BINDLESS_RESOURCES);
+                Transient->DescriptorIndex = ImageDescriptorCount++;
+            }
+            Transient->Image.DescriptorIndex = Transient->DescriptorIndex;
+            WriteImageDescriptor(Transient->Image);
+        }
+    }
+
+    Graph.AllocatedTransientCount = Graph.TransientCount;
+}
+
+void vulkan_renderer::
+DestroyTransients()
+{
+    for(u32 TransientIndex = 0;
+        TransientIndex < Graph.AllocatedTransientCount;
+        ++TransientIndex)
+    {
+        transient_image* Transient = Graph.Transients + TransientIndex;
+        if(Transient->Framebuffer)
+        {
+            vkDestroyFramebuffer(LogicalDevice, Transient->Framebuffer, 0);
+        }
+        if(Transient->Image.StorageView)
+        {
+            vkDestroyImageView(LogicalDevice, Transient->Image.StorageView, 0);
+        }
+        vkDestroyImageView(LogicalDevice, Transient->Image.View, 0);
+        vkDestroyImage(LogicalDevice, Transient->Image.Image, 0);
+
+        Transient->Image = {};
+        Transient->Framebuffer = VK_NULL_HANDLE;
+    }
+
+    if(Graph.TransientMemory)
+    {
+        vkFreeMemory(LogicalDevice, Graph.TransientMemory, 0);
+        Graph.TransientMemory = VK_NULL_HANDLE;
+    }
+
+    // NOTE: A new view can get the handle of a destroyed one
+    for(render_frame& Frame : Frames)
+    {
+        Frame.RasterTargetView = VK_NULL_HANDLE;
+    }
+
+    Graph.AllocatedTransientCount = 0;
+    Graph.TransientHash = 0;
+}
+
+// NOTE: Passes run in the order they were added, that order already
+// has every write before the reads that depend on it
+void vulkan_renderer::
+ExecuteGraph()
+{
+    CullPasses();
+
+    for(u32 PassIndex = 0;
+        PassIndex < Graph.PassCount;
+        ++PassIndex)
+    {
+        graph_pass* Pass = Graph.Passes + PassIndex;
+        if(Pass->IsCulled)
+        {
+            continue;
+        }
+
+        for(u32 AccessIndex = 0;
+            AccessIndex < Pass->AccessCount;
+            ++AccessIndex)
+        {
+            graph_resource_entry* Entry = Graph.Resources + Pass->Accesses[AccessIndex].Resource;
+            if(Entry->FirstPass == INVALID_GRAPH_PASS)
+            {
+                Entry->FirstPass = PassIndex;
+            }
+            Entry->LastPass = PassIndex;
+        }
+    }
+
+    for(u32 ResourceIndex = 0;
+        ResourceIndex < Graph.ResourceCount;
+        ++ResourceIndex)
+    {
+        graph_resource_entry* Entry = Graph.Resources + ResourceIndex;
+        if(!Entry->IsImported)
+        {
+            Graph.Transients[Entry->TransientIndex].FirstPass = Entry->FirstPass;
+            Graph.Transients[Entry->TransientIndex].LastPass = Entry->LastPass;
+        }
+        else if(Entry->FirstPass != INVALID_GRAPH_PASS)
+        {
+            // NOTE: The frame is the next graphics submission,
+            // uploads into the resource wait for that value
+            u64 FrameValue = GraphicsValue + 1;
+            if(Entry->Image)
+            {
+                Entry->Image->GraphicsValue = FrameValue;
+            }
+            if(Entry->Buffer)
+            {
+                Entry->Buffer->GraphicsValue = FrameValue;
+            }
+        }
+    }
+
+    AllocateTransients();
+
+    for(u32 ResourceIndex = 0;
+        ResourceIndex < Graph.ResourceCount;
+        ++ResourceIndex)
+    {
+        graph_resource_entry* Entry = Graph.Resources + ResourceIndex;
+        if(!Entry->IsImported)
+        {
+            Entry->Framebuffer = Graph.Transients[Entry->TransientIndex].Framebuffer;
+        }
+    }
+
+    for(u32 PassIndex = 0;
+        PassIndex < Graph.PassCount;
+        ++PassIndex)
+    {
+        if(!Graph.Passes[PassIndex].IsCulled)
+        {
+            RecordGraphPass(PassIndex);
+        }
+    }
+}
+
+// NOTE: All of the barriers of the pass go into one call before it. Graphics
+// passes clear their attachment when it is written the first time this frame.
+void vulkan_renderer::
+RecordGraphPass(u32 PassIndex)
+{
+    graph_pass* Pass = Graph.Passes + PassIndex;
+
+    barrier_batch Barriers;
+    graph_resource_entry* Attachment = nullptr;
+    b32 ShouldClear = false;
+    for(u32 AccessIndex = 0;
+        AccessIndex < Pass->AccessCount;
+        ++AccessIndex)
+    {
+        graph_access* Access = Pass->Accesses + AccessIndex;
+        graph_resource_entry* Entry = Graph.Resources + Access->Resource;
+        b32 ShouldDiscard = Entry->IsDiscardable && (Entry->FirstPass == PassIndex);
+        Assert(!ShouldDiscard || Access->IsWrite);
+
+        if(Entry->Image)
+        {
+            if(ShouldDiscard && !Entry->IsImported)
+            {
+                // NOTE: Transients that had the memory before have to be done with it
+                transient_image* Transient = Graph.Transients + Entry->TransientIndex;
+                for(u32 TransientIndex = 0;
+                    TransientIndex < Graph.TransientCount;
+                    ++TransientIndex)
+                {
+                    transient_image* Previous = Graph.Transients + TransientIndex;
+                    if((Previous->LastPass < PassIndex) && IsTransientMemoryShared(Transient, Previous))
+                    {
+                        Transient->Image.State.Stage |= Previous->Image.State.Stage;
+                        Transient->Image.State.Access |= Previous->Image.State.Access;
+                    }
+                }
+            }
+
+            TrackImage(&Barriers, *Entry->Image, (image_usage)Access->Usage, ShouldDiscard);
+            if(Access->Usage == ImageUsage_ColorAttachment)
+            {
+                Assert(Access->IsWrite && !Attachment);
+                Attachment = Entry;
+                ShouldClear = ShouldDiscard;
+            }
+        }
+        else
+        {
+            TrackBuffer(&Barriers, *Entry->Buffer, &Entry->BufferState, (buffer_usage)Access->Usage);
+        }
+    }
+
+    FlushBarriers(CommandBuffer, &Barriers);
+
+    // NOTE: The statistics cover every layer, the secondaries inherit the query
+    u32 Scope = BeginProfileScope(CommandBuffer, Pass->Name);
+    b32 IsStatisticsPass = IsStatisticsEnabled && (Pass->Type == GraphPass_Layers);
+    if(IsStatisticsPass)
+    {
+        profile_frame* ProfileFrame = ProfileFrames + ProfileFrameIndex;
+        vkCmdBeginQuery(CommandBuffer, ProfileFrame->StatisticsPool, 0, 0);
+        ProfileFrame->IsStatisticsWritten = true;
+    }
+
+    if((Pass->Type == GraphPass_Graphics) || (Pass->Type == GraphPass_Layers))
+    {
+        Assert(Attachment && Attachment->Framebuffer);
+        image& Target = *Attachment->Image;
+
+        // NOTE: Transients are drawn over something else later,
+        // so whatever isn't drawn into them stays transparent
+        VkClearColorValue Color = {0.086, 0.086, 0.113, 1};
+        if(!Attachment->IsImported)
+        {
+            Color = {0, 0, 0, 0};
+        }
+        VkClearValue ClearColor = {Color};
+
+        VkRenderPassBeginInfo RenderPassBeginInfo = {VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO};
+        RenderPassBeginInfo.renderPass = ShouldClear ? RenderPass : LoadRenderPass;
+        RenderPassBeginInfo.framebuffer = Attachment->Framebuffer;
+        RenderPassBeginInfo.renderArea.extent.width = Target.Width;
+        RenderPassBeginInfo.renderArea.extent.height = Target.Height;
+        RenderPassBeginInfo.clearValueCount = 1;
+        RenderPassBeginInfo.pClearValues = &ClearColor;
+
+        if(Pass->Type == GraphPass_Layers)
+        {
+            vkCmdBeginRenderPass(CommandBuffer, &RenderPassBeginInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+        }
+        else
+        {
+            vkCmdBeginRenderPass(CommandBuffer, &RenderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+            SetViewport(CommandBuffer, Target.Width, Target.Height);
+        }
+
+        Pass->Callback(this, CommandBuffer, Pass->Data);
+        vkCmdEndRenderPass(CommandBuffer);
+    }
+    else
+    {
+        Pass->Callback(this, CommandBuffer, Pass->Data);
+    }
+
+    if(IsStatisticsPass)
+    {
+        vkCmdEndQuery(CommandBuffer, ProfileFrames[ProfileFrameIndex].StatisticsPool, 0);
+    }
+    EndProfileScope(CommandBuffer, Scope);
+}
+
+void vulkan_renderer::
+InitProfiler(u32 TimestampValidBits, b32 IsHostQueryResetSupported, b32 IsStatisticsSupported)
+{
+    IsProfilingEnabled = (TimestampValidBits > 0) && IsHostQueryResetSupported;
+    IsStatisticsEnabled = IsProfilingEnabled && IsStatisticsSupported;
+    TimestampMask = (TimestampValidBits >= 64) ? ~0ull : ((1ull << TimestampValidBits) - 1);
+    ProfileFrameIndex = 0;
+    ProfileResultCount = 0;
+    ProfileStatistics = {};
+
+    for(profile_frame& Frame : ProfileFrames)
+    {
+        Frame.TimestampPool = VK_NULL_HANDLE;
+        Frame.StatisticsPool = VK_NULL_HANDLE;
+        Frame.ScopeCount = 0;
+        Frame.IsStatisticsWritten = false;
+        Frame.TransferValue = 0;
+
+        if(IsProfilingEnabled)
+        {
+            VkQueryPoolCreateInfo QueryPoolCreateInfo = {VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
+            QueryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+            QueryPoolCreateInfo.queryCount = 2*MAX_PROFILE_SCOPES;
+            VK_CHECK(vkCreateQueryPool(LogicalDevice, &QueryPoolCreateInfo, 0, &Frame.TimestampPool));
+            vkResetQueryPool(LogicalDevice, Frame.TimestampPool, 0, 2*MAX_PROFILE_SCOPES);
+        }
+
+        if(IsStatisticsEnabled)
+        {
+            VkQueryPoolCreateInfo QueryPoolCreateInfo = {VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
+            QueryPoolCreateInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+            QueryPoolCreateInfo.queryCount = 1;
+            QueryPoolCreateInfo.pipelineStatistics = PROFILE_STATISTICS_FLAGS;
+            VK_CHECK(vkCreateQueryPool(LogicalDevice, &QueryPoolCreateInfo, 0, &Frame.StatisticsPool));
+            vkResetQueryPool(LogicalDevice, Frame.StatisticsPool, 0, 1);
+        }
+    }
+}
+
+// NOTE: Can be called from the layer workers, the scope index is the only
+// thing that is shared. The name has to outlive the frame.
+u32 vulkan_renderer::
+BeginProfileScope(VkCommandBuffer CommandBuffer_, const char* Name)
+{
+    u32 Scope = INVALID_PROFILE_SCOPE;
+    if(IsProfilingEnabled)
+    {
+        profile_frame* Frame = ProfileFrames + ProfileFrameIndex;
+        u32 ScopeIndex = Frame->ScopeCount.fetch_add(1);
+        if(ScopeIndex < MAX_PROFILE_SCOPES)
+        {
+            Frame->ScopeNames[ScopeIndex] = Name;
+            vkCmdWriteTimestamp(CommandBuffer_, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, Frame->TimestampPool, 2*ScopeIndex);
+            Scope = ScopeIndex;
+        }
+    }
+
+    return Scope;
+}
+
+void vulkan_renderer::
+EndProfileScope(VkCommandBuffer CommandBuffer_, u32 Scope)
+{
+    if(Scope != INVALID_PROFILE_SCOPE)
+    {
+        profile_frame* Frame = ProfileFrames + ProfileFrameIndex;
+        vkCmdWriteTimestamp(CommandBuffer_, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, Frame->TimestampPool, 2*Scope + 1);
+    }
+}
+
+// NOTE: Never waits, queries that are not available yet are left out
+void vulkan_renderer::
+ResolveProfileFrame(profile_frame* Frame)
+{
+    // NOTE: The queries can't be reset while an upload still writes them
+    WaitForTransfer(Frame->TransferValue);
+    ProfileResultCount = 0;
+
+    u32 ScopeCount = Min(Frame->ScopeCount.load(), (u32)MAX_PROFILE_SCOPES);
+    if(ScopeCount)
+    {
+        // NOTE: Every query is its value followed by its availability
+        u64 Timestamps[2*MAX_PROFILE_SCOPES][2] = {};
+        vkGetQueryPoolResults(LogicalDevice, Frame->TimestampPool, 0, 2*ScopeCount, sizeof(Timestamps), Timestamps, sizeof(Timestamps[0]), 
+                              VK_QUERY_RESULT_64_BIT|VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+        for(u32 ScopeIndex = 0;
+            ScopeIndex < ScopeCount;
+            ++ScopeIndex)
+        {
+            u64* Begin = Timestamps[2*ScopeIndex];
+            u64* End = Timestamps[2*ScopeIndex + 1];
+            if(!Begin[1] || !End[1])
+            {
+                continue;
+            }
+
+            const char* Name = Frame->ScopeNames[ScopeIndex];
+            r64 Milliseconds = (r64)((End[0] - Begin[0]) & TimestampMask) * TimestampPeriod / 1000000.0;
+
+            profile_result* Result = nullptr;
+            for(u32 ResultIndex = 0;
+                ResultIndex < ProfileResultCount;
+                ++ResultIndex)
+            {
+                if(strcmp(ProfileResults[ResultIndex].Name, Name) == 0)
+                {
+                    Result = ProfileResults + ResultIndex;
+                    break;
+                }
+            }
+
+            if(!Result)
+            {
+                Result = ProfileResults + ProfileResultCount++;
+                *Result = {Name, 0, 0};
+            }
+
+            Result->Milliseconds += Milliseconds;
+            ++Result->Count;
+        }
+
+        vkResetQueryPool(LogicalDevice, Frame->TimestampPool, 0, 2*ScopeCount);
+    }
+
+    if(Frame->IsStatisticsWritten)
+    {
+        u64 Statistics[sizeof(profile_statistics)/sizeof(u64) + 1] = {};
+        vkGetQueryPoolResults(LogicalDevice, Frame->StatisticsPool, 0, 1, sizeof(Statistics), Statistics, sizeof(Statistics), 
+                              VK_QUERY_RESULT_64_BIT|VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+        if(Statistics[ArraySize(Statistics) - 1])
+        {
+            memcpy(&ProfileStatistics, Statistics, sizeof(ProfileStatistics));
+        }
+
+        vkResetQueryPool(LogicalDevice, Frame->StatisticsPool, 0, 1);
+    }
+
+    Frame->ScopeCount = 0;
+    Frame->IsStatisticsWritten = false;
+    Frame->TransferValue = 0;
+}
+
+// NOTE: Called once the frame that is reused is done. The pool that is
+// taken next was used by it, PROFILER_FRAME_COUNT - 1 frames ago.
+void vulkan_renderer::
+NextProfileFrame()
+{
+    if(IsProfilingEnabled)
+    {
+        ProfileFrameIndex = (ProfileFrameIndex + 1) % PROFILER_FRAME_COUNT;
+        ResolveProfileFrame(ProfileFrames + ProfileFrameIndex);
+    }
+}
+
+u32 vulkan_renderer::
+GetProfileResults(profile_result* Results, u32 MaxCount)
+{
+    u32 Count = Min(ProfileResultCount, MaxCount);
+    memcpy(Results, ProfileResults, Count*sizeof(profile_result));
+    return Count;
+}
+
+b32 vulkan_renderer::
+GetPipelineStatistics(profile_statistics* Statistics)
+{
+    *Statistics = ProfileStatistics;
+    return IsStatisticsEnabled;
 }
 
 vulkan_renderer::~vulkan_renderer()
 {
     PFN_vkDestroyDebugReportCallbackEXT vkDestroyDebugReportCallbackEXT = (PFN_vkDestroyDebugReportCallbackEXT)vkGetInstanceProcAddr(Instance, "vkDestroyDebugReportCallbackEXT");
 
-    vkDestroyFence(LogicalDevice, Fence, 0);
-    vkDestroySemaphore(LogicalDevice, AcquireSemaphore, 0);
-    vkDestroySemaphore(LogicalDevice, ReleaseSemaphore, 0);
+    EndCapture();
+    CompleteFrames();
+    WaitForTransfer(TransferValue);
+    CollectTransfers();
+
+    CompleteAllWork(&PipelineQueue);
+    DestroyWorkQueue(&PipelineQueue);
+
+    DestroyWorkQueue(&RecordQueue);
+    for(render_frame& Frame : Frames)
+    {
+        for(thread_commands& Commands : Frame.ThreadCommands)
+        {
+            vkDestroyCommandPool(LogicalDevice, Commands.CommandPool, 0);
+        }
+    }
+    for(auto& Material : Materials)
+    {
+        material_entry* Entry = Material.second;
+        while(Entry)
+        {
+            material_entry* NextInHash = Entry->NextInHash;
+            vkDestroyPipeline(LogicalDevice, Entry->Pipeline, 0);
+            delete Entry;
+            Entry = NextInHash;
+        }
+    }
+
+    size_t PipelineCacheSize = 0;
+    vkGetPipelineCacheData(LogicalDevice, PipelineCache, &PipelineCacheSize, nullptr);
+    std::vector<u8> PipelineCacheData(PipelineCacheSize);
+    vkGetPipelineCacheData(LogicalDevice, PipelineCache, &PipelineCacheSize, PipelineCacheData.data());
+
+    FILE* PipelineCacheFile = fopen(PIPELINE_CACHE_PATH, "wb");
+    if(PipelineCacheFile)
+    {
+        fwrite(PipelineCacheData.data(), 1, PipelineCacheSize, PipelineCacheFile);
+        fclose(PipelineCacheFile);
+    }
+    vkDestroyPipelineCache(LogicalDevice, PipelineCache, 0);
+
+    for(profile_frame& Frame : ProfileFrames)
+    {
+        if(Frame.TimestampPool)
+        {
+            vkDestroyQueryPool(LogicalDevice, Frame.TimestampPool, 0);
+        }
+        if(Frame.StatisticsPool)
+        {
+            vkDestroyQueryPool(LogicalDevice, Frame.StatisticsPool, 0);
+        }
+    }
+
+    for(VkSemaphore ReleaseSemaphore : ReleaseSemaphores)
+    {
+        vkDestroySemaphore(LogicalDevice, ReleaseSemaphore, 0);
+    }
+    vkDestroySemaphore(LogicalDevice, TransferSemaphore, 0);
+    vkDestroySemaphore(LogicalDevice, GraphicsSemaphore, 0);
+    vkDestroyCommandPool(LogicalDevice, TransferCommandPool, 0);
 
-    vkFreeCommandBuffers(LogicalDevice, CommandPool, 1, &CommandBuffer);
+    for(render_frame& Frame : Frames)
+    {
+        vkFreeCommandBuffers(LogicalDevice, CommandPool, 1, &Frame.CommandBuffer);
+        vkDestroyFence(LogicalDevice, Frame.Fence, 0);
+        vkDestroySemaphore(LogicalDevice, Frame.AcquireSemaphore, 0);
+    }
     vkDestroyCommandPool(LogicalDevice, CommandPool, nullptr);
 
+    DestroyTransients();
+    vkDestroyRenderPass(LogicalDevice, RenderPass, 0);
+    vkDestroyRenderPass(LogicalDevice, LoadRenderPass, 0);
     DestroySwapchain();
 
-    vkDestroySurfaceKHR(Instance, Surface, nullptr);
+    if(Surface)
+    {
+        vkDestroySurfaceKHR(Instance, Surface, nullptr);
+    }
 
     vkDestroyDebugReportCallbackEXT(Instance, DebugCallback, 0);
     vkDestroyInstance(Instance, nullptr);
@@ -1,6 +1,10 @@
 
 #include <initializer_list>
+#if defined(_WIN32)
 #define VK_USE_PLATFORM_WIN32_KHR
+#elif defined(__linux__)
+#define VK_USE_PLATFORM_XLIB_KHR
+#endif
 #include <SDL2/SDL_config.h>
 #include <SDL2/SDL_syswm.h>
 #include <SDL2/SDL.h>
@@ -9,10 +13,13 @@
 #include <vulkan/vulkan_core.h>
 #include <vulkan/vulkan.h>
 
+#include <stdio.h>
 #include <iostream>
+#include <deque>
 
 #include "intrinsics.h"
 #include "hmath.h"
+#include "work_queue.h"
 
 #define VK_CHECK(Error) \
 { \
@@ -42,16 +49,95 @@ struct buffer
     VkDeviceMemory Memory;
     void* Data;
     size_t Size;
+
+    u32 DescriptorIndex;
+
+    // NOTE: Transfer timeline value of the last upload that used the buffer,
+    // graphics timeline value of the last frame whose graph used it
+    u64 TransferValue;
+    u64 GraphicsValue;
+};
+
+// NOTE: How an image is used by a command. The tracker keeps the last
+// use of every image and a barrier is only added when the layout changes,
+// when a read stage doesn't see the last write yet
+// or when there is a write on either side.
+enum image_usage
+{
+    ImageUsage_Undefined,
+    ImageUsage_TransferSrc,
+    ImageUsage_TransferDst,
+    ImageUsage_Sampled,
+    ImageUsage_Storage,
+    ImageUsage_ColorAttachment,
+    ImageUsage_Present,
+
+    ImageUsage_Count,
+};
+
+// NOTE: Stage and Access are every use since the last barrier, so a write
+// waits for all of them. WriteStage and WriteAccess are the last barrier or
+// write, a read at a stage that isn't in Stage yet has to wait for those.
+struct image_state
+{
+    VkImageLayout Layout;
+    VkPipelineStageFlags2KHR Stage;
+    VkAccessFlags2KHR Access;
+    VkPipelineStageFlags2KHR WriteStage;
+    VkAccessFlags2KHR WriteAccess;
 };
 
 struct image
 {
     VkImage Image;
     VkImageView View;
+    VkImageView StorageView;
     VkDeviceMemory Memory;
     void* Data;
     u32 Width;
     u32 Height;
+
+    u32 DescriptorIndex;
+
+    // NOTE: Last use recorded on the cpu timeline
+    image_state State;
+
+    // NOTE: Graphics timeline value of the last frame whose graph used it
+    u64 GraphicsValue;
+
+    // NOTE: Linear images written by the host through Data,
+    // they stay in GENERAL so the host can always access them
+    b32 IsHostMapped;
+};
+
+// NOTE: Buffers are tracked by the render graph only, within one frame.
+// The first write of a frame waits for everything of the frames before.
+enum buffer_usage
+{
+    BufferUsage_TransferDst,
+    BufferUsage_ShaderRead,
+    BufferUsage_ShaderWrite,
+    BufferUsage_Indirect,
+    BufferUsage_Vertex,
+
+    BufferUsage_Count,
+};
+
+// NOTE: Same as the image_state without the layout
+struct buffer_state
+{
+    VkPipelineStageFlags2KHR Stage;
+    VkAccessFlags2KHR Access;
+    VkPipelineStageFlags2KHR WriteStage;
+    VkAccessFlags2KHR WriteAccess;
+};
+
+// NOTE: Barriers are collected and recorded with one call right before
+// the commands that need them
+struct barrier_batch
+{
+    std::vector<VkBufferMemoryBarrier2KHR> BufferBarriers;
+    std::vector<VkImageMemoryBarrier2KHR> ImageBarriers;
 };
 
 struct shader
@@ -66,8 +152,385 @@ struct material
     VkPipelineLayout PipelineLayout;
 };
 
+// NOTE: Compute pipelines have their own descriptor sets
+enum compute_layout
+{
+    ComputeLayout_Raster,
+    ComputeLayout_Cull,
+};
+
+// NOTE: Maps world positions to the screen, it has to
+// match the first constants of quad.vert.glsl
+struct view_constants
+{
+    v2 ScreenSize;
+    v2 ViewMin;
+    r32 ViewScale;
+};
+
+// NOTE: Written by cull.comp.glsl and read by DrawQuadsIndirect, it has to
+// match the Draws block of the shader. The count is 0 when every instance
+// was culled, so not even an empty draw is issued.
+struct indirect_quads
+{
+    u32 DrawCount;
+    VkDrawIndexedIndirectCommand Command;
+};
+
 using shaders = std::initializer_list<const shader*>;
 
+enum blend_mode
+{
+    BlendMode_Opaque,
+    BlendMode_Alpha,
+    BlendMode_Additive,
+};
+
+#define PIPELINE_CACHE_PATH "pipeline.cache"
+#define MAX_MATERIAL_SHADERS 2
+
+// NOTE: Variants every graphics shader can have, shaders/variants.glsl
+// declares them with these constant_ids. Branches on them are folded
+// by the driver, so each variant only pays for what it does.
+enum spec_constant
+{
+    SpecConstant_DebugView,
+
+    SpecConstant_Count,
+};
+
+enum debug_view
+{
+    DebugView_None,
+    DebugView_UV,
+    DebugView_Alpha,
+
+    DebugView_Count,
+};
+
+// NOTE: Everything a graphics pipeline is built from. Its hash is the key
+// of the material registry, so a variant is just a different description.
+// Specialization constants get constant_id equal to their index.
+struct material_desc
+{
+    shader Shaders[MAX_MATERIAL_SHADERS];
+    u32 ShaderCount;
+
+    blend_mode BlendMode;
+    VkPrimitiveTopology Topology;
+
+    u32 SpecConstantCount;
+    u32 SpecConstants[SpecConstant_Count];
+};
+
+inline void
+SetSpecConstant(material_desc* Desc, u32 ConstantID, u32 Value)
+{
+    Assert(ConstantID < SpecConstant_Count);
+    Desc->SpecConstants[ConstantID] = Value;
+    Desc->SpecConstantCount = Max(Desc->SpecConstantCount, ConstantID + 1);
+}
+
+// NOTE: Every constant starts out set, so a description that is
+// switched back to its default hashes the same as before
+inline material_desc
+MaterialDesc(shaders Shaders, blend_mode BlendMode = BlendMode_Opaque, VkPrimitiveTopology Topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST)
+{
+    material_desc Result = {};
+    for(const shader* Shader_ : Shaders)
+    {
+        Assert(Result.ShaderCount < MAX_MATERIAL_SHADERS);
+        Result.Shaders[Result.ShaderCount++] = *Shader_;
+    }
+    Result.BlendMode = BlendMode;
+    Result.Topology = Topology;
+    SetSpecConstant(&Result, SpecConstant_DebugView, DebugView_None);
+
+    return Result;
+}
+
+class vulkan_renderer;
+
+// NOTE: Layers are recorded in parallel into secondary command
+// buffers and executed in this order inside the frame render pass
+enum render_layer
+{
+    RenderLayer_Board,
+    RenderLayer_Pieces,
+    RenderLayer_Effects,
+    RenderLayer_UI,
+
+    RenderLayer_Count,
+};
+
+typedef void render_layer_callback(vulkan_renderer* Renderer, VkCommandBuffer CommandBuffer, void* Data);
+
+struct render_layer_job
+{
+    vulkan_renderer* Renderer;
+    render_layer_callback* Callback;
+    void* Data;
+
+    VkCommandBuffer CommandBuffer;
+};
+
+// NOTE: The frame is a list of passes with the resources they read and write.
+// Passes run in the order they were added, so a read sees the last write added
+// before it. Passes whose writes are never read are culled. Transient images
+// only live from their first to their last pass and share memory with the
+// transients that are never alive at the same time.
+#define MAX_GRAPH_PASSES 16
+#define MAX_GRAPH_RESOURCES 32
+#define MAX_GRAPH_ACCESSES 8
+#define MAX_TRANSIENT_IMAGES 8
+#define INVALID_GRAPH_PASS (~0u)
+
+typedef u32 graph_resource;
+
+enum graph_pass_type
+{
+    GraphPass_Graphics,
+    GraphPass_Layers,
+    GraphPass_Compute,
+    GraphPass_Transfer,
+};
+
+// NOTE: Graphics passes are already inside the render pass of their color
+// attachment when the callback runs, the viewport covers the attachment
+typedef void graph_pass_callback(vulkan_renderer* Renderer, VkCommandBuffer CommandBuffer, void* Data);
+
+struct graph_access
+{
+    graph_resource Resource;
+    u32 Usage;
+    b32 IsWrite;
+};
+
+struct graph_pass
+{
+    const char* Name;
+    graph_pass_type Type;
+    graph_pass_callback* Callback;
+    void* Data;
+
+    graph_access Accesses[MAX_GRAPH_ACCESSES];
+    u32 AccessCount;
+    b32 IsCulled;
+};
+
+// NOTE: Imported resources outlive the frame, so writes into them are never
+// culled. Their content is kept unless IsDiscardable, like the backbuffer.
+struct graph_resource_entry
+{
+    image* Image;
+    buffer* Buffer;
+    buffer_state BufferState;
+    VkFramebuffer Framebuffer;
+
+    b32 IsImported;
+    b32 IsDiscardable;
+    u32 TransientIndex;
+    u32 FirstPass;
+    u32 LastPass;
+};
+
+// NOTE: Kept between frames and only rebuilt when the transients
+// of the frame or their lifetimes are different from the last one
+struct transient_image
+{
+    u32 Width;
+    u32 Height;
+    VkImageUsageFlags Usage;
+    u32 FirstPass;
+    u32 LastPass;
+
+    image Image;
+    VkFramebuffer Framebuffer;
+    VkDeviceSize Offset;
+    VkDeviceSize Size;
+
+    // NOTE: Bindless slots are never given back, so the
+    // slot stays when the image is created again
+    u32 DescriptorIndex;
+};
+
+struct render_graph
+{
+    graph_pass Passes[MAX_GRAPH_PASSES];
+    u32 PassCount;
+
+    graph_resource_entry Resources[MAX_GRAPH_RESOURCES];
+    u32 ResourceCount;
+
+    transient_image Transients[MAX_TRANSIENT_IMAGES];
+    u32 TransientCount;
+    u32 AllocatedTransientCount;
+    u64 TransientHash;
+    VkDeviceMemory TransientMemory;
+};
+
+// NOTE: Command pools are externally synchronized, so every worker
+// records from its own pool. Buffers are reused after the pool reset.
+struct thread_commands
+{
+    VkCommandPool CommandPool;
+    std::vector<VkCommandBuffer> CommandBuffers;
+    u32 UsedCount;
+};
+
+// NOTE: Every scope is a pair of timestamps. Frames alternate between
+// query pools, so a pool is read back after the gpu is done with it
+// and the results are behind by the frames in flight.
+#define MAX_PROFILE_SCOPES 64
+#define PROFILER_FRAME_COUNT 2
+#define INVALID_PROFILE_SCOPE (~0u)
+
+// NOTE: The order of the flags is the order of the values in profile_statistics
+#define PROFILE_STATISTICS_FLAGS (VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT| \
+                                  VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT| \
+                                  VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT| \
+                                  VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT| \
+                                  VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT)
+
+struct profile_statistics
+{
+    u64 InputAssemblyVertices;
+    u64 InputAssemblyPrimitives;
+    u64 VertexShaderInvocations;
+    u64 ClippingPrimitives;
+    u64 FragmentShaderInvocations;
+};
+
+// NOTE: Scopes with the same name are summed up
+struct profile_result
+{
+    const char* Name;
+    r64 Milliseconds;
+    u32 Count;
+};
+
+struct profile_frame
+{
+    VkQueryPool TimestampPool;
+    VkQueryPool StatisticsPool;
+
+    std::atomic<u32> ScopeCount;
+    const char* ScopeNames[MAX_PROFILE_SCOPES];
+    b32 IsStatisticsWritten;
+    u64 TransferValue;
+};
+
+// NOTE: Where the graphics queue can first touch uploaded data
+#define UPLOAD_CONSUMER_STAGES (VK_PIPELINE_STAGE_TRANSFER_BIT| \
+                                VK_PIPELINE_STAGE_VERTEX_INPUT_BIT| \
+                                VK_PIPELINE_STAGE_VERTEX_SHADER_BIT| \
+                                VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT| \
+                                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT)
+#define UPLOAD_CONSUMER_ACCESS (VK_ACCESS_TRANSFER_READ_BIT| \
+                                VK_ACCESS_INDEX_READ_BIT| \
+                                VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT| \
+                                VK_ACCESS_SHADER_READ_BIT)
+
+struct transfer_submission
+{
+    VkCommandBuffer CommandBuffer;
+    u64 Value;
+};
+
+// NOTE: Pipeline stays null until a worker thread has compiled it.
+// Descriptions with the same hash are chained behind each other.
+struct material_entry
+{
+    material_desc Desc;
+    VkPipelineLayout PipelineLayout;
+    std::atomic<VkPipeline> Pipeline;
+
+    vulkan_renderer* Renderer;
+    material_entry* NextInHash;
+};
+
+// NOTE: Every pipeline shares one layout, so the push constant
+// range is big enough for all of the shaders that are using it
+#define MAX_PUSH_CONSTANTS_SIZE 128
+
+// NOTE: Buffers and images are indexed from the shaders, the indices are
+// pushed into the last 8 bytes of the push constants of every draw.
+// Both arrays together fit into the minimal maxPushDescriptors.
+#define MAX_BINDLESS_RESOURCES 16
+#define DESCRIPTOR_INDICES_OFFSET (MAX_PUSH_CONSTANTS_SIZE - 2*sizeof(u32))
+#define INVALID_DESCRIPTOR_INDEX (~0u)
+
+// NOTE: Frames take turns with everything they record into. A headless frame
+// is waited on only after the next one was submitted, so the gpu already has
+// that one while the last one is read back. Headless frames render into the
+// offscreen target of their index. A windowed frame is waited on when its
+// index comes around again in BeginRendering.
+#define RENDER_FRAME_COUNT 2
+#define INVALID_READBACK_INDEX (~0u)
+
+struct render_frame
+{
+    VkCommandBuffer CommandBuffer;
+    VkFence Fence;
+    VkSemaphore AcquireSemaphore;
+    b32 IsPending;
+    u64 FrameNumber;
+
+    std::vector<thread_commands> ThreadCommands;
+
+    // NOTE: The compute sets are rewritten only when the frame
+    // gets different resources than the last time it was used
+    VkDescriptorSet RasterDescriptor;
+    VkImageView RasterTargetView;
+    VkBuffer RasterCommandsBuffer;
+    VkDescriptorSet CullDescriptor;
+    VkBuffer CullBuffers[3];
+};
+
+// NOTE: A recording copies the backbuffer of every frame into a ring of
+// readback buffers. Once the fence of that frame is waited on anyway, the
+// buffer goes to one writer thread, so frames never wait for the disk. If
+// the writer is a whole ring behind, the frame is left out of the recording.
+#define CAPTURE_SLOT_COUNT 4
+
+enum capture_slot_state
+{
+    CaptureSlot_Free,
+    CaptureSlot_Copying,
+    CaptureSlot_Writing,
+};
+
+struct frame_capture;
+
+// NOTE: FrameIndex is the place in the recording,
+// FrameNumber is the frame of the renderer that copies
+struct capture_slot
+{
+    frame_capture* Capture;
+    buffer Readback;
+    u64 FrameIndex;
+    u64 FrameNumber;
+    std::atomic<u32> State;
+};
+
+struct frame_capture
+{
+    FILE* File;
+    u32 Width;
+    u32 Height;
+    b32 IsBGRA;
+
+    capture_slot Slots[CAPTURE_SLOT_COUNT];
+    u32 NextSlot;
+    u64 FrameCount;
+    u64 DroppedCount;
+
+    // NOTE: One thread, so the frames are written in the order they were
+    // captured. Row is its scratch memory for the conversion to RGB.
+    work_queue Writer;
+    std::vector<u8> Row;
+};
+
 class vulkan_renderer 
 {
 private:
@@ -79,6 +542,7 @@ private:
     u32 QueueFamilyIndex;
 
     SDL_Window* Window;
+    b32 IsHeadless;
 
     VkInstance Instance;
     VkPhysicalDevice PhysicalDevice;
@@ -86,18 +550,56 @@ private:
     VkDevice LogicalDevice;
     VkQueue Queue;
 
-    VkFence Fence;
-    VkSemaphore AcquireSemaphore;
-    VkSemaphore ReleaseSemaphore;
-    std::vector<VkSemaphore> RenderingSemaphores;
+    // NOTE: One per swapchain image, an image is only acquired
+    // again after its present waited on the semaphore
+    std::vector<VkSemaphore> ReleaseSemaphores;
 
+    // NOTE: CommandBuffer is the one of the frame that is recorded
     VkCommandPool CommandPool;
     VkCommandBuffer CommandBuffer;
+    render_frame Frames[RENDER_FRAME_COUNT];
+    u32 FrameIndex;
+
+    // NOTE: Uploads go through their own queue when the device has a transfer
+    // only family. Both queues count their submissions on a timeline semaphore.
+    u32 TransferFamilyIndex;
+    VkQueue TransferQueue;
+    VkCommandPool TransferCommandPool;
+    VkSemaphore TransferSemaphore;
+    VkSemaphore GraphicsSemaphore;
+    u64 TransferValue;
+    u64 GraphicsValue;
+    u64 AcquiredTransferValue;
+    u64 WaitedTransferValue;
+    std::deque<transfer_submission> TransferSubmissions;
+    barrier_batch AcquireBarriers;
+
+    PFN_vkCmdPipelineBarrier2KHR CmdPipelineBarrier2;
+
+    // NOTE: Rebuilt every frame between BeginRendering and EndRendering
+    render_graph Graph;
+    graph_resource Backbuffer;
+    image FrameTarget;
 
     VkSurfaceKHR Surface;
     VkSwapchainKHR Swapchain;
     VkSurfaceFormatKHR SwapchainSurfaceFormat;
 
+    // NOTE: Low latency asks for mailbox or immediate, otherwise it is fifo.
+    // An image count of 0 lets the present mode decide how many it needs.
+    b32 IsLowLatency;
+    u32 DesiredImageCount;
+    VkPresentModeKHR PresentMode;
+    b32 IsSwapchainDirty;
+    VkSwapchainKHR RetiredSwapchain;
+
+    // NOTE: Every present gets an id, waiting on it paces the frames
+    // to the display instead of to the swapchain queue
+    b32 IsPresentWaitEnabled;
+    u64 PresentId;
+    u64 FirstPresentId;
+    PFN_vkWaitForPresentKHR WaitForPresentKHR;
+
     VkDebugReportCallbackEXT DebugCallback;
 
     std::vector<shader> ShaderModules;
@@ -105,28 +607,124 @@ private:
     std::vector<VkImageView> SwapchainImageViews;
     std::vector<VkFramebuffer> SwapchainFramebuffers;
 
-    std::unordered_map<std::string, material> Materials;
+    std::vector<image> OffscreenTargets;
+    std::vector<buffer> ReadbackBuffers;
+    u64 FrameNumber;
+    u32 ReadbackIndex;
+    u64 ReadbackFrameNumber;
 
+    b32 IsCaptureSupported;
+    frame_capture* Capture;
+
+    // NOTE: Hashed material_desc to its chain of entries, only touched on the main thread
+    std::unordered_map<u64, material_entry*> Materials;
+    VkPipelineCache PipelineCache;
+    work_queue PipelineQueue;
+
+    work_queue RecordQueue;
+    render_layer_job LayerJobs[RenderLayer_Count];
+    std::mutex DescriptorMutex;
+
+    // NOTE: Both passes are compatible, pipelines and layers use the first one
     VkRenderPass RenderPass;
+    VkRenderPass LoadRenderPass;
     VkSampler MainImageSampler;
 
-    VkPipeline MainPipeline;
     VkPipelineLayout MainPipelineLayout;
+    VkDescriptorSetLayout MainDescriptorLayout;
+    VkDescriptorPool MainDescriptorPool;
     VkDescriptorSet MainDescriptor;
 
-    VkBufferMemoryBarrier CreateMemoryBarrier(buffer& Buffer, VkAccessFlags CurrentAccess, VkAccessFlags NewAccess);
-    VkImageMemoryBarrier CreateImageBarrier(image& Image, VkAccessFlags OldAccess, VkAccessFlags NewAccess, VkImageLayout OldLayout, VkImageLayout NewLayout);
+    // NOTE: Descriptor indexing is used when the device supports it,
+    // otherwise descriptors are pushed into the command buffer per draw
+    b32 IsBindless;
+    u32 BufferDescriptorCount;
+    u32 ImageDescriptorCount;
+    PFN_vkCmdPushDescriptorSetKHR CmdPushDescriptorSet;
+
+    // NOTE: Profiling needs timestamps on the queue and host query reset,
+    // statistics also need inherited queries because of the layers
+    b32 IsProfilingEnabled;
+    b32 IsStatisticsEnabled;
+    b32 IsTransferProfilingEnabled;
+    r32 TimestampPeriod;
+    u64 TimestampMask;
+    u32 ProfileFrameIndex;
+    profile_frame ProfileFrames[PROFILER_FRAME_COUNT];
+    profile_result ProfileResults[MAX_PROFILE_SCOPES];
+    u32 ProfileResultCount;
+    profile_statistics ProfileStatistics;
+
+    VkPipelineLayout RasterPipelineLayout;
+    VkDescriptorSetLayout RasterDescriptorLayout;
+
+    // NOTE: Instances in, the visible ones and their draw out
+    VkPipelineLayout CullPipelineLayout;
+    VkDescriptorSetLayout CullDescriptorLayout;
+    b32 IsDrawIndirectCountEnabled;
+
+    VkBufferMemoryBarrier2KHR CreateMemoryBarrier(buffer& Buffer, VkPipelineStageFlags2KHR OldStage, VkAccessFlags2KHR OldAccess, VkPipelineStageFlags2KHR NewStage, VkAccessFlags2KHR NewAccess);
+    VkImageMemoryBarrier2KHR CreateImageBarrier(image& Image, image_state OldState, image_state NewState);
+    void AddImageBarrier(barrier_batch* Batch, image& Image, image_state OldState, image_state NewState);
+    void TrackBuffer(barrier_batch* Batch, buffer& Buffer, buffer_state* State, buffer_usage Usage);
+    void WriteImageDescriptor(image& Image);
+    void TrackImage(barrier_batch* Batch, image& Image, image_usage Usage, b32 ShouldDiscard = false);
+    void FlushBarriers(VkCommandBuffer CommandBuffer_, barrier_batch* Batch);
     VkSampler CreateSampler(VkFilter Filter = VK_FILTER_LINEAR, VkSamplerAddressMode AddressMode = VK_SAMPLER_ADDRESS_MODE_REPEAT);
     VkDescriptorSetLayout CreateDescriptorSetLayout();
+    void BindResources(VkCommandBuffer CommandBuffer_, material& Material, buffer& Buffer, image& Image);
     VkDescriptorPool CreateDescriptorPool();
 
-    VkImageView CreateImageView(VkImage Image);
-    VkFramebuffer CreateFramebuffer(VkImageView ImageView_);
-    void UpdateImageLayout(image& Image, VkImageLayout OldLayout, VkImageLayout NewLayout);
-
-    void CreateRenderPass();
+    image CreateUnboundImage(u32 ImageWidth, u32 ImageHeight, VkImageUsageFlags Usage, u32 LayersCount = 1, VkBool32 ShouldBeCubemap = 0, VkImageTiling Tiling = VK_IMAGE_TILING_OPTIMAL);
+    u32 FindMemoryType(u32 MemoryTypeBits, VkMemoryPropertyFlags MemoryFlags);
+    VkImageView CreateImageView(VkImage Image, VkFormat Format = VK_FORMAT_UNDEFINED);
+    VkFramebuffer CreateFramebuffer(VkImageView ImageView_, u32 FramebufferWidth = 0, u32 FramebufferHeight = 0);
+
+    VkRenderPass CreateRenderPass(VkAttachmentLoadOp LoadOp);
+    VkPresentModeKHR ChoosePresentMode();
+    void DestroySwapchainTargets();
+    void CreateOffscreenTargets(u32 TargetWidth, u32 TargetHeight);
+    b32 IsMemoryTypeAvailable(VkMemoryPropertyFlags MemoryFlags);
+    VkMemoryPropertyFlags GetReadbackMemoryFlags();
+    void CompleteFrame(render_frame* Frame);
+    void CompleteFrames();
+    void CollectCaptures(u64 CompletedFrameNumber);
+    static void WriteCaptureJob(u32 ThreadIndex, void* Data);
+
+    void InitProfiler(u32 TimestampValidBits, b32 IsHostQueryResetSupported, b32 IsStatisticsSupported);
+    void ResolveProfileFrame(profile_frame* Frame);
+    void NextProfileFrame();
+
+    u64 HashMaterialDesc(const material_desc& Desc);
+    b32 AreMaterialDescsEqual(const material_desc& A, const material_desc& B);
+    VkPipeline CreatePipeline(const material_desc& Desc);
+    static void CompileMaterial(u32 ThreadIndex, void* Data);
+    static void RecordLayerJob(u32 ThreadIndex, void* Data);
+    void SetViewport(VkCommandBuffer CommandBuffer_, u32 ViewportWidth = 0, u32 ViewportHeight = 0);
+
+    graph_resource AddResource(image* Image, buffer* Buffer, b32 IsImported);
+    void AddAccess(u32 Pass, graph_resource Resource, u32 Usage, b32 IsWrite);
+    void CullPasses();
+    void AllocateTransients();
+    void DestroyTransients();
+    void ExecuteGraph();
+    void RecordGraphPass(u32 PassIndex);
+    static void ExecuteLayers(vulkan_renderer* Renderer, VkCommandBuffer CommandBuffer_, void* Data);
+    static void RecordReadback(vulkan_renderer* Renderer, VkCommandBuffer CommandBuffer_, void* Data);
+    static void RecordCapture(vulkan_renderer* Renderer, VkCommandBuffer CommandBuffer_, void* Data);
 
     VkSemaphore CreateSemaphore();
+    VkSemaphore CreateTimelineSemaphore();
+
+    void CollectTransfers();
+    void WaitForTransfer(u64 Value);
+    VkCommandBuffer BeginTransfer();
+    u32 BeginTransferScope(VkCommandBuffer CommandBuffer_, const char* Name);
+    u64 EndTransfer(VkCommandBuffer TransferCommandBuffer, u64 WaitValue);
+    void ReleaseBuffer(VkCommandBuffer TransferCommandBuffer, buffer& Buffer);
+    void ReleaseImage(VkCommandBuffer TransferCommandBuffer, image& Image, image_usage Usage);
+    void AcquireTransfers(VkCommandBuffer CommandBuffer_);
+    void SubmitGraphics(VkCommandBuffer CommandBuffer_, VkSemaphore* AcquireSemaphore_, VkSemaphore* ReleaseSemaphore_, VkFence Fence_);
     VkFence CreateFence();
 
 public:
@@ -137,32 +735,68 @@ public:
 
     void InitVulkanRenderer();
     void InitGraphicsPipeline();
-    void CreateSwapchain(u32 WindowWidth_ = 0, u32 WindowHeight_ = 0);
+    material GetMaterial(const material_desc& Desc);
+    material CreateComputeMaterial(const shader& ComputeShader, compute_layout Layout = ComputeLayout_Raster);
+    b32 CreateSwapchain(u32 WindowWidth_ = 0, u32 WindowHeight_ = 0);
     void DestroySwapchain();
+    void SetPresentation(b32 IsLowLatency_, u32 DesiredImageCount_ = 0);
+    void ResizeSwapchain();
+    b32 WaitForPresent();
 
     void BeginCommands();
-    void EndCommands(VkSemaphore* AcquireSemaphore_ = nullptr, VkSemaphore* ReleaseSemaphore_ = nullptr);
+    void EndCommands(VkSemaphore* AcquireSemaphore_ = nullptr, VkSemaphore* ReleaseSemaphore_ = nullptr, VkFence Fence_ = VK_NULL_HANDLE);
 
     VkCommandBuffer BeginCommand();
     void EndCommand(VkCommandBuffer CommandBufferResult);
 
-    void BeginRendering();
+    u32 GetFrameIndex();
+    b32 BeginRendering();
+    void RecordLayer(render_layer Layer, render_layer_callback* Callback, void* Data);
     void EndRendering();
 
-    void BindBuffer(buffer& VertexBuffer, u32 Binding);
-    void BindImage(image& Image, u32 Binding);
+    graph_resource GetBackbuffer();
+    graph_resource ImportImage(image& Image);
+    graph_resource ImportBuffer(buffer& Buffer);
+    graph_resource CreateTransientImage(u32 ImageWidth, u32 ImageHeight, VkImageUsageFlags Usage);
+    u32 AddPass(const char* Name, graph_pass_type Type, graph_pass_callback* Callback, void* Data);
+    u32 AddLayerPass(const char* Name);
+    void PassRead(u32 Pass, graph_resource Resource, image_usage Usage);
+    void PassRead(u32 Pass, graph_resource Resource, buffer_usage Usage);
+    void PassWrite(u32 Pass, graph_resource Resource, image_usage Usage);
+    void PassWrite(u32 Pass, graph_resource Resource, buffer_usage Usage);
+    image& GetImage(graph_resource Resource);
+    b32 GetReadback(void** Pixels, u64* FrameNumber_, b32 ShouldWait = false);
+    b32 BeginCapture(const char* Path);
+    void EndCapture();
+    b32 IsCapturing();
+
+    u32 BeginProfileScope(VkCommandBuffer CommandBuffer_, const char* Name);
+    void EndProfileScope(VkCommandBuffer CommandBuffer_, u32 Scope);
+    u32 GetProfileResults(profile_result* Results, u32 MaxCount);
+    b32 GetPipelineStatistics(profile_statistics* Statistics);
+
+    void BindBuffer(buffer& Buffer);
+    void BindImage(image& Image);
 
     void UpdateBuffer(buffer& Buffer, buffer& Scratch, void* Data, size_t Size, size_t Offset = 0);
     void UpdateBuffer(buffer& Buffer, buffer& Scratch, size_t Size, size_t Offset = 0);
     void UpdateTexture(image& Image, buffer& Scratch, size_t Offset = 0);
+    void WaitForTransfers(buffer& Buffer);
 
     void DrawImage(image Image, v3 StartPointSrc = V3(0, 0, 0), v3 StartPointDst = V3(0, 0, 0));
-    void DrawMeshes(buffer& VertexBuffer, buffer& IndexBuffer, image& Image);
+    void DrawMeshes(VkCommandBuffer CommandBuffer_, material& Material, buffer& VertexBuffer, buffer& IndexBuffer, image& Image, u32 IndexCount);
+    void DrawQuads(VkCommandBuffer CommandBuffer_, material& Material, buffer& InstanceBuffer, buffer& IndexBuffer, image& Image, u32 InstanceCount, view_constants& View);
+    void DrawQuadsIndirect(VkCommandBuffer CommandBuffer_, material& Material, buffer& InstanceBuffer, buffer& IndexBuffer, image& Image, buffer& Draws, view_constants& View);
+    void ResetQuadDraws(VkCommandBuffer CommandBuffer_, buffer& Draws);
+    void CullQuads(VkCommandBuffer CommandBuffer_, material& Material, buffer& Instances, u32 InstanceCount, buffer& Culled, buffer& Draws, rectangle2 ViewArea);
+    void DrawBoard(VkCommandBuffer CommandBuffer_, material& Material, void* Constants, u32 ConstantsSize);
+    void RasterizeCommands(VkCommandBuffer CommandBuffer_, material& Material, image& Target, buffer& Commands, u32 CommandCount);
 
     VkWriteDescriptorSet WriteBuffer(VkDescriptorBufferInfo* BufferInfo, VkDescriptorSet Set, VkDescriptorType DescriptorType, u32 Binding);
     VkWriteDescriptorSet WriteImage(VkDescriptorImageInfo* ImageInfo, VkDescriptorSet Set, VkDescriptorType DescriptorType, u32 Binding);
 
-    void UploadShader(const char* Path, VkShaderStageFlagBits Stages);
+    shader UploadShader(const char* Path, VkShaderStageFlagBits Stages);
 
     image CreateImage(u32 ImageWidth, u32 ImageHeight, VkImageUsageFlags Usage, VkMemoryPropertyFlags MemoryFlags, u32 LayersCount = 1, VkBool32 ShouldBeCubemap = 0);
+    b32 CreateHostImage(image* Result, u32 ImageWidth, u32 ImageHeight);
 };
@@ -0,0 +1,133 @@
+#if !defined(WORK_QUEUE_H)
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <atomic>
+#include "intrinsics.h"
+
+// NOTE: Fire and forget jobs for the worker threads. Entries are
+// taken in the order they were added, but they can finish in any order.
+// ThreadIndex is stable per worker, so per-thread resources can be
+// indexed with it without locking.
+typedef void work_queue_callback(u32 ThreadIndex, void* Data);
+
+struct work_queue_entry
+{
+    work_queue_callback* Callback;
+    void* Data;
+};
+
+struct work_queue
+{
+    std::vector<std::thread> Threads;
+    std::deque<work_queue_entry> Entries;
+
+    std::mutex Mutex;
+    std::condition_variable WorkSignal;
+    std::condition_variable DoneSignal;
+
+    u32 CompletionGoal;
+    u32 CompletionCount;
+    bool IsRunning;
+};
+
+inline void
+WorkerThread(work_queue* Queue, u32 ThreadIndex)
+{
+    for(;;)
+    {
+        work_queue_entry Entry;
+        {
+            std::unique_lock<std::mutex> Lock(Queue->Mutex);
+            Queue->WorkSignal.wait(Lock, [Queue]{ return !Queue->IsRunning || !Queue->Entries.empty(); });
+            if(Queue->Entries.empty())
+            {
+                return;
+            }
+
+            Entry = Queue->Entries.front();
+            Queue->Entries.pop_front();
+        }
+
+        Entry.Callback(ThreadIndex, Entry.Data);
+
+        {
+            std::lock_guard<std::mutex> Lock(Queue->Mutex);
+            ++Queue->CompletionCount;
+        }
+        Queue->DoneSignal.notify_all();
+    }
+}
+
+inline void
+InitWorkQueue(work_queue* Queue, u32 ThreadCount = 0)
+{
+    if(!ThreadCount)
+    {
+        // NOTE: Leaving one core for the main thread
+        u32 CoreCount = std::thread::hardware_concurrency();
+        ThreadCount = (CoreCount > 1) ? (CoreCount - 1) : 1;
+    }
+
+    Queue->CompletionGoal = 0;
+    Queue->CompletionCount = 0;
+    Queue->IsRunning = true;
+    for(u32 ThreadIndex = 0;
+        ThreadIndex < ThreadCount;
+        ++ThreadIndex)
+    {
+        Queue->Threads.emplace_back(WorkerThread, Queue, ThreadIndex);
+    }
+}
+
+inline void
+AddEntry(work_queue* Queue, work_queue_callback* Callback, void* Data)
+{
+    {
+        std::lock_guard<std::mutex> Lock(Queue->Mutex);
+        Queue->Entries.push_back({Callback, Data});
+        ++Queue->CompletionGoal;
+    }
+    Queue->WorkSignal.notify_one();
+}
+
+inline u32
+GetThreadCount(work_queue* Queue)
+{
+    return (u32)Queue->Threads.size();
+}
+
+inline bool
+IsWorkDone(work_queue* Queue)
+{
+    std::lock_guard<std::mutex> Lock(Queue->Mutex);
+    return Queue->CompletionCount == Queue->CompletionGoal;
+}
+
+inline void
+CompleteAllWork(work_queue* Queue)
+{
+    std::unique_lock<std::mutex> Lock(Queue->Mutex);
+    Queue->DoneSignal.wait(Lock, [Queue]{ return Queue->CompletionCount == Queue->CompletionGoal; });
+}
+
+inline void
+DestroyWorkQueue(work_queue* Queue)
+{
+    {
+        std::lock_guard<std::mutex> Lock(Queue->Mutex);
+        Queue->IsRunning = false;
+    }
+    Queue->WorkSignal.notify_all();
+
+    for(std::thread& Thread : Queue->Threads)
+    {
+        Thread.join();
+    }
+    Queue->Threads.clear();
+}
+
+#define WORK_QUEUE_H
+#endif
@@ -0,0 +1,72 @@
+#version 430
+#extension GL_GOOGLE_include_directive : require
+
+#include "variants.glsl"
+
+layout(push_constant) uniform Constants
+{
+	vec4  LightColor;
+	vec4  DarkColor;
+	vec4  GridColor;
+	vec4  HighlightColor;
+
+	vec2  ScreenSize;
+	vec2  BoardMin;
+	vec2  BoardSize;
+
+	uint  Cols;
+	uint  Rows;
+	float GridWidth;
+	uint  Pad;
+
+	uvec2 HighlightMask;
+};
+
+layout(location = 0) in  vec2 InP;
+layout(location = 0) out vec4 OutColor;
+
+void main()
+{
+	vec2 Local = (InP - BoardMin) / BoardSize;
+	if(any(lessThan(Local, vec2(0))) || any(greaterThanEqual(Local, vec2(1))))
+	{
+		discard;
+	}
+
+	vec2  Cell = Local * vec2(Cols, Rows);
+	uvec2 CellIndex = uvec2(floor(Cell));
+
+	vec4 Color = (((CellIndex.x + CellIndex.y) & 1u) == 0u) ? LightColor : DarkColor;
+
+	uint Square = CellIndex.y*Cols + CellIndex.x;
+	if(Square < 64u)
+	{
+		uint Bits = (Square < 32u) ? HighlightMask.x : HighlightMask.y;
+		if(((Bits >> (Square & 31u)) & 1u) != 0u)
+		{
+			Color.rgb = mix(Color.rgb, HighlightColor.rgb, HighlightColor.a);
+		}
+	}
+
+	if(GridWidth > 0)
+	{
+		// Distance in pixels to the closest edge of the square
+		vec2  CellSize = BoardSize / vec2(Cols, Rows);
+		vec2  EdgeDistance = min(fract(Cell), 1.0 - fract(Cell)) * CellSize;
+		float Distance = min(EdgeDistance.x, EdgeDistance.y);
+		float Line = clamp(0.5*GridWidth + 0.5 - Distance, 0.0, 1.0);
+		Color.rgb = mix(Color.rgb, GridColor.rgb, Line*GridColor.a);
+	}
+
+	// NOTE: The board has no uvs, the position on it stands in for them
+	if(DebugView == DebugView_UV)
+	{
+		Color.rgb = vec3(Local, 0);
+	}
+	else if(DebugView == DebugView_Alpha)
+	{
+		Color.rgb = vec3(1);
+	}
+
+	OutColor = vec4(Color.rgb, 1.0);
+}
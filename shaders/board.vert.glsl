@@ -0,0 +1,41 @@
+#version 430
+
+
+layout(push_constant) uniform Constants
+{
+    vec4  LightColor;
+    vec4  DarkColor;
+    vec4  GridColor;
+    vec4  HighlightColor;
+
+    vec2  ScreenSize;
+    vec2  BoardMin;
+    vec2  BoardSize;
+
+    uint  Cols;
+    uint  Rows;
+    float GridWidth;
+    uint  Pad;
+
+    uvec2 HighlightMask;
+};
+
+// One triangle that is covering the whole screen
+vec2 Positions[] = 
+{
+    vec2(-1, -1),
+    vec2( 3, -1),
+    vec2(-1,  3)
+};
+
+layout(location = 0) out vec2 OutP;
+
+
+void main()
+{
+    vec2 Pos = Positions[gl_VertexIndex];
+    gl_Position = vec4(Pos, 0, 1.0);
+
+    // Same screen space as the one of the entities
+    OutP = (0.5 * Pos + 0.5) * ScreenSize;
+}
@@ -0,0 +1,96 @@
+#version 430
+
+#define CULL_GROUP_SIZE 64
+
+layout(local_size_x = CULL_GROUP_SIZE) in;
+
+struct quad_instance
+{
+    vec2  P;
+    vec2  Size;
+    vec4  UVRect;
+
+    float Rotation;
+    uint  Color;
+
+    uint  Shape;
+    float ShapeParam;
+};
+
+layout(set = 0, binding = 0) readonly buffer Instances
+{
+    quad_instance InstanceBuffer[];
+};
+
+layout(set = 0, binding = 1) writeonly buffer Culled
+{
+    quad_instance CulledBuffer[];
+};
+
+// NOTE: Has to match indirect_quads, the counts are
+// cleared by ResetQuadDraws before every dispatch
+layout(set = 0, binding = 2) buffer Draws
+{
+    uint DrawCount;
+    uint IndexCount;
+    uint InstanceCount;
+    uint FirstIndex;
+    int  VertexOffset;
+    uint FirstInstance;
+};
+
+layout(push_constant) uniform Constants
+{
+    vec2 ViewMin;
+    vec2 ViewMax;
+    uint TotalCount;
+};
+
+shared uint GroupCount;
+shared uint GroupBase;
+
+void main()
+{
+    if(gl_LocalInvocationIndex == 0)
+    {
+        GroupCount = 0;
+    }
+    barrier();
+
+    // NOTE: The bounding circle covers every rotation of the quad
+    uint Index = gl_GlobalInvocationID.x;
+    bool Visible = false;
+    quad_instance Instance;
+    if(Index < TotalCount)
+    {
+        Instance = InstanceBuffer[Index];
+        vec2 Center = Instance.P + 0.5*Instance.Size;
+        float Radius = 0.5*length(Instance.Size);
+        Visible = all(greaterThan(Center + Radius, ViewMin)) && all(lessThan(Center - Radius, ViewMax));
+    }
+
+    // NOTE: Slots are reserved in shared memory first,
+    // so there is only one global atomic per workgroup
+    uint Slot = 0;
+    if(Visible)
+    {
+        Slot = atomicAdd(GroupCount, 1);
+    }
+    barrier();
+
+    if(gl_LocalInvocationIndex == 0)
+    {
+        GroupBase = 0;
+        if(GroupCount > 0)
+        {
+            GroupBase = atomicAdd(InstanceCount, GroupCount);
+            atomicMax(DrawCount, 1);
+        }
+    }
+    barrier();
+
+    if(Visible)
+    {
+        CulledBuffer[GroupBase + Slot] = Instance;
+    }
+}
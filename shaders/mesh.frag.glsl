@@ -1,11 +1,31 @@
 #version 430
+#extension GL_GOOGLE_include_directive : require
 
-layout(set = 0, binding = 1) uniform sampler2D Texture1;
+#include "variants.glsl"
+
+#define MAX_BINDLESS_RESOURCES 16
+
+layout(set = 0, binding = 1) uniform sampler2D Textures[MAX_BINDLESS_RESOURCES];
+
+layout(push_constant) uniform Constants
+{
+    layout(offset = 124) uint TextureIndex;
+};
 
 layout(location = 0) in  vec2 InUV;
 layout(location = 0) out vec4 OutColor;
 
 void main()
 {
-	OutColor = vec4(texture(Texture1, InUV).xyz, 1.0f);
+	vec4 Color = texture(Textures[TextureIndex], InUV);
+	if(DebugView == DebugView_UV)
+	{
+		Color = vec4(InUV, 0, 1);
+	}
+	else if(DebugView == DebugView_Alpha)
+	{
+		Color = vec4(Color.aaa, 1);
+	}
+
+	OutColor = Color;
 }
\ No newline at end of file
@@ -1,5 +1,7 @@
 #version 430
 
+#define MAX_BINDLESS_RESOURCES 16
+
 
 struct vertex_data
 {
@@ -18,6 +20,11 @@ vec2 UVs[] =
 layout(set = 0, binding = 0) buffer Vertices
 {
     vec2 VertexBuffer[];
+} VertexBuffers[MAX_BINDLESS_RESOURCES];
+
+layout(push_constant) uniform Constants
+{
+    layout(offset = 120) uint BufferIndex;
 };
 
 layout(location = 0) out vec2 OutUV;
@@ -25,7 +32,7 @@ layout(location = 0) out vec2 OutUV;
 
 void main()
 {
-    vec2 Pos = VertexBuffer[gl_VertexIndex];    
+    vec2 Pos = VertexBuffers[BufferIndex].VertexBuffer[gl_VertexIndex];    
     gl_Position = vec4(Pos, 0, 1.0);
     
     OutUV = UVs[gl_VertexIndex];
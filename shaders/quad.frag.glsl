@@ -0,0 +1,107 @@
+#version 430
+#extension GL_GOOGLE_include_directive : require
+
+#include "variants.glsl"
+
+#define MAX_BINDLESS_RESOURCES 16
+
+#define QuadShape_None  0
+#define QuadShape_Disc  1
+#define QuadShape_Ring  2
+#define QuadShape_Crown 3
+
+layout(set = 0, binding = 1) uniform sampler2D Textures[MAX_BINDLESS_RESOURCES];
+
+layout(push_constant) uniform Constants
+{
+    layout(offset = 124) uint TextureIndex;
+};
+
+layout(location = 0) in vec2 InUV;
+layout(location = 1) in vec4 InColor;
+layout(location = 2) flat in uint InTextured;
+layout(location = 3) in vec2 InLocal;
+layout(location = 4) flat in uint InShape;
+layout(location = 5) flat in float InShapeParam;
+layout(location = 0) out vec4 OutColor;
+
+float
+Box(vec2 P, vec2 HalfSize)
+{
+    vec2 D = abs(P) - HalfSize;
+    return length(max(D, 0.0)) + min(max(D.x, D.y), 0.0);
+}
+
+// NOTE: Tip at the origin, Q.y is negative so it points up
+float
+Triangle(vec2 P, vec2 Q)
+{
+    P.x = abs(P.x);
+    vec2 A = P - Q*clamp(dot(P, Q) / dot(Q, Q), 0.0, 1.0);
+    vec2 B = P - Q*vec2(clamp(P.x / Q.x, 0.0, 1.0), 1.0);
+    float S = -sign(Q.y);
+    vec2 D = min(vec2(dot(A, A), S*(P.x*Q.y - P.y*Q.x)),
+                 vec2(dot(B, B), S*(P.y - Q.y)));
+    return -sqrt(D.x)*sign(D.y);
+}
+
+// NOTE: Distances are in units of the radius, the edge is kept a little
+// inside of the quad so the antialiased border is not cut off
+float
+ShapeDistance(uint Shape, vec2 P, float Param)
+{
+    float Result = 0;
+    switch(Shape)
+    {
+        case QuadShape_Disc:
+        {
+            Result = length(P) - 0.9;
+        } break;
+        case QuadShape_Ring:
+        {
+            float HalfThickness = 0.5*Param;
+            Result = abs(length(P) - (0.9 - HalfThickness)) - HalfThickness;
+        } break;
+        case QuadShape_Crown:
+        {
+            Result = Box(P - vec2(0, -0.3), vec2(0.7, 0.35));
+            Result = min(Result, Triangle(P - vec2(-0.55, 0.6), vec2(0.25, -0.7)));
+            Result = min(Result, Triangle(P - vec2( 0.0, 0.75), vec2(0.25, -0.85)));
+            Result = min(Result, Triangle(P - vec2( 0.55, 0.6), vec2(0.25, -0.7)));
+            Result = min(Result, length(P - vec2(-0.55, 0.6)) - 0.12);
+            Result = min(Result, length(P - vec2( 0.0, 0.75)) - 0.12);
+            Result = min(Result, length(P - vec2( 0.55, 0.6)) - 0.12);
+        } break;
+    }
+
+    return Result;
+}
+
+void main()
+{
+	vec4 Color = InColor;
+	if(InShape != QuadShape_None)
+	{
+		// NOTE: One pixel wide edge at any size, fwidth is how much
+		// the distance changes from one pixel to the next
+		float Distance = ShapeDistance(InShape, InLocal, InShapeParam);
+		float Coverage = clamp(0.5 - Distance / fwidth(Distance), 0.0, 1.0);
+		Color.a *= Coverage;
+	}
+	else if(InTextured != 0)
+	{
+		Color *= texture(Textures[TextureIndex], InUV);
+	}
+
+	// NOTE: Shapes show their local position, sprites their uv
+	if(DebugView == DebugView_UV)
+	{
+		Color.rgb = vec3((InShape != QuadShape_None) ? (0.5*InLocal + 0.5) : InUV, 0);
+	}
+	else if(DebugView == DebugView_Alpha)
+	{
+		Color = vec4(Color.aaa, 1);
+	}
+
+	OutColor = Color;
+}
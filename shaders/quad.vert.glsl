@@ -0,0 +1,74 @@
+#version 430
+
+#define MAX_BINDLESS_RESOURCES 16
+
+
+struct quad_instance
+{
+    vec2  P;
+    vec2  Size;
+    vec4  UVRect;
+
+    float Rotation;
+    uint  Color;
+
+    uint  Shape;
+    float ShapeParam;
+};
+
+vec2 Corners[] = 
+{
+    vec2( 0,  0),
+    vec2( 1,  0),
+    vec2( 1,  1),
+    vec2( 0,  1)
+};
+
+layout(set = 0, binding = 0) readonly buffer Instances
+{
+    quad_instance InstanceBuffer[];
+} InstanceBuffers[MAX_BINDLESS_RESOURCES];
+
+// NOTE: Descriptor indices are always in the last 8 bytes,
+// the view has to match view_constants
+layout(push_constant) uniform Constants
+{
+    vec2  ScreenSize;
+    vec2  ViewMin;
+    float ViewScale;
+    layout(offset = 120) uint BufferIndex;
+};
+
+layout(location = 0) out vec2 OutUV;
+layout(location = 1) out vec4 OutColor;
+layout(location = 2) flat out uint OutTextured;
+layout(location = 3) out vec2 OutLocal;
+layout(location = 4) flat out uint OutShape;
+layout(location = 5) flat out float OutShapeParam;
+
+
+void main()
+{
+    quad_instance Instance = InstanceBuffers[BufferIndex].InstanceBuffer[gl_InstanceIndex];
+    vec2 Corner = Corners[gl_VertexIndex];
+
+    // Rotating around the center of the quad
+    vec2 HalfSize = 0.5 * Instance.Size;
+    vec2 Local = (Corner - 0.5) * Instance.Size;
+    float C = cos(Instance.Rotation);
+    float S = sin(Instance.Rotation);
+    vec2 Pos = Instance.P + HalfSize + vec2(Local.x*C - Local.y*S, Local.x*S + Local.y*C);
+
+    vec2 ScreenPos = (Pos - ViewMin) * ViewScale;
+    gl_Position = vec4(2.0 * ScreenPos / ScreenSize - 1.0, 0, 1.0);
+
+    OutUV = mix(Instance.UVRect.xy, Instance.UVRect.zw, Corner);
+    // Colors are packed as BGRA
+    OutColor = unpackUnorm4x8(Instance.Color).zyxw;
+    OutTextured = (Instance.UVRect.z > Instance.UVRect.x) ? 1 : 0;
+
+    // NOTE: Shapes are evaluated in the quad, the inscribed circle is radius 1
+    OutLocal = Local / (0.5 * min(Instance.Size.x, Instance.Size.y));
+    OutShape = Instance.Shape;
+    OutShapeParam = Instance.ShapeParam;
+}
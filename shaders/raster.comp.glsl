@@ -0,0 +1,201 @@
+#version 430
+
+#define TILE_SIZE 16
+#define RASTER_BATCH (TILE_SIZE*TILE_SIZE)
+
+#define RasterCommand_Clear        0
+#define RasterCommand_Rect         1
+#define RasterCommand_RotRect      2
+#define RasterCommand_Circle       3
+#define RasterCommand_FilledCircle 4
+
+layout(local_size_x = TILE_SIZE, local_size_y = TILE_SIZE) in;
+
+struct raster_command
+{
+    uint  Type;
+    uint  Color;
+    float Radius;
+    uint  Pad;
+
+    int   MinX;
+    int   MinY;
+    int   MaxX;
+    int   MaxY;
+
+    vec2  Origin;
+    vec2  XAxis;
+    vec2  YAxis;
+
+    vec2  InvXAxis;
+    vec2  InvYAxis;
+};
+
+layout(set = 0, binding = 0) readonly buffer Commands
+{
+    raster_command CommandBuffer[];
+};
+
+// NOTE: Raw 32 bit view of the target, so pixels are stored
+// exactly like the CPU writes them into the ColorBuffer
+layout(set = 0, binding = 1, r32ui) uniform uimage2D Target;
+
+layout(push_constant) uniform Constants
+{
+    uint CommandCount;
+};
+
+// NOTE: One bit per command of the current batch that touches this tile
+shared uint TileMask[RASTER_BATCH / 32];
+
+// NOTE: Same steps as RasterCircle in display.cpp. DrawPixel skips
+// the first row and column and zero length spans are not drawn.
+bool
+CircleCovers(raster_command Command, ivec2 P, bool Filled)
+{
+    if(P.x <= 0 || P.y <= 0)
+    {
+        return false;
+    }
+
+    ivec2 D = abs(P - ivec2(Command.Origin));
+    int X = 0;
+    int Y = int(Command.Radius);
+    int d = 3 - 2*Y;
+
+    bool Result = false;
+    while(true)
+    {
+        // NOTE: Y goes below zero for radius 0
+        int AbsY = abs(Y);
+        if(Filled)
+        {
+            Result = Result || ((D.y == AbsY) && (X > 0) && (D.x <= X));
+            Result = Result || ((D.y == X) && (AbsY > 0) && (D.x <= AbsY));
+        }
+        else
+        {
+            Result = Result || ((D.x == X) && (D.y == AbsY));
+            Result = Result || ((D.x == AbsY) && (D.y == X));
+        }
+
+        if(Result || (X > Y))
+        {
+            break;
+        }
+
+        if(d <= 0)
+        {
+            d = d + 4*X + 6;
+        }
+        else
+        {
+            d = d + 4*X - 4*Y + 10;
+            Y--;
+        }
+        X++;
+    }
+
+    return Result;
+}
+
+bool
+Covers(raster_command Command, ivec2 P)
+{
+    bool Result = false;
+    switch(Command.Type)
+    {
+        case RasterCommand_Clear:
+        case RasterCommand_Rect:
+        {
+            Result = true;
+        } break;
+        case RasterCommand_RotRect:
+        {
+            // NOTE: precise keeps the compiler from fusing these into fma,
+            // the CPU rounds after every multiply and add
+            precise vec2 D = vec2(P) - Command.Origin;
+            precise float U = D.x*Command.InvXAxis.x + D.y*Command.InvXAxis.y;
+            precise float V = D.x*Command.InvYAxis.x + D.y*Command.InvYAxis.y;
+            Result = (U >= 0) && (U <= 1) && (V >= 0) && (V <= 1);
+        } break;
+        case RasterCommand_Circle:
+        {
+            Result = CircleCovers(Command, P, false);
+        } break;
+        case RasterCommand_FilledCircle:
+        {
+            Result = CircleCovers(Command, P, true);
+        } break;
+    }
+
+    return Result;
+}
+
+void main()
+{
+    ivec2 Size = imageSize(Target);
+    ivec2 P = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 TileMin = ivec2(gl_WorkGroupID.xy) * TILE_SIZE;
+    ivec2 TileMax = TileMin + TILE_SIZE;
+    bool Inside = all(lessThan(P, Size));
+
+    // NOTE: Pixels that are not covered keep what is already in the target
+    uint Color = 0;
+    if(Inside)
+    {
+        Color = imageLoad(Target, P).x;
+    }
+
+    for(uint Base = 0; Base < CommandCount; Base += RASTER_BATCH)
+    {
+        if(gl_LocalInvocationIndex < (RASTER_BATCH / 32))
+        {
+            TileMask[gl_LocalInvocationIndex] = 0;
+        }
+        barrier();
+
+        // NOTE: Every invocation bins one command of the batch against the tile
+        uint Index = Base + gl_LocalInvocationIndex;
+        if(Index < CommandCount)
+        {
+            raster_command Command = CommandBuffer[Index];
+            ivec2 Min = max(ivec2(Command.MinX, Command.MinY), ivec2(0));
+            ivec2 Max = min(ivec2(Command.MaxX, Command.MaxY), Size);
+            if(all(lessThan(Min, TileMax)) && all(lessThan(TileMin, Max)) && all(lessThan(Min, Max)))
+            {
+                atomicOr(TileMask[gl_LocalInvocationIndex / 32], 1u << (gl_LocalInvocationIndex % 32));
+            }
+        }
+        barrier();
+
+        // NOTE: Bits are walked from the lowest one, so the commands
+        // are still applied in the order they were pushed
+        if(Inside)
+        {
+            for(uint Word = 0; Word < (RASTER_BATCH / 32); ++Word)
+            {
+                uint Bits = TileMask[Word];
+                while(Bits != 0)
+                {
+                    uint Bit = uint(findLSB(Bits));
+                    Bits &= Bits - 1;
+
+                    raster_command Command = CommandBuffer[Base + Word*32 + Bit];
+                    ivec2 Min = max(ivec2(Command.MinX, Command.MinY), ivec2(0));
+                    ivec2 Max = min(ivec2(Command.MaxX, Command.MaxY), Size);
+                    if(all(greaterThanEqual(P, Min)) && all(lessThan(P, Max)) && Covers(Command, P))
+                    {
+                        Color = Command.Color;
+                    }
+                }
+            }
+        }
+        barrier();
+    }
+
+    if(Inside)
+    {
+        imageStore(Target, P, uvec4(Color, 0, 0, 0));
+    }
+}
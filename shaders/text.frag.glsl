@@ -0,0 +1,40 @@
+#version 430
+#extension GL_GOOGLE_include_directive : require
+
+#include "variants.glsl"
+
+#define MAX_BINDLESS_RESOURCES 16
+
+layout(set = 0, binding = 1) uniform sampler2D Textures[MAX_BINDLESS_RESOURCES];
+
+layout(push_constant) uniform Constants
+{
+    layout(offset = 124) uint TextureIndex;
+};
+
+// NOTE: Same outputs as quad.vert.glsl, the shape ones are not used
+layout(location = 0) in vec2 InUV;
+layout(location = 1) in vec4 InColor;
+layout(location = 0) out vec4 OutColor;
+
+void main()
+{
+	// NOTE: The alpha of the glyph atlas is 0.5 on the edge of the glyph.
+	// The edge is one pixel wide at any size, fwidth is how much the
+	// distance changes from one pixel to the next.
+	float Distance = texture(Textures[TextureIndex], InUV).a;
+	float Width = max(fwidth(Distance), 1e-4);
+	float Coverage = clamp((Distance - 0.5) / Width + 0.5, 0.0, 1.0);
+
+	vec4 Color = vec4(InColor.rgb, InColor.a*Coverage);
+	if(DebugView == DebugView_UV)
+	{
+		Color.rgb = vec3(InUV, 0);
+	}
+	else if(DebugView == DebugView_Alpha)
+	{
+		Color = vec4(vec3(Distance), 1);
+	}
+
+	OutColor = Color;
+}
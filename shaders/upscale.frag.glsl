@@ -0,0 +1,52 @@
+#version 430
+#extension GL_GOOGLE_include_directive : require
+
+#include "variants.glsl"
+
+#define MAX_BINDLESS_RESOURCES 16
+
+layout(set = 0, binding = 1) uniform sampler2D Textures[MAX_BINDLESS_RESOURCES];
+
+layout(push_constant) uniform Constants
+{
+    layout(offset = 124) uint TextureIndex;
+};
+
+layout(location = 0) in  vec2 InUV;
+layout(location = 0) out vec4 OutColor;
+
+// NOTE: Sharp bilinear. Every source texel is scaled up by the largest
+// whole factor with nearest filtering, only the remaining fraction of a
+// pixel at its edges is blended with the neighbour. Edges stay crisp at
+// any output size without the uneven texel widths of plain nearest.
+vec4
+SampleSharp(sampler2D Texture, vec2 UV)
+{
+    vec2 SourceSize = vec2(textureSize(Texture, 0));
+    vec2 Texel = UV*SourceSize;
+
+    // NOTE: The layer covers the target, so the screen pixels
+    // per texel are the same everywhere
+    vec2 Scale = max(floor(1.0 / fwidth(Texel) + 0.01), vec2(1.0));
+
+    vec2 Region = 0.5 - 0.5 / Scale;
+    vec2 CenterDistance = fract(Texel) - 0.5;
+    vec2 Offset = (CenterDistance - clamp(CenterDistance, -Region, Region))*Scale + 0.5;
+
+    return textureLod(Texture, (floor(Texel) + Offset) / SourceSize, 0);
+}
+
+void main()
+{
+	vec4 Color = SampleSharp(Textures[TextureIndex], InUV);
+	if(DebugView == DebugView_UV)
+	{
+		Color = vec4(InUV, 0, 1);
+	}
+	else if(DebugView == DebugView_Alpha)
+	{
+		Color = vec4(Color.aaa, 1);
+	}
+
+	OutColor = Color;
+}
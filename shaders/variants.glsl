@@ -0,0 +1,9 @@
+// NOTE: Included by every fragment shader, same constant_ids as the
+// spec_constant enum in vulkan_renderer.h. Every pipeline only keeps
+// the branches of its variant.
+
+#define DebugView_None  0
+#define DebugView_UV    1
+#define DebugView_Alpha 2
+
+layout(constant_id = 0) const uint DebugView = DebugView_None;